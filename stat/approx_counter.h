@@ -175,6 +175,18 @@ class ApproxCounter {
   const absl::Duration kInterval;
   const absl::Duration kSpanLength = kInterval / kSpansPerInterval;
 
+  friend class ConcurrentApproxCounter;
+
+  // A copy of the state of another counter, see ConcurrentApproxCounter.
+  ApproxCounter(const absl::Duration interval,
+                const std::array<int64_t, kSpansPerInterval>& span_bytes,
+                int64_t cur_span, int64_t cur_span_bytes)
+      : kInterval(interval),
+        span_bytes_(span_bytes),
+        cur_span_(cur_span),
+        cur_span_end_(kStartTime + (cur_span + 1) * kSpanLength),
+        cur_span_bytes_(cur_span_bytes) {}
+
   // Bytes transferred during a span of time.
   // The data in span_bytes_ array is a circular buffer with
   // SpanAt(cur_span_) pointing at the oldest span.
@@ -0,0 +1,153 @@
+#ifndef MOGO_EXP_STAT_CONCURRENT_APPROX_COUNTER_H_
+#define MOGO_EXP_STAT_CONCURRENT_APPROX_COUNTER_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "absl/base/config.h"
+#include "absl/log/check.h"
+#include "absl/time/time.h"
+#include "approx_counter.h"
+#include "stat_utils.h"
+
+namespace mogo {
+
+/* ApproxCounter for one thread that records and any number of threads that
+ * read, e.g. an I/O thread counting bytes and control threads polling
+ * GetBytesPerSecond.
+ *
+ * Thread-safe for a single writer: RecordRequest must not be called
+ * concurrently with itself, the getters can be called from any thread.
+ *
+ * Same spans and same results as ApproxCounter. The writer never waits and
+ * never does an atomic read-modify-write:
+ *  - Within a span RecordRequest adds to the current span's bytes, a plain
+ *    load and store of a value only the writer changes, as ApproxCounter.
+ *  - Moving to a new span, once per 1/16th of the interval, publishes the new
+ *    span under a sequence lock: the sequence is odd while the spans change.
+ *
+ * Readers copy the spans, the current span number and its bytes, and retry if
+ * the sequence changed or was odd meanwhile. Adding to the current span
+ * doesn't change the sequence, a reader that sees the new bytes sees the
+ * counter as it was a few requests later. Readers never write to the counter,
+ * but they do pull in the writer's cache line.
+ * */
+class ConcurrentApproxCounter {
+ public:
+  ConcurrentApproxCounter(absl::Time now, const absl::Duration interval)
+      : kInterval(interval) {
+    const int64_t cur_span = (now - kStartTime) / kSpanLength;
+    cur_span_.store(cur_span, std::memory_order_relaxed);
+    cur_span_end_ = kStartTime + (cur_span + 1) * kSpanLength;
+  }
+
+  explicit ConcurrentApproxCounter(absl::Time now)
+      : ConcurrentApproxCounter(now, absl::Seconds(1)) {}
+
+  ConcurrentApproxCounter(const ConcurrentApproxCounter&) = delete;
+  ConcurrentApproxCounter& operator=(const ConcurrentApproxCounter&) = delete;
+
+  // Single writer.
+  void RecordRequest(int64_t len, absl::Time now) {
+    if (now < cur_span_end_) {
+      // Release orders the store after the last span change, see Snapshot.
+      cur_span_bytes_.store(
+          cur_span_bytes_.load(std::memory_order_relaxed) + len,
+          std::memory_order_release);
+      return;
+    }
+    NextSpan(len, now);
+  }
+
+  double GetBytesPerSecond(absl::Time now) const {
+    return Snapshot().GetBytesPerSecond(now);
+  }
+
+  double GetBytesPerInterval(absl::Time now) const {
+    return Snapshot().GetBytesPerInterval(now);
+  }
+
+  // A consistent copy of the counter.
+  ApproxCounter Snapshot() const {
+    std::array<int64_t, kSpansPerInterval> span_bytes;
+    int64_t cur_span;
+    int64_t cur_span_bytes;
+    while (true) {
+      const uint64_t seq = seq_.load(std::memory_order_acquire);
+      if (seq & 1) {
+        continue;
+      }
+      for (int i = 0; i < kSpansPerInterval; ++i) {
+        span_bytes[i] = span_bytes_[i].load(std::memory_order_relaxed);
+      }
+      cur_span = cur_span_.load(std::memory_order_relaxed);
+      cur_span_bytes = cur_span_bytes_.load(std::memory_order_relaxed);
+      // Keeps the loads above before the second sequence load. If any of them
+      // saw a store made after `seq`, the load below sees the new sequence.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == seq) {
+        break;
+      }
+    }
+    return ApproxCounter(kInterval, span_bytes, cur_span, cur_span_bytes);
+  }
+
+ private:
+  static constexpr int kSpansPerInterval = ApproxCounter::kSpansPerInterval;
+  static constexpr absl::Time kStartTime = ApproxCounter::kStartTime;
+
+  // The slow path of RecordRequest, same steps as ApproxCounter.
+  void NextSpan(int64_t len, absl::Time now) {
+    int64_t cur_span = cur_span_.load(std::memory_order_relaxed);
+    const int64_t new_span = (now - kStartTime) / kSpanLength;
+    DCHECK(new_span > cur_span);
+
+    const uint64_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    // Keeps the stores below after the odd sequence.
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (new_span - cur_span > kSpansPerInterval + 1) {
+      // Enough time has passed to obliterate our history, reset.
+      cur_span = new_span;
+      for (std::atomic<int64_t>& bytes : span_bytes_) {
+        bytes.store(0, std::memory_order_relaxed);
+      }
+    } else {
+      // Drop the current value into the storage overwriting the oldest value,
+      // zero the spans with no data.
+      SpanAt(cur_span).store(cur_span_bytes_.load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+      while (++cur_span < new_span) {
+        SpanAt(cur_span).store(0, std::memory_order_relaxed);
+      }
+    }
+    cur_span_.store(cur_span, std::memory_order_relaxed);
+    cur_span_end_ = kStartTime + (cur_span + 1) * kSpanLength;
+    cur_span_bytes_.store(len, std::memory_order_relaxed);
+
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  std::atomic<int64_t>& SpanAt(int64_t index) {
+    return span_bytes_[PositiveModulo<kSpansPerInterval>(index)];
+  }
+
+  const absl::Duration kInterval;
+  const absl::Duration kSpanLength = kInterval / kSpansPerInterval;
+
+  // Only the writer uses it, see ApproxCounter::cur_span_end_.
+  absl::Time cur_span_end_;
+
+  // Odd while the writer moves to a new span.
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<uint64_t> seq_{0};
+  // See ApproxCounter.
+  std::atomic<int64_t> cur_span_bytes_{0};
+  std::atomic<int64_t> cur_span_{0};
+  std::array<std::atomic<int64_t>, kSpansPerInterval> span_bytes_ = {};
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_STAT_CONCURRENT_APPROX_COUNTER_H_
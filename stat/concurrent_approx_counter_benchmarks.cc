@@ -0,0 +1,139 @@
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "approx_counter.h"
+#include "benchmark/benchmark.h"
+#include "concurrent_approx_counter.h"
+
+/*
+sudo cpufreq-set -g performance
+
+bazel test -c opt --dynamic_mode=off --test_output=streamed \
+  --cache_test_results=no stat:concurrent_approx_counter_benchmarks \
+  --test_arg=--benchmark_filter=all \
+  --test_arg=--benchmark_repetitions=1 \
+  --test_arg=--benchmark_enable_random_interleaving=false
+
+sudo cpufreq-set -g powersave
+
+The benchmark thread is the writer, it records a request every kStep of a
+synthetic clock, a new span starts every 62500 requests. The argument is the
+number of reader threads that call GetBytesPerSecond in a loop meanwhile. The
+reported time is the writer's CPU time per request, compare it across reader
+counts and with the mutex-protected ApproxCounter readers used to need. Run
+on a machine with a spare core per reader.
+*/
+
+namespace mogo {
+namespace {
+
+constexpr absl::Duration kStep = absl::Microseconds(1);
+
+// Calls `read` in a loop on `count` threads until destroyed.
+template <typename Read>
+class Readers {
+ public:
+  Readers(int count, Read read) {
+    for (int i = 0; i < count; ++i) {
+      threads_.emplace_back([this, read] {
+        int64_t reads = 0;
+        while (!done_.load(std::memory_order_relaxed)) {
+          benchmark::DoNotOptimize(read());
+          ++reads;
+        }
+        reads_.fetch_add(reads, std::memory_order_relaxed);
+      });
+    }
+  }
+
+  // Stops the readers, returns the number of reads.
+  int64_t Stop() {
+    done_ = true;
+    for (std::thread& t : threads_) {
+      t.join();
+    }
+    threads_.clear();
+    return reads_.load(std::memory_order_relaxed);
+  }
+
+  ~Readers() { Stop(); }
+
+ private:
+  std::atomic<bool> done_{false};
+  std::atomic<int64_t> reads_{0};
+  std::vector<std::thread> threads_;
+};
+
+template <typename Read>
+Readers(int, Read) -> Readers<Read>;
+
+void BM_ApproxCounterRecord(benchmark::State& state) {
+  absl::Time now = absl::UnixEpoch();
+  ApproxCounter counter(now);
+  for (auto s : state) {
+    counter.RecordRequest(4096, now);
+    now += kStep;
+  }
+  benchmark::DoNotOptimize(counter.GetBytesPerSecond(now));
+}
+BENCHMARK(BM_ApproxCounterRecord);
+
+void BM_ConcurrentApproxCounterRecord(benchmark::State& state) {
+  const absl::Time start = absl::UnixEpoch();
+  absl::Time now = start;
+  ConcurrentApproxCounter counter(now);
+  // Readers look at the counter at the start time, that's all they need to
+  // copy it.
+  Readers readers(state.range(0),
+                  [&] { return counter.GetBytesPerSecond(start); });
+  for (auto s : state) {
+    counter.RecordRequest(4096, now);
+    now += kStep;
+  }
+  state.counters["reads"] = benchmark::Counter(
+      readers.Stop(), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_ConcurrentApproxCounterRecord)
+    ->ArgName("readers")
+    ->DenseRange(0, 4);
+
+void BM_MutexApproxCounterRecord(benchmark::State& state) {
+  const absl::Time start = absl::UnixEpoch();
+  absl::Time now = start;
+  absl::Mutex mu;
+  ApproxCounter counter(now);
+  Readers readers(state.range(0), [&] {
+    absl::MutexLock l(&mu);
+    return counter.GetBytesPerSecond(start);
+  });
+  for (auto s : state) {
+    absl::MutexLock l(&mu);
+    counter.RecordRequest(4096, now);
+    now += kStep;
+  }
+  state.counters["reads"] = benchmark::Counter(
+      readers.Stop(), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_MutexApproxCounterRecord)
+    ->ArgName("readers")
+    ->DenseRange(0, 4);
+
+void BM_ConcurrentApproxCounterRead(benchmark::State& state) {
+  absl::Time now = absl::UnixEpoch();
+  ConcurrentApproxCounter counter(now);
+  for (int i = 0; i < 1000000; ++i) {
+    counter.RecordRequest(4096, now);
+    now += kStep;
+  }
+  for (auto s : state) {
+    benchmark::DoNotOptimize(counter.GetBytesPerSecond(now));
+  }
+}
+BENCHMARK(BM_ConcurrentApproxCounterRead);
+
+}  // namespace
+}  // namespace mogo
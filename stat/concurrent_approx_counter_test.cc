@@ -0,0 +1,91 @@
+/*
+bazel test stat:concurrent_approx_counter_test --test_output=streamed
+*/
+
+#include "concurrent_approx_counter.h"
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "absl/time/time.h"
+#include "approx_counter.h"
+#include "gtest/gtest.h"
+
+namespace mogo {
+namespace {
+
+TEST(ConcurrentApproxCounterTest, SameAsApproxCounter) {
+  absl::BitGen gen;
+  absl::Time now = absl::UnixEpoch() + absl::Hours(1);
+  ApproxCounter expected(now);
+  ConcurrentApproxCounter counter(now);
+  for (int i = 0; i < 100000; ++i) {
+    // Mostly small steps, sometimes past a span, sometimes past the interval.
+    const double step_ms = absl::Bernoulli(gen, 0.001)
+                               ? absl::Uniform(gen, 0.0, 3000.0)
+                               : absl::Exponential(gen, 1.0);
+    now += absl::Milliseconds(step_ms);
+    const int64_t len = absl::Uniform(gen, 0, 64 * 1024);
+    expected.RecordRequest(len, now);
+    counter.RecordRequest(len, now);
+    for (absl::Duration ahead : {absl::ZeroDuration(), absl::Milliseconds(30),
+                                 absl::Milliseconds(700)}) {
+      ASSERT_EQ(expected.GetBytesPerInterval(now + ahead),
+                counter.GetBytesPerInterval(now + ahead));
+    }
+  }
+  EXPECT_EQ(expected.ToDebugString(), counter.Snapshot().ToDebugString());
+}
+
+// The writer records `k` bytes in span `k`, in two requests, and moves one span
+// at a time. A consistent snapshot has consecutive numbers in the spans and
+// either half or all of the next number in the current span.
+TEST(ConcurrentApproxCounterTest, ReadersSeeConsistentSpans) {
+  constexpr absl::Duration kInterval = absl::Seconds(16);
+  constexpr absl::Duration kSpan = absl::Seconds(1);
+  constexpr int64_t kFirstSpan = 1000;
+  constexpr int64_t kSpans = 200000;
+  ConcurrentApproxCounter counter(absl::UnixEpoch() + kFirstSpan * kSpan,
+                                  kInterval);
+  std::atomic<bool> done{false};
+  std::atomic<int64_t> snapshots{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&] {
+      while (!done.load(std::memory_order_relaxed)) {
+        std::istringstream ss(counter.Snapshot().ToDebugString());
+        std::vector<int64_t> spans(17);
+        for (int64_t& bytes : spans) {
+          ss >> bytes;
+        }
+        for (int i = 0; i + 1 < 16; ++i) {
+          if (spans[i] != 0) {
+            ASSERT_EQ(spans[i] + 1, spans[i + 1]) << ss.str();
+          }
+        }
+        if (spans[15] != 0) {
+          const int64_t cur = spans[15] + 1;
+          ASSERT_TRUE(spans[16] == cur / 2 || spans[16] == cur) << ss.str();
+        }
+        snapshots.fetch_add(1, std::memory_order_relaxed);
+      }
+    });
+  }
+  for (int64_t k = kFirstSpan; k < kFirstSpan + kSpans; ++k) {
+    const absl::Time start = absl::UnixEpoch() + k * kSpan;
+    counter.RecordRequest(k / 2, start);
+    counter.RecordRequest(k - k / 2, start + kSpan / 2);
+  }
+  done = true;
+  for (std::thread& t : readers) {
+    t.join();
+  }
+  EXPECT_GT(snapshots.load(), 0);
+}
+
+}  // namespace
+}  // namespace mogo
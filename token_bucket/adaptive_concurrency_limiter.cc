@@ -0,0 +1,199 @@
+#include "token_bucket/adaptive_concurrency_limiter.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "absl/log/check.h"
+#include "absl/time/time.h"
+#include "perf/cycle_clock_utils.h"
+#include "perf/time_histogram.h"
+
+namespace mogo {
+
+AdaptiveConcurrencyLimiter::AdaptiveConcurrencyLimiter(int64_t now_cycles,
+                                                       const Options& options)
+    : options_(options),
+      update_interval_cycles_(DurationToCycles(options.update_interval)),
+      min_rtt_interval_cycles_(DurationToCycles(options.min_rtt_interval)),
+      limit_(options.initial_limit),
+      next_update_cycles_(now_cycles + update_interval_cycles_),
+      exact_limit_(options.initial_limit),
+      next_probe_cycles_(now_cycles + min_rtt_interval_cycles_),
+      latency_(/*cycles_min=*/DurationToCycles(absl::Microseconds(1)),
+               /*cycles_step1=*/DurationToCycles(absl::Microseconds(1))) {
+  CHECK_GE(options_.min_limit, 1);
+  CHECK_LE(options_.min_limit, options_.initial_limit);
+  CHECK_LE(options_.initial_limit, options_.max_limit);
+  CHECK_GT(update_interval_cycles_, 0);
+  CHECK_GE(options_.probe_limit, 1);
+}
+
+int AdaptiveConcurrencyLimiter::RttBucket(int64_t rtt_cycles) {
+  // Bucket `b` holds the RTTs in [2^(b-1), 2^b).
+  return std::min(internal::Fls64(std::max<int64_t>(rtt_cycles, 0)),
+                  kBucketCount - 1);
+}
+
+void AdaptiveConcurrencyLimiter::OnComplete(int64_t start_cycles,
+                                            int64_t now_cycles) {
+  const int64_t rtt = now_cycles - start_cycles;
+  window_buckets_[RttBucket(rtt)].fetch_add(1, std::memory_order_relaxed);
+  int64_t min_rtt = window_min_rtt_.load(std::memory_order_relaxed);
+  while (rtt < min_rtt && !window_min_rtt_.compare_exchange_weak(
+                              min_rtt, rtt, std::memory_order_relaxed)) {
+  }
+  latency_.AddSample(rtt);
+  in_flight_.fetch_sub(1, std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(
+          now_cycles >= next_update_cycles_.load(std::memory_order_relaxed))) {
+    MaybeUpdate(now_cycles);
+  }
+}
+
+void AdaptiveConcurrencyLimiter::OnDropped(int64_t now_cycles) {
+  window_drops_.fetch_add(1, std::memory_order_relaxed);
+  in_flight_.fetch_sub(1, std::memory_order_relaxed);
+  if (ABSL_PREDICT_FALSE(
+          now_cycles >= next_update_cycles_.load(std::memory_order_relaxed))) {
+    MaybeUpdate(now_cycles);
+  }
+}
+
+int64_t AdaptiveConcurrencyLimiter::Quantile(
+    const std::array<int64_t, kBucketCount>& buckets, int64_t count,
+    double quantile) {
+  const double rank = quantile * count;
+  int64_t running = 0;
+  for (int b = 0; b < kBucketCount; ++b) {
+    if (buckets[b] == 0) {
+      continue;
+    }
+    if (running + buckets[b] >= rank) {
+      const double low = b == 0 ? 0 : std::ldexp(1.0, b - 1);
+      const double high = std::ldexp(1.0, b);
+      return static_cast<int64_t>(low + (high - low) * (rank - running) /
+                                            buckets[b]);
+    }
+    running += buckets[b];
+  }
+  return std::numeric_limits<int64_t>::max();
+}
+
+int64_t AdaptiveConcurrencyLimiter::TakeWindow(
+    std::array<int64_t, kBucketCount>& buckets, int64_t& min_rtt) {
+  int64_t count = 0;
+  for (int b = 0; b < kBucketCount; ++b) {
+    buckets[b] = window_buckets_[b].exchange(0, std::memory_order_relaxed);
+    count += buckets[b];
+  }
+  min_rtt = window_min_rtt_.exchange(std::numeric_limits<int64_t>::max(),
+                                     std::memory_order_relaxed);
+  return count;
+}
+
+void AdaptiveConcurrencyLimiter::Probe(int64_t now_cycles) {
+  std::array<int64_t, kBucketCount> buckets;
+  int64_t min_rtt;
+  if (!probe_drained_) {
+    if (in_flight_.load(std::memory_order_relaxed) > options_.probe_limit) {
+      return;
+    }
+    // Only the RTTs from here on are at the probe limit.
+    TakeWindow(buckets, min_rtt);
+    probe_drained_ = true;
+    return;
+  }
+  int64_t count = 0;
+  for (const std::atomic<int64_t>& b : window_buckets_) {
+    count += b.load(std::memory_order_relaxed);
+  }
+  if (count < options_.min_rtt_samples) {
+    return;
+  }
+  TakeWindow(buckets, min_rtt);
+  min_rtt_ = min_rtt;
+  probing_ = false;
+  window_drops_.store(0, std::memory_order_relaxed);
+  peak_in_flight_.store(in_flight_.load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+  limit_.store(static_cast<int64_t>(exact_limit_), std::memory_order_relaxed);
+  next_probe_cycles_ = now_cycles + min_rtt_interval_cycles_;
+  next_update_cycles_.store(now_cycles + update_interval_cycles_,
+                            std::memory_order_relaxed);
+}
+
+void AdaptiveConcurrencyLimiter::MaybeUpdate(int64_t now_cycles) {
+  if (updating_.exchange(true, std::memory_order_acquire)) {
+    return;
+  }
+  // Another thread may have updated the limit in the meantime.
+  if (now_cycles < next_update_cycles_.load(std::memory_order_relaxed)) {
+    updating_.store(false, std::memory_order_release);
+    return;
+  }
+  if (probing_) {
+    Probe(now_cycles);
+    updating_.store(false, std::memory_order_release);
+    return;
+  }
+  int64_t count = 0;
+  for (const std::atomic<int64_t>& b : window_buckets_) {
+    count += b.load(std::memory_order_relaxed);
+  }
+  const int64_t drops = window_drops_.load(std::memory_order_relaxed);
+  if (count + drops < options_.min_samples) {
+    // Too few samples to tell, keep collecting.
+    updating_.store(false, std::memory_order_release);
+    return;
+  }
+
+  std::array<int64_t, kBucketCount> buckets;
+  int64_t window_min_rtt;
+  count = TakeWindow(buckets, window_min_rtt);
+  window_drops_.fetch_sub(drops, std::memory_order_relaxed);
+  const int64_t peak_in_flight = peak_in_flight_.exchange(
+      in_flight_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  if (min_rtt_ == 0 && count > 0) {
+    // Before the first probe the RTTs at the initial limit stand in.
+    min_rtt_ = window_min_rtt;
+  }
+
+  if (drops > 0) {
+    // Back off right away, not smoothed.
+    exact_limit_ *= options_.backoff_ratio;
+  } else if (count > 0) {
+    const double sample_rtt = Quantile(buckets, count, options_.rtt_quantile);
+    const double gradient = std::clamp(
+        options_.tolerance * min_rtt_ / std::max(sample_rtt, 1.0), 0.5, 1.0);
+    double new_limit = exact_limit_ * gradient + std::sqrt(exact_limit_);
+    if (new_limit > exact_limit_ && peak_in_flight < exact_limit_ / 2) {
+      // The limit isn't what holds the requests back.
+      new_limit = exact_limit_;
+    }
+    exact_limit_ = (1 - options_.smoothing) * exact_limit_ +
+                   options_.smoothing * new_limit;
+  }
+  exact_limit_ = std::clamp(exact_limit_, double(options_.min_limit),
+                            double(options_.max_limit));
+
+  if (now_cycles >= next_probe_cycles_) {
+    // Every completion checks whether the probe can go on.
+    probing_ = true;
+    probe_drained_ = false;
+    limit_.store(std::min(options_.probe_limit, options_.max_limit),
+                 std::memory_order_relaxed);
+    next_update_cycles_.store(now_cycles, std::memory_order_relaxed);
+  } else {
+    limit_.store(static_cast<int64_t>(exact_limit_),
+                 std::memory_order_relaxed);
+    next_update_cycles_.store(now_cycles + update_interval_cycles_,
+                              std::memory_order_relaxed);
+  }
+  updating_.store(false, std::memory_order_release);
+}
+
+}  // namespace mogo
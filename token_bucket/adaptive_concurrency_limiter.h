@@ -0,0 +1,176 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_ADAPTIVE_CONCURRENCY_LIMITER_H
+#define MOGO_EXP_TOKEN_BUCKET_ADAPTIVE_CONCURRENCY_LIMITER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "perf/time_histogram.h"
+
+namespace mogo {
+
+/*
+AdaptiveConcurrencyLimiter caps the requests in flight to a backend at the
+level that gets the most throughput out of it without inflating the latency,
+instead of a hand-tuned max-in-flight.
+
+Same idea as TCP Vegas: the round trip time at low load, the minimum RTT, is
+the backend's service time. An RTT above it means the requests queue up and the
+concurrency is above what the backend can use. Every `update_interval` the
+limit is updated with the gradient rule of Netflix's concurrency-limits and
+Envoy's adaptive concurrency filter:
+
+  gradient = clamp(tolerance * min_rtt / sample_rtt, 0.5, 1)
+  limit = limit * gradient + sqrt(limit)
+
+The sqrt(limit) term lets the limit probe upwards while the RTT stays close to
+the minimum, the gradient cuts it as soon as the RTT grows. The new limit is
+smoothed and kept between `min_limit` and `max_limit`. A limit that wasn't
+used, fewer than half of it in flight, doesn't grow. Dropped requests
+(timeouts, overload errors) multiply the limit by `backoff_ratio` instead.
+
+The sample RTT is the `rtt_quantile` of the RTTs completed during the update
+interval, taken from log2 buckets like TimeHistogram's. The minimum RTT can't
+be the smallest RTT seen over a sliding window: the rule keeps a small standing
+queue, so under steady load no request sees the bare service time and such a
+minimum creeps up with the queue. Instead, like Envoy, the minimum is measured
+first on the RTTs at the initial limit and then again every
+`min_rtt_interval`: the limit drops to `probe_limit` until the requests in
+flight drain below it and `min_rtt_samples` more completed, the smallest of
+their RTTs is the new minimum. This follows a backend that got slower or faster
+for good. All RTTs also go into a TimeHistogram, see latency().
+
+Permits are handed out with a compare-and-swap on the in-flight count,
+completing a request is a few relaxed atomic adds. The completion that passes
+the end of the update interval updates the limit, other threads never wait for
+it. Time is in CycleClock cycles.
+
+Thread-safe.
+*/
+class AdaptiveConcurrencyLimiter {
+ public:
+  struct Options {
+    int64_t initial_limit = 20;
+    int64_t min_limit = 1;
+    int64_t max_limit = 1000;
+    // The RTT is allowed to grow by this factor before the limit decreases.
+    double tolerance = 1.25;
+    double rtt_quantile = 0.5;
+    // How much of the new limit is taken on every update.
+    double smoothing = 0.2;
+    double backoff_ratio = 0.9;
+    absl::Duration update_interval = absl::Milliseconds(100);
+    // The limit isn't updated until this many requests completed since the
+    // last update.
+    int64_t min_samples = 10;
+    // How often the minimum RTT is measured again.
+    absl::Duration min_rtt_interval = absl::Seconds(30);
+    // The limit while the minimum RTT is measured.
+    int64_t probe_limit = 3;
+    int64_t min_rtt_samples = 50;
+  };
+
+  AdaptiveConcurrencyLimiter(int64_t now_cycles, const Options& options);
+
+  AdaptiveConcurrencyLimiter(const AdaptiveConcurrencyLimiter&) = delete;
+  AdaptiveConcurrencyLimiter& operator=(const AdaptiveConcurrencyLimiter&) =
+      delete;
+
+  // Takes a permit for a request. Returns false if the limit is reached, the
+  // request should be rejected or queued. Every permit taken is returned with
+  // OnComplete or OnDropped.
+  bool TryAcquire() {
+    int64_t in_flight = in_flight_.load(std::memory_order_relaxed);
+    while (true) {
+      if (in_flight >= limit_.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      if (ABSL_PREDICT_TRUE(in_flight_.compare_exchange_weak(
+              in_flight, in_flight + 1, std::memory_order_relaxed))) {
+        break;
+      }
+    }
+    // Approximate, a lost update only underestimates the peak.
+    if (in_flight + 1 > peak_in_flight_.load(std::memory_order_relaxed)) {
+      peak_in_flight_.store(in_flight + 1, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  // Returns the permit of a request that started at `start_cycles` and
+  // completed at `now_cycles`.
+  void OnComplete(int64_t start_cycles, int64_t now_cycles);
+
+  // Returns the permit of a request that failed because of the backend's load.
+  void OnDropped(int64_t now_cycles);
+
+  int64_t limit() const { return limit_.load(std::memory_order_relaxed); }
+  int64_t in_flight() const {
+    return in_flight_.load(std::memory_order_relaxed);
+  }
+
+  // All RTTs, in cycles.
+  const TimeHistogram& latency() const { return latency_; }
+
+  template <typename Sink>
+  friend void AbslStringify(Sink& sink, const AdaptiveConcurrencyLimiter& l) {
+    absl::Format(&sink, "{AdaptiveConcurrencyLimiter limit: %d, in_flight: %d}",
+                 l.limit(), l.in_flight());
+  }
+
+ private:
+  static constexpr int kBucketCount = 64;
+
+  static int RttBucket(int64_t rtt_cycles);
+
+  // Called by the completion that passes `next_update_cycles_`.
+  void MaybeUpdate(int64_t now_cycles);
+
+  // Called with `updating_` held while the minimum RTT is measured.
+  void Probe(int64_t now_cycles);
+
+  // Takes the window counters, returns the number of RTTs in `buckets`.
+  int64_t TakeWindow(std::array<int64_t, kBucketCount>& buckets,
+                     int64_t& min_rtt);
+
+  // The RTT at `quantile` of the window buckets, interpolated in the bucket.
+  static int64_t Quantile(const std::array<int64_t, kBucketCount>& buckets,
+                          int64_t count, double quantile);
+
+  const Options options_;
+  const int64_t update_interval_cycles_;
+  const int64_t min_rtt_interval_cycles_;
+
+  alignas(ABSL_CACHELINE_SIZE) std::atomic<int64_t> in_flight_{0};
+  std::atomic<int64_t> limit_;
+  std::atomic<int64_t> peak_in_flight_{0};
+
+  // The RTTs completed since the last update.
+  alignas(ABSL_CACHELINE_SIZE)
+      std::array<std::atomic<int64_t>, kBucketCount> window_buckets_ = {};
+  std::atomic<int64_t> window_min_rtt_{
+      std::numeric_limits<int64_t>::max()};
+  std::atomic<int64_t> window_drops_{0};
+  std::atomic<int64_t> next_update_cycles_;
+  // Taken by the thread that updates the limit.
+  std::atomic<bool> updating_{false};
+
+  // Owned by the thread that holds `updating_`.
+  double exact_limit_;
+  // 0 until the first update.
+  int64_t min_rtt_ = 0;
+  int64_t next_probe_cycles_;
+  bool probing_ = false;
+  // The requests in flight before the probe have drained.
+  bool probe_drained_ = false;
+
+  TimeHistogram latency_;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_ADAPTIVE_CONCURRENCY_LIMITER_H
@@ -0,0 +1,170 @@
+/*
+bazel test token_bucket:adaptive_concurrency_limiter_test
+*/
+
+#include "token_bucket/adaptive_concurrency_limiter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "perf/cycle_clock_utils.h"
+
+namespace mogo {
+namespace {
+
+struct SimulationResult {
+  int64_t limit;
+  absl::Duration mean_rtt;
+  double throughput;
+};
+
+// A backend that serves `capacity` requests in parallel in `base_rtt`, more
+// requests queue up and take proportionally longer. The clients always have
+// more requests than the limit lets through.
+SimulationResult Simulate(AdaptiveConcurrencyLimiter& l, int64_t now,
+                          int64_t capacity, int64_t base_rtt,
+                          int64_t duration) {
+  // Completion time and start time of the requests in flight.
+  using Request = std::pair<int64_t, int64_t>;
+  std::priority_queue<Request, std::vector<Request>, std::greater<Request>>
+      in_flight;
+  const int64_t end = now + duration;
+  const int64_t measure_from = now + duration / 2;
+  int64_t completed = 0;
+  int64_t total_rtt = 0;
+  while (now < end) {
+    while (l.TryAcquire()) {
+      const int64_t n = l.in_flight();
+      const int64_t rtt = base_rtt * std::max<int64_t>(n, capacity) / capacity;
+      in_flight.push({now + rtt, now});
+    }
+    const auto [done, start] = in_flight.top();
+    in_flight.pop();
+    now = done;
+    l.OnComplete(start, now);
+    if (now > measure_from) {
+      ++completed;
+      total_rtt += now - start;
+    }
+  }
+  // Return the permits still out, the next simulation starts from scratch.
+  while (!in_flight.empty()) {
+    l.OnComplete(in_flight.top().second, in_flight.top().first);
+    in_flight.pop();
+  }
+  return {l.limit(),
+          CyclesToDuration(total_rtt / std::max<int64_t>(completed, 1)),
+          completed /
+              absl::ToDoubleSeconds(CyclesToDuration(end - measure_from))};
+}
+
+TEST(AdaptiveConcurrencyLimiterTest, FindsTheBackendCapacity) {
+  const int64_t ms = DurationToCycles(absl::Milliseconds(1));
+  constexpr int64_t kCapacity = 50;
+  AdaptiveConcurrencyLimiter::Options options;
+  options.initial_limit = 5;
+  int64_t now = 1000 * ms;
+  AdaptiveConcurrencyLimiter l(now, options);
+  SimulationResult r =
+      Simulate(l, now, kCapacity, /*base_rtt=*/10 * ms, /*duration=*/60000 * ms);
+  LOG(INFO) << "limit: " << r.limit << " mean_rtt: " << r.mean_rtt
+            << " throughput: " << r.throughput << "\n"
+            << l.latency().ToHumanString();
+  EXPECT_GE(r.limit, kCapacity * 0.8);
+  EXPECT_LE(r.limit, kCapacity * 2);
+  EXPECT_LT(r.mean_rtt, absl::Milliseconds(16));
+  // The backend serves 5000 requests per second at most.
+  EXPECT_GT(r.throughput, 4000);
+}
+
+TEST(AdaptiveConcurrencyLimiterTest, FollowsASlowerBackend) {
+  const int64_t ms = DurationToCycles(absl::Milliseconds(1));
+  AdaptiveConcurrencyLimiter::Options options;
+  options.min_rtt_interval = absl::Seconds(5);
+  int64_t now = 1000 * ms;
+  AdaptiveConcurrencyLimiter l(now, options);
+  SimulationResult r = Simulate(l, now, /*capacity=*/200, /*base_rtt=*/10 * ms,
+                                /*duration=*/60000 * ms);
+  LOG(INFO) << "limit: " << r.limit << " mean_rtt: " << r.mean_rtt;
+  EXPECT_GE(r.limit, 160);
+
+  // The backend lost capacity.
+  now += 60000 * ms;
+  r = Simulate(l, now, /*capacity=*/20, /*base_rtt=*/10 * ms,
+               /*duration=*/60000 * ms);
+  LOG(INFO) << "limit: " << r.limit << " mean_rtt: " << r.mean_rtt;
+  EXPECT_LE(r.limit, 40);
+  EXPECT_LT(r.mean_rtt, absl::Milliseconds(16));
+
+  // Every request takes twice as long. The minimum RTT measured before would
+  // push the limit down to `min_limit`, the probes pick up the new one.
+  now += 60000 * ms;
+  r = Simulate(l, now, /*capacity=*/20, /*base_rtt=*/20 * ms,
+               /*duration=*/60000 * ms);
+  LOG(INFO) << "limit: " << r.limit << " mean_rtt: " << r.mean_rtt;
+  EXPECT_GE(r.limit, 16);
+  EXPECT_LE(r.limit, 40);
+  EXPECT_LT(r.mean_rtt, absl::Milliseconds(32));
+}
+
+TEST(AdaptiveConcurrencyLimiterTest, DropsDecreaseTheLimit) {
+  AdaptiveConcurrencyLimiter::Options options;
+  options.initial_limit = 100;
+  const int64_t interval = DurationToCycles(options.update_interval);
+  int64_t now = 10 * interval;
+  AdaptiveConcurrencyLimiter l(now, options);
+  for (int update = 0; update < 10; ++update) {
+    now += interval;
+    for (int i = 0; i < options.min_samples; ++i) {
+      ASSERT_TRUE(l.TryAcquire());
+      l.OnDropped(now);
+    }
+  }
+  LOG(INFO) << "limit: " << l.limit();
+  // 100 * 0.9^10
+  EXPECT_LT(l.limit(), 40);
+  EXPECT_EQ(0, l.in_flight());
+}
+
+TEST(AdaptiveConcurrencyLimiterTest, NeverAboveTheLimit) {
+  AdaptiveConcurrencyLimiter::Options options;
+  options.initial_limit = 8;
+  options.max_limit = 8;
+  AdaptiveConcurrencyLimiter l(CycleClock::Now(), options);
+  std::atomic<int64_t> in_flight{0};
+  std::atomic<int64_t> max_in_flight{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 16; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 100000; ++i) {
+        if (!l.TryAcquire()) {
+          continue;
+        }
+        const int64_t start = CycleClock::Now();
+        const int64_t n = in_flight.fetch_add(1) + 1;
+        int64_t m = max_in_flight.load();
+        while (n > m && !max_in_flight.compare_exchange_weak(m, n)) {
+        }
+        in_flight.fetch_sub(1);
+        l.OnComplete(start, CycleClock::Now());
+      }
+    });
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  EXPECT_LE(max_in_flight.load(), 8);
+  EXPECT_EQ(0, l.in_flight());
+}
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,54 @@
+#include "token_bucket/adaptive_rate_token_bucket.h"
+
+#include <algorithm>
+
+#include "absl/log/check.h"
+#include "absl/time/time.h"
+
+namespace mogo {
+
+AdaptiveRateTokenBucket::AdaptiveRateTokenBucket(absl::Time now,
+                                                 const Options& options)
+    : options_(options),
+      tb_(now, options.initial_rate),
+      consumed_(now, options.measurement_interval),
+      rate_(options.initial_rate),
+      next_increase_time_(now),
+      next_decrease_time_(now) {
+  CHECK_GT(options_.min_rate, 0);
+  CHECK_LE(options_.min_rate, options_.max_rate);
+  CHECK_GE(options_.initial_rate, options_.min_rate);
+  CHECK_LE(options_.initial_rate, options_.max_rate);
+  CHECK_GT(options_.decrease_factor, 0);
+  CHECK_LT(options_.decrease_factor, 1);
+}
+
+void AdaptiveRateTokenBucket::OnSuccess(absl::Time now) {
+  if (now < next_increase_time_ || rate_ >= options_.max_rate) {
+    return;
+  }
+  if (achieved_rate(now) < options_.min_utilization * rate_) {
+    // Limited by the demand, not by the rate.
+    return;
+  }
+  next_increase_time_ = now + options_.increase_interval;
+  SetRate(now, std::min(options_.max_rate, rate_ + options_.additive_increase));
+}
+
+void AdaptiveRateTokenBucket::OnThrottle(absl::Time now) {
+  if (now < next_decrease_time_) {
+    return;
+  }
+  next_decrease_time_ = now + options_.decrease_interval;
+  // Don't increase right after a decrease either, the successes that follow
+  // are often requests sent before the decrease.
+  next_increase_time_ = std::max(next_increase_time_, next_decrease_time_);
+  SetRate(now, std::max(options_.min_rate, rate_ * options_.decrease_factor));
+}
+
+void AdaptiveRateTokenBucket::SetRate(absl::Time now, double rate) {
+  rate_ = rate;
+  tb_.SetRefillRate(now, rate);
+}
+
+}  // namespace mogo
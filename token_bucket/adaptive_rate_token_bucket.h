@@ -0,0 +1,97 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_ADAPTIVE_RATE_TOKEN_BUCKET_H
+#define MOGO_EXP_TOKEN_BUCKET_ADAPTIVE_RATE_TOKEN_BUCKET_H
+
+#include <cstdint>
+
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "stat/approx_counter.h"
+#include "token_bucket/rate_token_bucket.h"
+
+namespace mogo {
+
+/*
+AdaptiveRateTokenBucket is a RateTokenBucket whose refill rate follows the
+feedback from the downstream service, additive increase, multiplicative
+decrease (AIMD), the same control loop TCP congestion control uses.
+
+OnSuccess adds `additive_increase` tokens per second to the rate, at most once
+per `increase_interval`. OnThrottle, for an explicit throttle or a timeout,
+multiplies the rate by `decrease_factor`, at most once per `decrease_interval`,
+so that a burst of throttles caused by a single overload counts once.
+
+The rate only increases while the caller actually uses it. The tokens admitted
+are counted with an ApproxCounter over `measurement_interval` and a success
+doesn't raise the rate unless the achieved rate is at least `min_utilization`
+of the current one. A caller that is limited by its own demand gets no signal
+from the downstream about the higher rate, so it must not raise it.
+
+Changing the rate keeps the debt, the tokens already taken are refilled at the
+new rate.
+
+Not thread-safe. This class is thread-compatible.
+*/
+class AdaptiveRateTokenBucket {
+ public:
+  struct Options {
+    double initial_rate = 1000;
+    double min_rate = 1;
+    double max_rate = 1e9;
+    // Tokens per second added on success.
+    double additive_increase = 10;
+    absl::Duration increase_interval = absl::Milliseconds(100);
+    // The rate is multiplied by this on throttle, between 0 and 1.
+    double decrease_factor = 0.5;
+    absl::Duration decrease_interval = absl::Seconds(1);
+    // The window over which the achieved rate is measured.
+    absl::Duration measurement_interval = absl::Seconds(1);
+    double min_utilization = 0.9;
+  };
+
+  AdaptiveRateTokenBucket(absl::Time now, const Options& options);
+
+  // Attempts to extract the specified tokens from the token bucket.
+  // Returns absl::ZeroDuration() if the extraction was successful.
+  // Returns a delay that the caller should wait for until tokens are going to
+  // be available.
+  absl::Duration TryGetTokens(absl::Time now, int64_t token_count) {
+    absl::Duration d = tb_.TryGetTokens(now, token_count);
+    if (d == absl::ZeroDuration()) {
+      consumed_.RecordRequest(token_count, now);
+    }
+    return d;
+  }
+
+  // The downstream accepted a request.
+  void OnSuccess(absl::Time now);
+
+  // The downstream throttled a request or the request timed out.
+  void OnThrottle(absl::Time now);
+
+  // The current refill rate in tokens per second.
+  double refill_rate() const { return rate_; }
+
+  // The rate of tokens admitted over the measurement interval.
+  double achieved_rate(absl::Time now) const {
+    return consumed_.GetBytesPerSecond(now);
+  }
+
+  template <typename Sink>
+  friend void AbslStringify(Sink& sink, const AdaptiveRateTokenBucket& t) {
+    absl::Format(&sink, "{AdaptiveRateTokenBucket rate: %f}", t.rate_);
+  }
+
+ private:
+  void SetRate(absl::Time now, double rate);
+
+  const Options options_;
+  RateTokenBucket tb_;
+  ApproxCounter consumed_;
+  double rate_;
+  absl::Time next_increase_time_;
+  absl::Time next_decrease_time_;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_ADAPTIVE_RATE_TOKEN_BUCKET_H
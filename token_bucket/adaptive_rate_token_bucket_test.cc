@@ -0,0 +1,115 @@
+/*
+bazel test token_bucket:adaptive_rate_token_bucket_test
+*/
+
+#include "token_bucket/adaptive_rate_token_bucket.h"
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "token_bucket/burst_token_bucket.h"
+
+namespace mogo {
+namespace {
+
+TEST(AdaptiveRateTokenBucketTest, ThrottleKeepsDebt) {
+  absl::Time now = absl::UnixEpoch();
+  AdaptiveRateTokenBucket::Options options;
+  options.initial_rate = 1000;
+  AdaptiveRateTokenBucket t(now, options);
+
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, 100));
+  ASSERT_EQ(absl::Milliseconds(100), t.TryGetTokens(now, 1));
+  now += absl::Milliseconds(50);
+  // 50 tokens are still owed, at the halved rate they take 100ms to refill.
+  t.OnThrottle(now);
+  ASSERT_EQ(500, t.refill_rate());
+  ASSERT_EQ(absl::Milliseconds(100), t.TryGetTokens(now, 1));
+  // Further throttles within decrease_interval are part of the same overload.
+  t.OnThrottle(now + absl::Milliseconds(10));
+  ASSERT_EQ(500, t.refill_rate());
+  t.OnThrottle(now + options.decrease_interval);
+  ASSERT_EQ(250, t.refill_rate());
+}
+
+TEST(AdaptiveRateTokenBucketTest, NoIncreaseWhenLimitedByDemand) {
+  absl::Time now = absl::UnixEpoch();
+  AdaptiveRateTokenBucket::Options options;
+  options.initial_rate = 1000;
+  AdaptiveRateTokenBucket t(now, options);
+  // 100 requests per second, all of them succeed.
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, 1));
+    t.OnSuccess(now);
+    now += absl::Milliseconds(10);
+  }
+  ASSERT_EQ(1000, t.refill_rate());
+  ASSERT_NEAR(100, t.achieved_rate(now), 10);
+}
+
+TEST(AdaptiveRateTokenBucketTest, IncreasesUpToMaxRate) {
+  absl::Time now = absl::UnixEpoch();
+  AdaptiveRateTokenBucket::Options options;
+  options.initial_rate = 1000;
+  options.max_rate = 1500;
+  options.additive_increase = 100;
+  AdaptiveRateTokenBucket t(now, options);
+  absl::Time end_time = now + absl::Seconds(10);
+  while (now < end_time) {
+    absl::Duration d = t.TryGetTokens(now, 1);
+    if (d == absl::ZeroDuration()) {
+      t.OnSuccess(now);
+    } else {
+      now += d;
+    }
+  }
+  ASSERT_EQ(1500, t.refill_rate());
+}
+
+// A client with unlimited demand in front of a backend that serves at most
+// kCapacity requests per second and throttles the rest. The rate has to find
+// the capacity and keep oscillating around it.
+TEST(AdaptiveRateTokenBucketTest, ConvergesToCapacity) {
+  constexpr double kCapacity = 5000;
+  absl::Time now = absl::UnixEpoch();
+  AdaptiveRateTokenBucket::Options options;
+  options.initial_rate = 1000;
+  options.additive_increase = 100;
+  AdaptiveRateTokenBucket t(now, options);
+  BurstTokenBucket backend(now, absl::Milliseconds(10));
+  const absl::Duration backend_cost = absl::Seconds(1) / kCapacity;
+
+  const absl::Time measure_time = now + absl::Seconds(20);
+  const absl::Time end_time = now + absl::Seconds(60);
+  int64_t served = 0;
+  double min_rate = options.max_rate;
+  double max_rate = 0;
+  while (now < end_time) {
+    absl::Duration d = t.TryGetTokens(now, 1);
+    if (d != absl::ZeroDuration()) {
+      now += d;
+      continue;
+    }
+    if (backend.TryGetTokens(now, backend_cost) == absl::ZeroDuration()) {
+      t.OnSuccess(now);
+      if (now >= measure_time) ++served;
+    } else {
+      t.OnThrottle(now);
+    }
+    if (now >= measure_time) {
+      min_rate = std::min(min_rate, t.refill_rate());
+      max_rate = std::max(max_rate, t.refill_rate());
+    }
+  }
+  const double served_rate =
+      served / absl::ToDoubleSeconds(end_time - measure_time);
+  LOG(INFO) << "Served: " << served_rate << " r/s, rate between " << min_rate
+            << " and " << max_rate;
+  ASSERT_GT(served_rate, 0.6 * kCapacity);
+  ASSERT_LE(served_rate, kCapacity * 1.01);
+  ASSERT_GE(min_rate, kCapacity * options.decrease_factor * 0.9);
+  ASSERT_LE(max_rate, kCapacity * 1.1);
+}
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,23 @@
+#include "token_bucket/blocking_token_bucket.h"
+
+#include "absl/time/clock.h"
+
+namespace mogo {
+
+void BlockingTokenBucket::Acquire(absl::Duration d) {
+  const absl::Time start = Reserve(absl::Now(), d);
+  // The only wakeup of this caller.
+  absl::SleepFor(start - absl::Now());
+}
+
+bool BlockingTokenBucket::AcquireWithDeadline(absl::Duration d,
+                                              absl::Time deadline) {
+  const absl::Time start = Reserve(absl::Now(), d, deadline);
+  if (start == absl::InfiniteFuture()) {
+    return false;
+  }
+  absl::SleepFor(start - absl::Now());
+  return true;
+}
+
+}  // namespace mogo
@@ -0,0 +1,57 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_BLOCKING_TOKEN_BUCKET_H
+#define MOGO_EXP_TOKEN_BUCKET_BLOCKING_TOKEN_BUCKET_H
+
+#include "absl/time/time.h"
+#include "token_bucket/concurrent_token_bucket.h"
+
+namespace mogo {
+
+/*
+BlockingTokenBucket hands out tokens of a SimpleTokenBucket to callers that
+prefer to wait for them instead of sleeping and retrying.
+
+With TryGetTokens every throttled caller sleeps for the returned delay and
+retries. Under overload all of them wake up around the same zero time, only
+one wins and the order in which they get through is arbitrary.
+
+Acquire instead reserves the caller's slot at the moment it arrives: the slot
+starts at the current zero time (or now, if the bucket is at zero) and the zero
+time moves forward by the cost of the request. The chain of reservations forms
+a FIFO queue, the caller that arrives first is served first. Each caller then
+sleeps until its own slot starts and is woken exactly once, by its own timer,
+with no retries and no shared condition to stampede on.
+
+The reservations are ConcurrentTokenBucket::Reserve, this class only adds the
+waiting.
+
+Thread-safe, lock-free. Reservations are a compare-and-swap on a single 64-bit
+zero time.
+*/
+class BlockingTokenBucket {
+ public:
+  explicit BlockingTokenBucket(absl::Time now) : tb_(now) {}
+
+  BlockingTokenBucket(const BlockingTokenBucket&) = delete;
+  BlockingTokenBucket& operator=(const BlockingTokenBucket&) = delete;
+
+  // Blocks until the caller's `d` tokens are available.
+  void Acquire(absl::Duration d);
+
+  // Same as Acquire, but gives up if the tokens are not going to be available
+  // by `deadline`. Giving up doesn't reserve anything, the callers queued
+  // behind are not delayed. Returns whether the tokens were acquired.
+  bool AcquireWithDeadline(absl::Duration d, absl::Time deadline);
+
+  // The non-blocking part of Acquire, see ConcurrentTokenBucket::Reserve.
+  absl::Time Reserve(absl::Time now, absl::Duration d,
+                     absl::Time deadline = absl::InfiniteFuture()) {
+    return tb_.Reserve(now, d, deadline);
+  }
+
+ private:
+  ConcurrentTokenBucket tb_;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_BLOCKING_TOKEN_BUCKET_H
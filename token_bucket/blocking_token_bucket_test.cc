@@ -0,0 +1,83 @@
+/*
+bazel test token_bucket:blocking_token_bucket_test
+*/
+
+#include "token_bucket/blocking_token_bucket.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "gtest/gtest.h"
+
+namespace mogo {
+namespace {
+
+TEST(BlockingTokenBucketTest, ReservationsQueueUp) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  BlockingTokenBucket t(now);
+
+  // Every reservation starts where the previous one ended.
+  ASSERT_EQ(now, t.Reserve(now, token));
+  ASSERT_EQ(now + token, t.Reserve(now, token));
+  ASSERT_EQ(now + 2 * token, t.Reserve(now, token * 3));
+  ASSERT_EQ(now + 5 * token, t.Reserve(now + token, token));
+
+  // A reservation past the deadline doesn't change anything.
+  ASSERT_EQ(absl::InfiniteFuture(),
+            t.Reserve(now, token, /*deadline=*/now + 5 * token));
+  ASSERT_EQ(now + 6 * token,
+            t.Reserve(now, token, /*deadline=*/now + 6 * token));
+
+  // Once the queue drains the reservation starts immediately.
+  now += absl::Seconds(1);
+  ASSERT_EQ(now, t.Reserve(now, token));
+}
+
+TEST(BlockingTokenBucketTest, ConcurrentAcquireIsPaced) {
+  constexpr int kThreadCount = 20;
+  const absl::Duration token = absl::Milliseconds(5);
+  const absl::Time start_time = absl::Now();
+  BlockingTokenBucket t(start_time);
+
+  absl::Mutex mu;
+  std::vector<absl::Time> finish_times;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreadCount; ++i) {
+    threads.emplace_back([&]() {
+      t.Acquire(token);
+      absl::MutexLock lock(&mu);
+      finish_times.push_back(absl::Now());
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // The first caller goes through immediately, every next one waits for one
+  // more token.
+  std::sort(finish_times.begin(), finish_times.end());
+  for (int i = 0; i < kThreadCount; ++i) {
+    ASSERT_GE(finish_times[i] - start_time, token * i) << i;
+  }
+  LOG(INFO) << "Total time: " << finish_times.back() - start_time;
+}
+
+TEST(BlockingTokenBucketTest, AcquireWithDeadline) {
+  const absl::Duration token = absl::Milliseconds(10);
+  BlockingTokenBucket t(absl::Now());
+  // The bucket is at zero, the tokens are acquired right away.
+  ASSERT_TRUE(t.AcquireWithDeadline(token, absl::Now() + token / 2));
+  // The bucket is busy for the next 10ms.
+  ASSERT_FALSE(t.AcquireWithDeadline(token, absl::Now() + token / 2));
+  const absl::Time before = absl::Now();
+  ASSERT_TRUE(t.AcquireWithDeadline(token, absl::Now() + token * 2));
+  ASSERT_GT(absl::Now() - before, absl::ZeroDuration());
+}
+
+}  // namespace
+}  // namespace mogo
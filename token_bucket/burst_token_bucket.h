@@ -1,35 +1,156 @@
 #ifndef MOGO_EXP_TOKEN_BUCKET_BURST_TOKEN_BUCKET_H
 #define MOGO_EXP_TOKEN_BUCKET_BURST_TOKEN_BUCKET_H
 
+#include <algorithm>
+#include <optional>
+
+#include "absl/base/attributes.h"
 #include "absl/log/check.h"
 #include "absl/strings/str_format.h"
 #include "absl/time/time.h"
+#include "token_bucket/clock_domain.h"
 #include "token_bucket/simple_token_bucket.h"
 
 namespace mogo {
 
-class BurstTokenBucket {
+// TryGetTokens and TryGetTokensAboveHeadroom calls are recorded in `Metrics`,
+// reservations are not, see NoTokenBucketMetrics.
+template <typename Domain, typename Metrics = NoTokenBucketMetrics>
+class BasicBurstTokenBucket {
  public:
-  BurstTokenBucket(absl::Time now, absl::Duration burst_tokens)
-      : tb_(now - burst_tokens), max_burst_tokens_(burst_tokens) {}
+  using Time = typename Domain::Time;
+  using Duration = typename Domain::Duration;
+
+  constexpr BasicBurstTokenBucket(Time now, Duration burst_tokens)
+      : tb_(now - burst_tokens),
+        metrics_(now),
+        max_burst_tokens_(burst_tokens) {}
 
   // Attempts to extract the specified tokens from the token bucket.
-  // Returns absl::Zero duration if the extraction was successful.
+  // Returns Domain::Zero() if the extraction was successful.
   // Returns a delay that the caller should wait for until tokens are going to
   // be available.
-  absl::Duration TryGetTokens(absl::Time now, absl::Duration tokens);
+  Duration TryGetTokens(Time now, Duration tokens) {
+    // If the bucket would have refilled to the max_burst_tokens - use that.
+    Time past_with_burst = now - max_burst_tokens_;
+    Duration delay = tb_.TryGetTokens(past_with_burst, tokens);
+    if (delay == Domain::Zero()) {
+      metrics_.RecordAdmit(now, tokens);
+      return Domain::Zero();
+    }
+    if (delay <= max_burst_tokens_) {
+      delay = tb_.TryGetTokens(past_with_burst + delay, tokens);
+      DCHECK_EQ(delay, Domain::Zero());
+      metrics_.RecordAdmit(now, tokens);
+      return Domain::Zero();
+    }
+    metrics_.RecordDelay(now, delay - max_burst_tokens_);
+    return delay - max_burst_tokens_;
+  }
+
+  using Grant = TokenGrant<Domain>;
+
+  // Extracts at most `max_chunk` of the requested tokens, see
+  // BasicSimpleTokenBucket::TryGetPartialTokens. The chunks of a large request
+  // take the burst like any other request.
+  Grant TryGetPartialTokens(Time now, Duration tokens, Duration max_chunk) {
+    DCHECK_GT(max_chunk, Domain::Zero());
+    const Duration chunk = std::min(tokens, max_chunk);
+    const Duration delay = TryGetTokens(now, chunk);
+    if (delay != Domain::Zero()) {
+      return {Domain::Zero(), tokens, delay};
+    }
+    const Duration remaining = tokens - chunk;
+    return {chunk, remaining,
+            remaining == Domain::Zero() ? Domain::Zero()
+                                        : EarliestStart(now) - now};
+  }
+
+  const Metrics& metrics() const { return metrics_; }
+
+  // Same as TryGetTokens, but only admits the request while the bucket holds
+  // at least `headroom` tokens, the rest is reserved for other requests. The
+  // delay returned is the time until the bucket refills to `headroom`.
+  // A zero headroom is the same as TryGetTokens.
+  Duration TryGetTokensAboveHeadroom(Time now, Duration tokens,
+                                     Duration headroom) {
+    DCHECK_LE(headroom, max_burst_tokens_);
+    Duration missing = Deficit(now);
+    Duration allowed_missing = max_burst_tokens_ - headroom;
+    if (missing > allowed_missing) {
+      metrics_.RecordDelay(now, missing - allowed_missing);
+      return missing - allowed_missing;
+    }
+    tb_.Reserve(now - max_burst_tokens_, tokens);
+    metrics_.RecordAdmit(now, tokens);
+    return Domain::Zero();
+  }
+
+  // The tokens missing to a full bucket at `now`, more than the burst while
+  // the bucket is below zero. Saved on shutdown and passed to SetDeficit on
+  // startup it carries the bucket across a restart, re-based to the new
+  // process's `now`, instead of the bucket coming back full.
+  Duration Deficit(Time now) const {
+    Time past_with_burst = now - max_burst_tokens_;
+    return tb_.EarliestStart(past_with_burst) - past_with_burst;
+  }
+
+  void SetDeficit(Time now, Duration deficit) {
+    tb_.SetDebt(now - max_burst_tokens_, deficit);
+  }
+
+  using Reservation = TokenReservation<Domain>;
+
+  // Returns the time when a request arriving at `now` would get its tokens.
+  // Doesn't change the bucket.
+  Time EarliestStart(Time now) const {
+    return std::max(now, tb_.EarliestStart(now - max_burst_tokens_));
+  }
+
+  // Reserves the tokens for a request arriving at `now`, always succeeds. The
+  // request may start at the returned start time, later reservations start
+  // after it. Like TryGetTokens, a request that arrives while the bucket is
+  // not below zero takes the burst.
+  Reservation Reserve(Time now, Duration tokens) {
+    Reservation r = tb_.Reserve(now - max_burst_tokens_, tokens);
+    r.start_time = std::max(now, r.start_time);
+    return r;
+  }
+
+  // Same as Reserve, but if the request can't start by `deadline` returns
+  // std::nullopt and leaves the bucket unchanged.
+  std::optional<Reservation> TryReserve(Time now, Duration tokens,
+                                        Time deadline) {
+    if (EarliestStart(now) > deadline) {
+      return std::nullopt;
+    }
+    return Reserve(now, tokens);
+  }
+
+  // Credits back `unused` tokens of a reservation, never above the burst.
+  // Each ticket should be refunded at most once.
+  void Refund(const typename Reservation::Ticket& ticket, Duration unused) {
+    tb_.Refund(ticket, unused);
+  }
 
   template <typename Sink>
-  friend void AbslStringify(Sink& sink, BurstTokenBucket btb) {
+  friend void AbslStringify(Sink& sink, const BasicBurstTokenBucket& btb) {
     absl::Format(&sink, "{BurstTokenBucket %v, max_burst: %v }", btb.tb_,
                  btb.max_burst_tokens_);
   }
 
  private:
-  SimpleTokenBucket tb_;
-  const absl::Duration max_burst_tokens_;
+  BasicSimpleTokenBucket<Domain> tb_;
+  // Not next to the empty metrics of `tb_`, two empty members of the same type
+  // can't share an address.
+  ABSL_ATTRIBUTE_NO_UNIQUE_ADDRESS Metrics metrics_;
+  const Duration max_burst_tokens_;
 };
 
+extern template class BasicBurstTokenBucket<AbslTimeDomain>;
+
+using BurstTokenBucket = BasicBurstTokenBucket<AbslTimeDomain>;
+
 }  // namespace mogo
 
 #endif  // MOGO_EXP_TOKEN_BUCKET_BURST_TOKEN_BUCKET_H
@@ -88,5 +88,79 @@ TEST(RateTokenBucketTest, Test50s) {
   ASSERT_NEAR(total_rate, 10000, /*abs_error=*/1);
 }
 
+TEST(BurstTokenBucketTest, Reserve) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  mogo::BurstTokenBucket btb(now, 3 * token);
+
+  // The burst and one more request start right away, same as TryGetTokens.
+  for (int i = 0; i < 4; ++i) {
+    BurstTokenBucket::Reservation r = btb.Reserve(now, token);
+    ASSERT_EQ(now, r.start_time);
+  }
+  BurstTokenBucket::Reservation r5 = btb.Reserve(now, 5 * token);
+  ASSERT_EQ(now + token, r5.start_time);
+  ASSERT_EQ(now + 6 * token, btb.EarliestStart(now));
+  ASSERT_FALSE(btb.TryReserve(now, token, now + 5 * token).has_value());
+  ASSERT_EQ(now + 6 * token, btb.EarliestStart(now));
+
+  btb.Refund(r5.ticket, 4 * token);
+  ASSERT_EQ(now + 2 * token, btb.EarliestStart(now));
+  ASSERT_TRUE(btb.TryReserve(now, token, now + 2 * token).has_value());
+
+  // Refunds on an idle bucket don't grow it beyond the burst.
+  now += absl::Seconds(1);
+  BurstTokenBucket::Reservation r = btb.Reserve(now, token);
+  now += absl::Seconds(1);
+  btb.Refund(r.ticket, token);
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_EQ(absl::ZeroDuration(), btb.TryGetTokens(now, token));
+  }
+  ASSERT_EQ(token, btb.TryGetTokens(now, token));
+}
+
+TEST(BurstTokenBucketTest, DeficitAcrossRestart) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  mogo::BurstTokenBucket btb(now, 3 * token);
+  ASSERT_EQ(absl::ZeroDuration(), btb.Deficit(now));
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_EQ(absl::ZeroDuration(), btb.TryGetTokens(now, token));
+  }
+  absl::Duration deficit = btb.Deficit(now);
+  ASSERT_EQ(4 * token, deficit);
+
+  // The restarted process sees a different time, the debt is still owed.
+  now += absl::Hours(1);
+  mogo::BurstTokenBucket restored(now, 3 * token);
+  restored.SetDeficit(now, deficit);
+  ASSERT_EQ(token, restored.TryGetTokens(now, token));
+  now += token;
+  ASSERT_EQ(absl::ZeroDuration(), restored.TryGetTokens(now, token));
+  ASSERT_EQ(token, restored.TryGetTokens(now, token));
+}
+
+// Chunks are handed out right away while the burst lasts.
+TEST(BurstTokenBucketTest, PartialTokens) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  mogo::BurstTokenBucket btb(now, 3 * token);
+
+  BurstTokenBucket::Grant g = btb.TryGetPartialTokens(now, 10 * token, token);
+  ASSERT_EQ(token, g.granted);
+  ASSERT_EQ(9 * token, g.remaining);
+  ASSERT_EQ(absl::ZeroDuration(), g.delay);
+  for (int i = 0; i < 3; ++i) {
+    g = btb.TryGetPartialTokens(now, g.remaining, token);
+    ASSERT_EQ(token, g.granted);
+  }
+  ASSERT_EQ(6 * token, g.remaining);
+  ASSERT_EQ(token, g.delay);
+
+  g = btb.TryGetPartialTokens(now, g.remaining, token);
+  ASSERT_EQ(absl::ZeroDuration(), g.granted);
+  ASSERT_EQ(token, g.delay);
+}
+
 }  // namespace
 }  // namespace mogo
@@ -0,0 +1,136 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_CLOCK_DOMAIN_H
+#define MOGO_EXP_TOKEN_BUCKET_CLOCK_DOMAIN_H
+
+#include <cstdint>
+
+#include "absl/numeric/int128.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "perf/cycle_clock_utils.h"
+
+namespace mogo {
+
+/*
+Clock domains define the time representation the token buckets compute with.
+
+A domain provides:
+  Time, Duration - the types of time points and token amounts.
+  TokenCount     - the type of token counts taken by the rate based buckets.
+  TokenCost      - the precomputed Duration of a single token.
+  Zero()         - the zero Duration.
+  Now()          - the current time of the domain's clock.
+  FromDuration() - converts an absl::Duration to the domain's Duration.
+  CostPerToken(refill_rate) - the TokenCost for a rate in tokens per second.
+  CostOf(cost, token_count) - the Duration of `token_count` tokens.
+  Rescale(d, from, to) - converts the Duration `d` of tokens that cost `from`
+                   each to the Duration of the same tokens at cost `to`.
+
+AbslTimeDomain is the default and keeps the original absl::Time behavior. Its
+arithmetic handles infinities and a 128 bit representation, and the rate based
+buckets multiply a double by a Duration on every call.
+
+NanosDomain and CyclesDomain use plain int64 time points, nanoseconds since the
+unix epoch and CycleClock cycles respectively. Token counts are integers and the
+cost of a token is a fixed-point number, so charging a rate based bucket is an
+integer multiply and a shift. Time points must not get within the largest token
+amount of the int64 range.
+*/
+
+struct AbslTimeDomain {
+  using Time = absl::Time;
+  using Duration = absl::Duration;
+  using TokenCount = double;
+  using TokenCost = absl::Duration;
+
+  static constexpr Duration Zero() { return absl::ZeroDuration(); }
+  static Time Now() { return absl::Now(); }
+  static Duration FromDuration(absl::Duration d) { return d; }
+
+  static TokenCost CostPerToken(double refill_rate) {
+    return absl::Seconds(1) / refill_rate;
+  }
+  static Duration CostOf(TokenCost cost, TokenCount token_count) {
+    return token_count * cost;
+  }
+  static Duration Rescale(Duration d, TokenCost from, TokenCost to) {
+    return d * absl::FDivDuration(to, from);
+  }
+};
+
+// Duration of a single token in units of 2^-kFractionBits of the domain's time
+// unit. 16 fraction bits keep a 1/65536 unit precision and allow token costs of
+// up to 2^47 units, more than a day at nanosecond or cycle resolution.
+struct FixedPointTokenCost {
+  static constexpr int kFractionBits = 16;
+
+  static constexpr FixedPointTokenCost FromUnits(double units) {
+    return {static_cast<int64_t>(units * (int64_t{1} << kFractionBits))};
+  }
+
+  int64_t value;
+};
+
+namespace internal_clock_domain {
+
+inline int64_t FixedPointCostOf(FixedPointTokenCost cost, int64_t token_count) {
+  return static_cast<int64_t>((absl::int128(token_count) * cost.value) >>
+                              FixedPointTokenCost::kFractionBits);
+}
+
+inline int64_t FixedPointRescale(int64_t d, FixedPointTokenCost from,
+                                 FixedPointTokenCost to) {
+  return static_cast<int64_t>(absl::int128(d) * to.value / from.value);
+}
+
+}  // namespace internal_clock_domain
+
+struct NanosDomain {
+  using Time = int64_t;
+  using Duration = int64_t;
+  using TokenCount = int64_t;
+  using TokenCost = FixedPointTokenCost;
+
+  static constexpr Duration Zero() { return 0; }
+  static Time Now() { return absl::GetCurrentTimeNanos(); }
+  static Duration FromDuration(absl::Duration d) {
+    return absl::ToInt64Nanoseconds(d);
+  }
+
+  // constexpr, rates known at compile time are converted at compile time.
+  static constexpr TokenCost CostPerToken(double refill_rate) {
+    return FixedPointTokenCost::FromUnits(1e9 / refill_rate);
+  }
+  static Duration CostOf(TokenCost cost, TokenCount token_count) {
+    return internal_clock_domain::FixedPointCostOf(cost, token_count);
+  }
+  static Duration Rescale(Duration d, TokenCost from, TokenCost to) {
+    return internal_clock_domain::FixedPointRescale(d, from, to);
+  }
+};
+
+struct CyclesDomain {
+  using Time = int64_t;
+  using Duration = int64_t;
+  using TokenCount = int64_t;
+  using TokenCost = FixedPointTokenCost;
+
+  static constexpr Duration Zero() { return 0; }
+  static Time Now() { return CycleClock::Now(); }
+  static Duration FromDuration(absl::Duration d) { return DurationToCycles(d); }
+
+  // The cycle frequency is only known at run time.
+  static TokenCost CostPerToken(double refill_rate) {
+    return FixedPointTokenCost::FromUnits(CycleClock::Frequency() /
+                                          refill_rate);
+  }
+  static Duration CostOf(TokenCost cost, TokenCount token_count) {
+    return internal_clock_domain::FixedPointCostOf(cost, token_count);
+  }
+  static Duration Rescale(Duration d, TokenCost from, TokenCost to) {
+    return internal_clock_domain::FixedPointRescale(d, from, to);
+  }
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_CLOCK_DOMAIN_H
@@ -0,0 +1,103 @@
+#include <cstdint>
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "token_bucket/burst_token_bucket.h"
+#include "token_bucket/clock_domain.h"
+#include "token_bucket/rate_token_bucket.h"
+#include "token_bucket/simple_token_bucket.h"
+
+/*
+sudo cpufreq-set -g performance
+
+bazel test -c opt --dynamic_mode=off --test_output=streamed \
+  --cache_test_results=no token_bucket:clock_domain_benchmarks \
+  --test_arg=--benchmark_filter=all \
+  --test_arg=--benchmark_repetitions=1 \
+  --test_arg=--benchmark_enable_random_interleaving=false
+
+sudo cpufreq-set -g powersave
+
+The same buckets instantiated for every clock domain. The plain benchmarks move
+a synthetic clock forward by a fixed step so they only measure the bucket
+arithmetic, the `Now` ones read the domain's clock on every call the way a
+server would. About half of the requests are admitted.
+*/
+
+namespace mogo {
+namespace {
+
+constexpr double kRate = 1e6;
+constexpr absl::Duration kStep = absl::Nanoseconds(500);
+constexpr absl::Duration kBurst = absl::Microseconds(10);
+
+template <typename Domain>
+void BM_Simple(benchmark::State& state) {
+  const auto step = Domain::FromDuration(kStep);
+  const auto cost = Domain::FromDuration(absl::Seconds(1) / kRate);
+  auto now = Domain::Now();
+  BasicSimpleTokenBucket<Domain> t(now);
+  int64_t admits = 0;
+  for (auto s : state) {
+    now += step;
+    admits += t.TryGetTokens(now, cost) == Domain::Zero();
+  }
+  state.SetItemsProcessed(state.iterations());
+  VLOG(2) << admits;
+}
+BENCHMARK(BM_Simple<AbslTimeDomain>);
+BENCHMARK(BM_Simple<NanosDomain>);
+BENCHMARK(BM_Simple<CyclesDomain>);
+
+template <typename Domain>
+void BM_Burst(benchmark::State& state) {
+  const auto step = Domain::FromDuration(kStep);
+  const auto cost = Domain::FromDuration(absl::Seconds(1) / kRate);
+  auto now = Domain::Now();
+  BasicBurstTokenBucket<Domain> t(now, Domain::FromDuration(kBurst));
+  int64_t admits = 0;
+  for (auto s : state) {
+    now += step;
+    admits += t.TryGetTokens(now, cost) == Domain::Zero();
+  }
+  state.SetItemsProcessed(state.iterations());
+  VLOG(2) << admits;
+}
+BENCHMARK(BM_Burst<AbslTimeDomain>);
+BENCHMARK(BM_Burst<NanosDomain>);
+BENCHMARK(BM_Burst<CyclesDomain>);
+
+template <typename Domain>
+void BM_Rate(benchmark::State& state) {
+  const auto step = Domain::FromDuration(kStep);
+  auto now = Domain::Now();
+  BasicRateTokenBucket<Domain> t(now, kRate);
+  int64_t admits = 0;
+  for (auto s : state) {
+    now += step;
+    admits += t.TryGetTokens(now, 1) == Domain::Zero();
+  }
+  state.SetItemsProcessed(state.iterations());
+  VLOG(2) << admits;
+}
+BENCHMARK(BM_Rate<AbslTimeDomain>);
+BENCHMARK(BM_Rate<NanosDomain>);
+BENCHMARK(BM_Rate<CyclesDomain>);
+
+template <typename Domain>
+void BM_RateNow(benchmark::State& state) {
+  BasicRateTokenBucket<Domain> t(Domain::Now(), kRate);
+  int64_t admits = 0;
+  for (auto s : state) {
+    admits += t.TryGetTokens(Domain::Now(), 1) == Domain::Zero();
+  }
+  state.SetItemsProcessed(state.iterations());
+  VLOG(2) << admits;
+}
+BENCHMARK(BM_RateNow<AbslTimeDomain>);
+BENCHMARK(BM_RateNow<NanosDomain>);
+BENCHMARK(BM_RateNow<CyclesDomain>);
+
+}  // namespace
+}  // namespace mogo
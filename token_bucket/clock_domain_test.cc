@@ -0,0 +1,92 @@
+/*
+bazel test token_bucket:clock_domain_test
+*/
+
+#include "token_bucket/clock_domain.h"
+
+#include <cstdint>
+
+#include "absl/log/log.h"
+#include "absl/random/random.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "token_bucket/burst_token_bucket.h"
+#include "token_bucket/rate_token_bucket.h"
+#include "token_bucket/simple_token_bucket.h"
+
+namespace mogo {
+namespace {
+
+// Rates known at compile time are converted to the fixed-point cost at compile
+// time.
+constexpr FixedPointTokenCost kCost10k = NanosDomain::CostPerToken(10000);
+static_assert(kCost10k.value ==
+              int64_t{100000} << FixedPointTokenCost::kFractionBits);
+constexpr BasicRateTokenBucket<NanosDomain> kRateBucket(/*now=*/0, kCost10k);
+
+// The int64 nanosecond buckets make exactly the same decisions as the
+// absl::Time ones for the same sequence of requests.
+TEST(ClockDomainTest, NanosMatchesAbslTime) {
+  absl::BitGen gen;
+  const absl::Time start = absl::UnixEpoch() + absl::Hours(1);
+  const absl::Duration burst = absl::Milliseconds(3);
+  SimpleTokenBucket simple(start);
+  BurstTokenBucket burst_tb(start, burst);
+  BasicSimpleTokenBucket<NanosDomain> simple_ns(absl::ToUnixNanos(start));
+  BasicBurstTokenBucket<NanosDomain> burst_tb_ns(
+      absl::ToUnixNanos(start), absl::ToInt64Nanoseconds(burst));
+
+  absl::Time now = start;
+  for (int i = 0; i < 100000; ++i) {
+    now += absl::Nanoseconds(absl::Uniform(gen, 0, 2000));
+    const absl::Duration tokens =
+        absl::Nanoseconds(absl::Uniform(gen, 0, 3000));
+    const int64_t now_ns = absl::ToUnixNanos(now);
+    const int64_t tokens_ns = absl::ToInt64Nanoseconds(tokens);
+    ASSERT_EQ(absl::ToInt64Nanoseconds(simple.TryGetTokens(now, tokens)),
+              simple_ns.TryGetTokens(now_ns, tokens_ns))
+        << i;
+    ASSERT_EQ(absl::ToInt64Nanoseconds(burst_tb.TryGetTokens(now, tokens)),
+              burst_tb_ns.TryGetTokens(now_ns, tokens_ns))
+        << i;
+  }
+}
+
+TEST(ClockDomainTest, FixedPointRate) {
+  BasicRateTokenBucket<NanosDomain> t = kRateBucket;
+  ASSERT_EQ(0, t.TryGetTokens(0, 1));
+  ASSERT_EQ(100000, t.TryGetTokens(0, 1));
+  ASSERT_EQ(0, t.TryGetTokens(100000, 3));
+  ASSERT_EQ(300000, t.TryGetTokens(100000, 1));
+
+  // A rate that doesn't divide a second evenly keeps the fractional nanoseconds
+  // of the token cost: 3 tokens at 3/s are exactly one second.
+  BasicRateTokenBucket<NanosDomain> third(0, /*refill_rate=*/3);
+  ASSERT_EQ(0, third.TryGetTokens(0, 3));
+  ASSERT_NEAR(1000000000, third.TryGetTokens(0, 1), 1);
+}
+
+// Same as RateTokenBucketTest.Test50s, in the cycle domain.
+TEST(ClockDomainTest, CyclesRate) {
+  const double rate = 10000;
+  const int64_t start = CyclesDomain::Now();
+  const int64_t end = start + CyclesDomain::FromDuration(absl::Seconds(50));
+  BasicRateTokenBucket<CyclesDomain> t(start, rate);
+  int64_t now = start;
+  int request_count = 0;
+  while (now < end) {
+    const int64_t d = t.TryGetTokens(now, 1);
+    if (d == 0) {
+      request_count++;
+    } else {
+      now += d;
+    }
+  }
+  const double total_rate =
+      request_count / CyclesToSeconds(now - start);
+  LOG(INFO) << "Total rate: " << total_rate << " r/s";
+  ASSERT_NEAR(total_rate, rate, /*abs_error=*/1);
+}
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,46 @@
+#include "token_bucket/codel_shedder.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "absl/log/check.h"
+#include "absl/time/time.h"
+#include "perf/cycle_clock_utils.h"
+
+namespace mogo {
+
+CoDelShedder::CoDelShedder(int64_t now_cycles, const Options& options)
+    : seconds_per_cycle_(1 / CycleClock::Frequency()),
+      target_cycles_(DurationToCycles(options.target)),
+      interval_cycles_(DurationToCycles(options.interval)),
+      min_delay_cycles_(0),
+      interval_end_cycles_(now_cycles + interval_cycles_),
+      shed_(ToTime(now_cycles), options.rate_interval) {
+  CHECK_GT(target_cycles_, 0);
+  CHECK_GT(interval_cycles_, 0);
+}
+
+bool CoDelShedder::OnDequeue(int64_t enqueue_cycles, int64_t now_cycles) {
+  ++dequeued_count_;
+  const int64_t delay = now_cycles - enqueue_cycles;
+  if (now_cycles >= interval_end_cycles_) {
+    // A queue that never got below the target during the interval that just
+    // ended is a standing queue. A whole interval without dequeues means the
+    // queue went empty, like packet CoDel that leaves the dropping state then.
+    overloaded_ = min_delay_cycles_ > target_cycles_ &&
+                  now_cycles < interval_end_cycles_ + interval_cycles_;
+    min_delay_cycles_ = delay;
+    interval_end_cycles_ = now_cycles + interval_cycles_;
+  } else {
+    min_delay_cycles_ = std::min(min_delay_cycles_, delay);
+  }
+
+  if (delay <= (overloaded_ ? target_cycles_ : interval_cycles_)) {
+    return false;
+  }
+  ++shed_count_;
+  shed_.RecordRequest(1, ToTime(now_cycles));
+  return true;
+}
+
+}  // namespace mogo
@@ -0,0 +1,93 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_CODEL_SHEDDER_H
+#define MOGO_EXP_TOKEN_BUCKET_CODEL_SHEDDER_H
+
+#include <cstdint>
+
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "perf/cycle_clock_utils.h"
+#include "stat/approx_counter.h"
+
+namespace mogo {
+
+/*
+CoDelShedder sheds work when the server's own queue backs up, what a token
+bucket can't see: a rate limit sized for the average cost lets the queue grow
+without bound when requests get slower.
+
+The queue delay is measured per request, the time between the enqueue and the
+dequeue timestamps, in CycleClock cycles. Like CoDel (Nichols & Jacobson,
+"Controlling Queue Delay") it tells a burst from a standing queue by the
+minimum delay over an `interval`: a burst drains and its minimum drops below
+`target`, a standing queue doesn't. Packet CoDel then drops at a slowly
+increasing rate, which works for senders that back off but lets the delay of
+requests that keep coming sit far above the target. The shedding instead
+follows the RPC-queue variant of CoDel (Maurer, "Fail at Scale"): a request is
+shed if it waited longer than `interval`, or, while the queue is overloaded,
+longer than `target`. The queue delay of the served requests is bounded by
+the target under a persistent overload and by the interval always, bursts are
+served. A whole interval without dequeues, an empty queue, ends the overload.
+
+OnDequeue is called for every request taken off the queue and returns whether
+to shed it, fail it fast or move it to a lower priority queue. While
+overloaded() is true new requests may also be refused right away instead of
+being queued. The rate of shed requests is tracked with an ApproxCounter.
+
+Not thread-safe. This class is thread-compatible.
+*/
+class CoDelShedder {
+ public:
+  struct Options {
+    absl::Duration target = absl::Milliseconds(5);
+    absl::Duration interval = absl::Milliseconds(100);
+    // The window of the shed rate.
+    absl::Duration rate_interval = absl::Seconds(1);
+  };
+
+  CoDelShedder(int64_t now_cycles, const Options& options);
+
+  // Returns true if the request enqueued at `enqueue_cycles` and dequeued at
+  // `now_cycles` should be shed.
+  bool OnDequeue(int64_t enqueue_cycles, int64_t now_cycles);
+
+  // Whether the minimum queue delay over the last full interval was above
+  // the target.
+  bool overloaded() const { return overloaded_; }
+
+  // The requests shed per second over the rate interval.
+  double shed_rate(int64_t now_cycles) const {
+    return shed_.GetBytesPerSecond(ToTime(now_cycles));
+  }
+
+  int64_t shed_count() const { return shed_count_; }
+  int64_t dequeued_count() const { return dequeued_count_; }
+
+  template <typename Sink>
+  friend void AbslStringify(Sink& sink, const CoDelShedder& s) {
+    absl::Format(&sink, "{CoDelShedder overloaded: %v, shed: %d of %d}",
+                 s.overloaded_, s.shed_count_, s.dequeued_count_);
+  }
+
+ private:
+  // The ApproxCounter time of a cycle timestamp.
+  absl::Time ToTime(int64_t cycles) const {
+    return absl::UnixEpoch() + absl::Seconds(cycles * seconds_per_cycle_);
+  }
+
+  const double seconds_per_cycle_;
+  const int64_t target_cycles_;
+  const int64_t interval_cycles_;
+
+  bool overloaded_ = false;
+  // The minimum queue delay in the current interval.
+  int64_t min_delay_cycles_;
+  int64_t interval_end_cycles_;
+
+  int64_t shed_count_ = 0;
+  int64_t dequeued_count_ = 0;
+  ApproxCounter shed_;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_CODEL_SHEDDER_H
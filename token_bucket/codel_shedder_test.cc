@@ -0,0 +1,118 @@
+/*
+bazel test token_bucket:codel_shedder_test
+*/
+
+#include "token_bucket/codel_shedder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "perf/cycle_clock_utils.h"
+
+namespace mogo {
+namespace {
+
+// A bursty queue below the capacity of the server is never shed.
+TEST(CoDelShedderTest, BurstsPass) {
+  const int64_t ms = DurationToCycles(absl::Milliseconds(1));
+  int64_t now = 1000 * ms;
+  CoDelShedder s(now, CoDelShedder::Options());
+  for (int burst = 0; burst < 10; ++burst) {
+    // 20 requests arrive at once, served in 20ms, then the queue is empty.
+    const int64_t enqueue = now;
+    for (int i = 0; i < 20; ++i) {
+      now += ms;
+      ASSERT_FALSE(s.OnDequeue(enqueue, now));
+    }
+    now += 100 * ms;
+  }
+  ASSERT_EQ(0, s.shed_count());
+  ASSERT_FALSE(s.overloaded());
+}
+
+// An overload followed by an idle period, the first request after it waited
+// above the target but the queue is empty.
+TEST(CoDelShedderTest, IdleEndsTheOverload) {
+  const int64_t ms = DurationToCycles(absl::Milliseconds(1));
+  int64_t now = 1000 * ms;
+  CoDelShedder s(now, CoDelShedder::Options());
+  for (int i = 0; i < 1000; ++i) {
+    now += ms;
+    s.OnDequeue(now - 50 * ms, now);
+  }
+  ASSERT_TRUE(s.overloaded());
+  ASSERT_GT(s.shed_count(), 0);
+  const int64_t shed_count = s.shed_count();
+
+  now += 1000 * ms;
+  ASSERT_FALSE(s.OnDequeue(now - 10 * ms, now));
+  ASSERT_FALSE(s.overloaded());
+  ASSERT_EQ(shed_count, s.shed_count());
+}
+
+// Queue delays of the served requests with requests arriving 25% faster than
+// the server can serve them.
+int64_t MaxQueueDelayUnderOverload(bool shed, int64_t* shed_count,
+                                   double* shed_rate) {
+  const int64_t ms = DurationToCycles(absl::Milliseconds(1));
+  const int64_t arrival_interval = ms * 4 / 5;
+  int64_t now = 1000 * ms;
+  const int64_t start = now;
+  CoDelShedder s(now, CoDelShedder::Options());
+  std::deque<int64_t> queue;
+  int64_t next_arrival = now;
+  int64_t max_delay = 0;
+  std::vector<int64_t> delays;
+  while (now < start + 20000 * ms) {
+    while (next_arrival <= now) {
+      queue.push_back(next_arrival);
+      next_arrival += arrival_interval;
+    }
+    if (queue.empty()) {
+      now = next_arrival;
+      continue;
+    }
+    const int64_t enqueue = queue.front();
+    queue.pop_front();
+    if (shed && s.OnDequeue(enqueue, now)) {
+      // Shedding costs next to nothing.
+      continue;
+    }
+    if (now > start + 10000 * ms) {
+      max_delay = std::max(max_delay, now - enqueue);
+      delays.push_back(now - enqueue);
+    }
+    now += ms;
+  }
+  std::sort(delays.begin(), delays.end());
+  LOG(INFO) << "p50 " << CyclesToDuration(delays[delays.size() / 2]) << " p99 "
+            << CyclesToDuration(delays[delays.size() * 99 / 100]);
+  *shed_count = s.shed_count();
+  *shed_rate = s.shed_rate(now);
+  return max_delay;
+}
+
+TEST(CoDelShedderTest, BoundsQueueDelayUnderOverload) {
+  int64_t shed_count;
+  double shed_rate;
+  const absl::Duration unbounded = CyclesToDuration(
+      MaxQueueDelayUnderOverload(/*shed=*/false, &shed_count, &shed_rate));
+  const absl::Duration bounded = CyclesToDuration(
+      MaxQueueDelayUnderOverload(/*shed=*/true, &shed_count, &shed_rate));
+  LOG(INFO) << "max queue delay without shedding: " << unbounded
+            << ", with shedding: " << bounded << ", shed: " << shed_count
+            << ", shed rate: " << shed_rate;
+  EXPECT_GT(unbounded, absl::Seconds(2));
+  // Never above the interval.
+  EXPECT_LT(bounded, CoDelShedder::Options().interval);
+  // The overload is 250 requests per second.
+  EXPECT_NEAR(shed_rate, 250, 50);
+}
+
+}  // namespace
+}  // namespace mogo
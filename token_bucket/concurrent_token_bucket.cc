@@ -0,0 +1,53 @@
+#include "token_bucket/concurrent_token_bucket.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace mogo {
+
+int64_t ConcurrentTokenBucket::TryGetTokensNs(int64_t now_ns, int64_t d_ns) {
+  int64_t zero_time_ns = zero_time_ns_.load(std::memory_order_relaxed);
+  while (true) {
+    if (now_ns < zero_time_ns) {
+      return zero_time_ns - now_ns;
+    }
+    // The bucket has already returned back to zero, try to extract tokens. If
+    // another thread got there first `zero_time_ns` is reloaded and we check
+    // again whether the request can still go through.
+    if (ABSL_PREDICT_TRUE(zero_time_ns_.compare_exchange_weak(
+            zero_time_ns, now_ns + d_ns, std::memory_order_relaxed,
+            std::memory_order_relaxed))) {
+      return 0;
+    }
+  }
+}
+
+int64_t ConcurrentTokenBucket::ReserveNs(int64_t now_ns, int64_t d_ns,
+                                         int64_t deadline_ns) {
+  int64_t zero_time_ns = zero_time_ns_.load(std::memory_order_relaxed);
+  while (true) {
+    // The slot starts right after the previous reservation ends.
+    const int64_t start_ns = std::max(now_ns, zero_time_ns);
+    if (start_ns > deadline_ns) {
+      return std::numeric_limits<int64_t>::max();
+    }
+    if (zero_time_ns_.compare_exchange_weak(zero_time_ns, start_ns + d_ns,
+                                            std::memory_order_relaxed,
+                                            std::memory_order_relaxed)) {
+      return start_ns;
+    }
+  }
+}
+
+void ConcurrentTokenBucket::ScaleDebtNs(int64_t now_ns, double factor) {
+  int64_t zero_time_ns = zero_time_ns_.load(std::memory_order_relaxed);
+  while (now_ns < zero_time_ns &&
+         !zero_time_ns_.compare_exchange_weak(
+             zero_time_ns,
+             now_ns + static_cast<int64_t>((zero_time_ns - now_ns) * factor),
+             std::memory_order_relaxed, std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace mogo
@@ -0,0 +1,87 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_CONCURRENT_TOKEN_BUCKET_H
+#define MOGO_EXP_TOKEN_BUCKET_CONCURRENT_TOKEN_BUCKET_H
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+#include "absl/base/optimization.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+
+namespace mogo {
+
+// A thread-safe, lock-free version of the SimpleTokenBucket.
+// Refills at one second per second.
+// Tokens extracted in units of absl::Duration.
+// Has no burst, but the first request is going to be allowed through.
+//
+// The zero time is stored as nanoseconds since the unix epoch in a single
+// 64-bit atomic and admission is a compare-and-swap loop on that value, so
+// concurrent callers never block each other. The object occupies a full cache
+// line to avoid false sharing with neighbouring data.
+class alignas(ABSL_CACHELINE_SIZE) ConcurrentTokenBucket {
+ public:
+  explicit ConcurrentTokenBucket(absl::Time now)
+      : zero_time_ns_(absl::ToUnixNanos(now)) {}
+
+  ConcurrentTokenBucket(const ConcurrentTokenBucket&) = delete;
+  ConcurrentTokenBucket& operator=(const ConcurrentTokenBucket&) = delete;
+
+  // Attempts to extract the specified tokens from the token bucket.
+  // Returns absl::ZeroDuration() if the extraction was successful.
+  // Returns a delay that the caller should wait for until tokens are going to
+  // be available.
+  absl::Duration TryGetTokens(absl::Time now, absl::Duration d) {
+    return absl::Nanoseconds(
+        TryGetTokensNs(absl::ToUnixNanos(now), absl::ToInt64Nanoseconds(d)));
+  }
+
+  // Same as TryGetTokens, but operates on nanoseconds since the unix epoch
+  // and avoids the absl::Time conversions on the hot path.
+  // Returns 0 if the extraction was successful, the delay in nanoseconds
+  // otherwise.
+  int64_t TryGetTokensNs(int64_t now_ns, int64_t d_ns);
+
+  // Reserves the next `d` tokens for a request arriving at `now` and returns
+  // the time when it may proceed: `now` if the bucket is at zero, the end of
+  // the previous reservation otherwise. Reservations queue up in the order
+  // they are made. Returns absl::InfiniteFuture() and reserves nothing if the
+  // request couldn't proceed by `deadline`.
+  absl::Time Reserve(absl::Time now, absl::Duration d,
+                     absl::Time deadline = absl::InfiniteFuture()) {
+    const int64_t start_ns =
+        ReserveNs(absl::ToUnixNanos(now), absl::ToInt64Nanoseconds(d),
+                  deadline == absl::InfiniteFuture()
+                      ? std::numeric_limits<int64_t>::max()
+                      : absl::ToUnixNanos(deadline));
+    return start_ns == std::numeric_limits<int64_t>::max()
+               ? absl::InfiniteFuture()
+               : absl::FromUnixNanos(start_ns);
+  }
+
+  // Same as Reserve in nanoseconds since the unix epoch. Returns the maximum
+  // int64_t instead of absl::InfiniteFuture().
+  int64_t ReserveNs(int64_t now_ns, int64_t d_ns, int64_t deadline_ns);
+
+  // Multiplies the debt, the time from `now_ns` until the bucket returns back
+  // to zero, by `factor`. Used when the tokens already taken change their
+  // cost, like RateTokenBucket::SetCostPerToken.
+  void ScaleDebtNs(int64_t now_ns, double factor);
+
+  template <typename Sink>
+  friend void AbslStringify(Sink& sink, const ConcurrentTokenBucket& ctb) {
+    absl::Format(&sink, "{ConcurrentTokenBucket zero_time: %v} ",
+                 absl::FromUnixNanos(
+                     ctb.zero_time_ns_.load(std::memory_order_relaxed)));
+  }
+
+ private:
+  // The time when the token bucket returns back to zero and starts allowing
+  // requests through, in nanoseconds since the unix epoch.
+  std::atomic<int64_t> zero_time_ns_;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_CONCURRENT_TOKEN_BUCKET_H
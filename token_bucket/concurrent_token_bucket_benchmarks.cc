@@ -0,0 +1,100 @@
+#include <cstdint>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/log/log.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "token_bucket/concurrent_token_bucket.h"
+#include "token_bucket/simple_token_bucket.h"
+
+/*
+sudo cpufreq-set -g performance
+
+bazel test -c opt --dynamic_mode=off --test_output=streamed \
+  --cache_test_results=no token_bucket:concurrent_token_bucket_benchmarks \
+  --test_arg=--benchmark_filter=all \
+  --test_arg=--benchmark_repetitions=1 \
+  --test_arg=--benchmark_enable_random_interleaving=false
+
+sudo cpufreq-set -g powersave
+
+The `admits` counter is the aggregate number of admitted requests per second
+across all threads, `attempts` is the aggregate number of TryGetTokens calls
+per second.
+*/
+
+namespace mogo {
+namespace {
+
+// The token cost is small enough for the bucket to return to zero between
+// calls from a single thread, so the uncontended case admits every request.
+constexpr absl::Duration kRequestCost = absl::Nanoseconds(1);
+
+// The way SimpleTokenBucket has to be shared between threads without a
+// dedicated concurrent implementation.
+class MutexTokenBucket {
+ public:
+  explicit MutexTokenBucket(absl::Time now) : tb_(now) {}
+
+  absl::Duration TryGetTokens(absl::Time now, absl::Duration d) {
+    absl::MutexLock lock(&mu_);
+    return tb_.TryGetTokens(now, d);
+  }
+
+ private:
+  absl::Mutex mu_;
+  SimpleTokenBucket tb_ ABSL_GUARDED_BY(mu_);
+};
+
+template <typename TokenBucket>
+void BM_ContendedAdmit(benchmark::State& state) {
+  // Shared between all benchmark threads, the instance from the previous run
+  // is destroyed before the timing loop of the next run starts.
+  static TokenBucket* tb = nullptr;
+  if (state.thread_index() == 0) {
+    delete tb;
+    tb = new TokenBucket(absl::Now());
+  }
+  int64_t admits = 0;
+  for (auto s : state) {
+    if (tb->TryGetTokens(absl::Now(), kRequestCost) == absl::ZeroDuration()) {
+      ++admits;
+    }
+  }
+  state.counters["admits"] =
+      benchmark::Counter(admits, benchmark::Counter::kIsRate);
+  state.counters["attempts"] =
+      benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+  VLOG(2) << admits;
+}
+BENCHMARK(BM_ContendedAdmit<MutexTokenBucket>)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK(BM_ContendedAdmit<ConcurrentTokenBucket>)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+void BM_ConcurrentAdmitNs(benchmark::State& state) {
+  static ConcurrentTokenBucket* tb = nullptr;
+  if (state.thread_index() == 0) {
+    delete tb;
+    tb = new ConcurrentTokenBucket(absl::Now());
+  }
+  const int64_t cost_ns = absl::ToInt64Nanoseconds(kRequestCost);
+  int64_t admits = 0;
+  for (auto s : state) {
+    if (tb->TryGetTokensNs(absl::GetCurrentTimeNanos(), cost_ns) == 0) {
+      ++admits;
+    }
+  }
+  state.counters["admits"] =
+      benchmark::Counter(admits, benchmark::Counter::kIsRate);
+  state.counters["attempts"] =
+      benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_ConcurrentAdmitNs)->ThreadRange(1, 64)->UseRealTime();
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,116 @@
+/*
+bazel test token_bucket:concurrent_token_bucket_test
+*/
+
+#include "token_bucket/concurrent_token_bucket.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/time/clock.h"
+#include "gtest/gtest.h"
+
+namespace mogo {
+namespace {
+
+TEST(ConcurrentTokenBucketTest, SingleThread) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  ConcurrentTokenBucket t(now);
+
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, token));
+  ASSERT_EQ(token, t.TryGetTokens(now, token));
+  now += absl::Microseconds(400);
+  ASSERT_EQ(token - absl::Microseconds(400), t.TryGetTokens(now, token));
+  now += token;
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, token));
+  LOG(INFO) << t;
+}
+
+TEST(ConcurrentTokenBucketTest, Reserve) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  ConcurrentTokenBucket t(now);
+
+  ASSERT_EQ(now, t.Reserve(now, token));
+  ASSERT_EQ(now + token, t.Reserve(now, token));
+  // TryGetTokens waits behind the reservations.
+  ASSERT_EQ(2 * token, t.TryGetTokens(now, token));
+  ASSERT_EQ(absl::InfiniteFuture(),
+            t.Reserve(now, token, /*deadline=*/now + token));
+  ASSERT_EQ(now + 2 * token,
+            t.Reserve(now, token, /*deadline=*/now + 2 * token));
+}
+
+TEST(ConcurrentTokenBucketTest, ScaleDebt) {
+  const int64_t now_ns = 1000000000;
+  ConcurrentTokenBucket t(absl::FromUnixNanos(now_ns));
+  ASSERT_EQ(0, t.TryGetTokensNs(now_ns, 1000));
+  t.ScaleDebtNs(now_ns + 200, 0.25);
+  // 800ns of debt left, 200ns after scaling.
+  ASSERT_EQ(200, t.TryGetTokensNs(now_ns + 200, 1000));
+  // No debt, nothing to scale.
+  t.ScaleDebtNs(now_ns + 500, 100);
+  ASSERT_EQ(0, t.TryGetTokensNs(now_ns + 500, 1000));
+}
+
+TEST(ConcurrentTokenBucketTest, Test50s) {
+  absl::Time start_time = absl::Now();
+  absl::Time now = start_time;
+  ConcurrentTokenBucket t(now);
+  absl::Duration request_cost = absl::Microseconds(100);  // 10k requests/sec
+  absl::Time end_time = now + absl::Seconds(50);
+  int request_count = 0;
+  while (now < end_time) {
+    absl::Duration d = t.TryGetTokens(now, request_cost);
+    if (d == absl::ZeroDuration()) {
+      request_count++;
+    } else {
+      // Sleep until we can schedule the next request.
+      now += d;
+    }
+  }
+  double total_rate = request_count / absl::ToDoubleSeconds(now - start_time);
+  LOG(INFO) << "Total rate: " << total_rate << " r/s";
+  ASSERT_NEAR(total_rate, absl::FDivDuration(absl::Seconds(1), request_cost),
+              /*abs_error=*/1);
+}
+
+// Every admitted request moves the zero time forward by `request_cost` from a
+// point that is not earlier than the previous zero time, so the number of
+// admitted requests can't exceed the elapsed time divided by the cost no
+// matter how many threads compete for the tokens.
+TEST(ConcurrentTokenBucketTest, ContendedNeverOverAdmits) {
+  constexpr int kThreadCount = 8;
+  const absl::Duration request_cost = absl::Microseconds(10);
+  const absl::Time start_time = absl::Now();
+  const absl::Time end_time = start_time + absl::Milliseconds(200);
+  ConcurrentTokenBucket t(start_time);
+  std::atomic<int64_t> admitted{0};
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreadCount; ++i) {
+    threads.emplace_back([&]() {
+      while (true) {
+        absl::Time now = absl::Now();
+        if (now >= end_time) break;
+        if (t.TryGetTokens(now, request_cost) == absl::ZeroDuration()) {
+          admitted.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const int64_t max_admitted = (end_time - start_time) / request_cost + 1;
+  LOG(INFO) << "Admitted: " << admitted.load() << " max: " << max_admitted;
+  ASSERT_LE(admitted.load(), max_admitted);
+  ASSERT_GT(admitted.load(), 0);
+}
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,113 @@
+#include "token_bucket/heavy_hitter_token_bucket.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "absl/base/prefetch.h"
+#include "absl/log/check.h"
+#include "absl/numeric/bits.h"
+#include "absl/time/time.h"
+
+namespace mogo {
+
+namespace {
+
+// Odd multipliers for Fibonacci-style hashing, one per sketch row. Each row
+// takes the high bits of its product, so the rows index independently.
+constexpr uint64_t kRowMultipliers[] = {
+    0x9E3779B97F4A7C15ull,
+    0xC2B2AE3D27D4EB4Full,
+    0x165667B19E3779F9ull,
+    0xD6E8FEB86659FD93ull,
+};
+
+}  // namespace
+
+HeavyHitterTokenBucket::HeavyHitterTokenBucket(const Options& options)
+    : span_ns_(absl::ToInt64Nanoseconds(options.window) / (kSpansPerCell - 1)),
+      heavy_ns_(options.heavy_fraction *
+                absl::ToInt64Nanoseconds(options.window)),
+      exact_(options.top_k, options.burst_tokens) {
+  static_assert(sizeof(kRowMultipliers) / sizeof(kRowMultipliers[0]) ==
+                kDepth);
+  CHECK_GT(options.sketch_width, 0);
+  CHECK_GT(span_ns_, 0);
+  CHECK_GT(options.heavy_fraction, 0);
+  CHECK_LE(options.heavy_fraction, 1);
+  const uint64_t width =
+      absl::bit_ceil(static_cast<uint64_t>(std::max<int64_t>(
+          2, options.sketch_width)));
+  width_mask_ = width - 1;
+  width_shift_ = 64 - absl::countr_zero(width);
+  // Zero tokens in every span, the span tag doesn't matter.
+  cells_.reset(new Cell[kDepth * width]());
+}
+
+uint64_t HeavyHitterTokenBucket::CellIndex(int row, uint64_t key) const {
+  return row * (width_mask_ + 1) +
+         ((key * kRowMultipliers[row]) >> width_shift_);
+}
+
+HeavyHitterTokenBucket::Cell& HeavyHitterTokenBucket::CellAt(int row,
+                                                            uint64_t key,
+                                                            int64_t span) {
+  Cell& cell = cells_[CellIndex(row, key)];
+  if (ABSL_PREDICT_FALSE(cell.last_span != span)) {
+    // Zero the spans between the last update and now, they are reused for the
+    // spans that follow.
+    const int64_t expired =
+        std::min<int64_t>(span - cell.last_span, kSpansPerCell);
+    for (int64_t s = span - expired + 1; s <= span; ++s) {
+      cell.span_tokens_ns[s % kSpansPerCell] = 0;
+    }
+    cell.last_span = span;
+  }
+  return cell;
+}
+
+int64_t HeavyHitterTokenBucket::Sum(const Cell& cell) {
+  int64_t sum = 0;
+  for (int64_t tokens_ns : cell.span_tokens_ns) {
+    sum += tokens_ns;
+  }
+  return sum;
+}
+
+int64_t HeavyHitterTokenBucket::EstimateNs(uint64_t key, int64_t now_ns) {
+  const int64_t span = now_ns / span_ns_;
+  int64_t estimate = std::numeric_limits<int64_t>::max();
+  for (int row = 0; row < kDepth; ++row) {
+    estimate = std::min(estimate, Sum(CellAt(row, key, span)));
+  }
+  return estimate;
+}
+
+int64_t HeavyHitterTokenBucket::TryGetTokensNs(uint64_t key, int64_t now_ns,
+                                               int64_t tokens_ns) {
+  const int64_t span = now_ns / span_ns_;
+  // The rows are independent, start all the cache misses at once.
+  for (int row = 0; row < kDepth; ++row) {
+    absl::PrefetchToLocalCache(&cells_[CellIndex(row, key)]);
+  }
+  Cell* cells[kDepth];
+  int64_t estimate = std::numeric_limits<int64_t>::max();
+  for (int row = 0; row < kDepth; ++row) {
+    cells[row] = &CellAt(row, key, span);
+    estimate = std::min(estimate, Sum(*cells[row]));
+  }
+  if (estimate >= heavy_ns_) {
+    ++heavy_requests_;
+    const int64_t delay_ns = exact_.TryGetTokensNs(key, now_ns, tokens_ns);
+    if (delay_ns != 0) {
+      return delay_ns;
+    }
+  }
+  const int slot = span % kSpansPerCell;
+  for (Cell* cell : cells) {
+    cell->span_tokens_ns[slot] += tokens_ns;
+  }
+  return 0;
+}
+
+}  // namespace mogo
@@ -0,0 +1,123 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_HEAVY_HITTER_TOKEN_BUCKET_H
+#define MOGO_EXP_TOKEN_BUCKET_HEAVY_HITTER_TOKEN_BUCKET_H
+
+#include <cstdint>
+#include <memory>
+
+#include "absl/base/optimization.h"
+#include "absl/time/time.h"
+#include "token_bucket/keyed_token_bucket.h"
+
+namespace mogo {
+
+/*
+HeavyHitterTokenBucket limits every key of an unbounded, possibly adversarial
+key space, e.g. source IPs, to the same rate as KeyedTokenBucket, in memory
+fixed at construction.
+
+Most keys use a small fraction of their rate and need no bucket of their own.
+The tokens admitted for every key are counted in a count-min sketch, kDepth
+rows of cells, where a key maps to one cell per row and its estimate is the
+smallest of its cells. Collisions only ever add to a cell, so the estimate is
+never below the real consumption. Every cell counts the consumption over the
+last `window` in spans, the same sliding span scheme ThroughputCounter uses: a
+circular buffer of per-span counts where the spans that slid out of the window
+are zeroed. Here every cell carries the span it was last updated in and zeroes
+the expired spans when it is next touched, there is no cleanup pass.
+
+A key whose estimate stays below `heavy_fraction` of what the rate allows over
+the window is admitted without further checks. A key that reaches it is a heavy
+hitter and is promoted to an exact burst bucket in a KeyedTokenBucket of
+`top_k` buckets. When the exact table is full the bucket closest to being full
+is evicted, so the table holds the heaviest keys. A promoted bucket starts
+full, a key gets at most the `heavy_fraction` of the window on top of the rate
+and burst before it is limited exactly.
+
+An admission reads and updates one cache line per sketch row, heavy hitters
+also touch their exact bucket.
+
+Keys are typically fingerprints of the real client identifier, key 0 is
+reserved.
+
+Not thread-safe. This class is thread-compatible.
+*/
+class HeavyHitterTokenBucket {
+ public:
+  struct Options {
+    // Cells per sketch row, rounded up to a power of two. The more distinct
+    // keys are active within a window, the wider the rows have to be to keep
+    // light keys from adding up to a heavy estimate.
+    int64_t sketch_width = 1 << 16;
+    // The number of exact buckets.
+    int64_t top_k = 1 << 12;
+    // The burst of the exact buckets.
+    absl::Duration burst_tokens = absl::Milliseconds(100);
+    // The window the consumption of every key is estimated over.
+    absl::Duration window = absl::Seconds(1);
+    // Keys that consume more than this fraction of the window are limited by
+    // an exact bucket.
+    double heavy_fraction = 0.5;
+  };
+
+  explicit HeavyHitterTokenBucket(const Options& options);
+
+  // Attempts to extract the specified tokens from the bucket of `key`.
+  // Returns absl::ZeroDuration() if the extraction was successful.
+  // Returns a delay that the caller should wait for until tokens are going to
+  // be available.
+  absl::Duration TryGetTokens(uint64_t key, absl::Time now,
+                              absl::Duration tokens) {
+    return absl::Nanoseconds(TryGetTokensNs(key, absl::ToUnixNanos(now),
+                                            absl::ToInt64Nanoseconds(tokens)));
+  }
+
+  // Same as TryGetTokens, but in nanoseconds since the unix epoch.
+  int64_t TryGetTokensNs(uint64_t key, int64_t now_ns, int64_t tokens_ns);
+
+  // The estimated tokens admitted for `key` over the window, in nanoseconds.
+  int64_t EstimateNs(uint64_t key, int64_t now_ns);
+
+  // The number of requests that were checked against an exact bucket.
+  int64_t heavy_requests() const { return heavy_requests_; }
+
+  // The exact buckets that were evicted before they fully refilled.
+  int64_t forced_evictions() const { return exact_.forced_evictions(); }
+
+  // Bytes used by the sketch and the exact buckets.
+  int64_t memory_usage() const {
+    return kDepth * (width_mask_ + 1) * sizeof(Cell) + exact_.memory_usage();
+  }
+
+ private:
+  static constexpr int kDepth = 4;
+  // One span is the one being filled, the rest cover the window.
+  static constexpr int kSpansPerCell = 7;
+
+  struct alignas(ABSL_CACHELINE_SIZE) Cell {
+    // The span the cell was last updated in.
+    int64_t last_span;
+    // Tokens admitted within a span, in nanoseconds, indexed by span modulo
+    // kSpansPerCell.
+    int64_t span_tokens_ns[kSpansPerCell];
+  };
+
+  uint64_t CellIndex(int row, uint64_t key) const;
+
+  // Returns the cell of `key` in `row` with the expired spans zeroed.
+  Cell& CellAt(int row, uint64_t key, int64_t span);
+
+  // Returns the tokens of the cell over the window.
+  static int64_t Sum(const Cell& cell);
+
+  const int64_t span_ns_;
+  const int64_t heavy_ns_;
+  int64_t width_mask_;
+  int width_shift_;
+  std::unique_ptr<Cell[]> cells_;
+  KeyedTokenBucket exact_;
+  int64_t heavy_requests_ = 0;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_HEAVY_HITTER_TOKEN_BUCKET_H
@@ -0,0 +1,108 @@
+/*
+bazel test token_bucket:heavy_hitter_token_bucket_test
+*/
+
+#include "token_bucket/heavy_hitter_token_bucket.h"
+
+#include <cstdint>
+
+#include "absl/log/log.h"
+#include "absl/random/random.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace mogo {
+namespace {
+
+HeavyHitterTokenBucket::Options SmallOptions() {
+  HeavyHitterTokenBucket::Options options;
+  options.sketch_width = 1 << 12;
+  options.top_k = 64;
+  options.burst_tokens = absl::Milliseconds(10);
+  options.window = absl::Seconds(1);
+  options.heavy_fraction = 0.5;
+  return options;
+}
+
+TEST(HeavyHitterTokenBucketTest, EstimateSlidesWithTheWindow) {
+  HeavyHitterTokenBucket hh(SmallOptions());
+  int64_t now_ns = 1000000000000;
+  ASSERT_EQ(0, hh.TryGetTokensNs(42, now_ns, 1000));
+  ASSERT_EQ(0, hh.TryGetTokensNs(42, now_ns + 100000000, 2000));
+  ASSERT_EQ(3000, hh.EstimateNs(42, now_ns + 200000000));
+  ASSERT_EQ(0, hh.EstimateNs(43, now_ns + 200000000));
+  // Both requests slid out of the window.
+  ASSERT_EQ(0, hh.EstimateNs(42, now_ns + 1500000000));
+}
+
+// A key far above the rate is limited to about the rate once it is promoted.
+TEST(HeavyHitterTokenBucketTest, HeavyKeyIsLimited) {
+  const HeavyHitterTokenBucket::Options options = SmallOptions();
+  HeavyHitterTokenBucket hh(options);
+  const absl::Time start_time = absl::UnixEpoch() + absl::Hours(1);
+  const absl::Duration token = absl::Microseconds(100);
+  const absl::Duration test_duration = absl::Seconds(10);
+  int64_t admitted = 0;
+  for (absl::Time now = start_time; now < start_time + test_duration;
+       now += token / 10) {
+    if (hh.TryGetTokens(7, now, token) == absl::ZeroDuration()) {
+      ++admitted;
+    }
+  }
+  const double expected =
+      (test_duration + options.burst_tokens +
+       options.heavy_fraction * options.window) /
+      token;
+  LOG(INFO) << "Admitted: " << admitted << " expected at most: " << expected;
+  ASSERT_LE(admitted, expected + 1);
+  ASSERT_GE(admitted, test_duration / token);
+}
+
+// Many light keys share the sketch, none of them is limited and none of them
+// takes an exact bucket. Memory doesn't depend on the number of keys.
+TEST(HeavyHitterTokenBucketTest, LightKeysPassThrough) {
+  HeavyHitterTokenBucket hh(SmallOptions());
+  const int64_t memory_usage = hh.memory_usage();
+  LOG(INFO) << "Memory usage: " << memory_usage;
+  absl::BitGen gen;
+  int64_t now_ns = 1000000000000;
+  // 1M distinct keys at 1000 requests per second each 10us worth of tokens,
+  // 1% of the rate in total spread over the keys.
+  for (uint64_t i = 0; i < 1000000; ++i) {
+    const uint64_t key = absl::Uniform<uint64_t>(gen, 1, ~uint64_t{0});
+    ASSERT_EQ(0, hh.TryGetTokensNs(key, now_ns, 10000));
+    now_ns += 1000000;
+  }
+  ASSERT_EQ(0, hh.heavy_requests());
+  ASSERT_EQ(memory_usage, hh.memory_usage());
+}
+
+// Heavy keys hidden among a lot of light traffic are still found.
+TEST(HeavyHitterTokenBucketTest, HeavyKeysAmongLightTraffic) {
+  HeavyHitterTokenBucket hh(SmallOptions());
+  absl::BitGen gen;
+  const absl::Duration token = absl::Microseconds(100);
+  absl::Time now = absl::UnixEpoch() + absl::Hours(1);
+  int64_t heavy_admitted[4] = {};
+  const int64_t kSteps = 200000;
+  for (int64_t step = 0; step < kSteps; ++step) {
+    now += token / 4;
+    hh.TryGetTokens(absl::Uniform<uint64_t>(gen, 100, ~uint64_t{0}), now,
+                    token);
+    // 4 heavy keys at 4 times the rate.
+    for (uint64_t heavy_key = 1; heavy_key <= 4; ++heavy_key) {
+      if (hh.TryGetTokens(heavy_key, now, token) == absl::ZeroDuration()) {
+        ++heavy_admitted[heavy_key - 1];
+      }
+    }
+  }
+  const double rate_limit = (kSteps * token / 4) / token;
+  for (int64_t admitted : heavy_admitted) {
+    LOG(INFO) << "Heavy admitted: " << admitted << " rate: " << rate_limit;
+    ASSERT_LE(admitted, rate_limit * 1.1);
+  }
+  ASSERT_EQ(0, hh.forced_evictions());
+}
+
+}  // namespace
+}  // namespace mogo
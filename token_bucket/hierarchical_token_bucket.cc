@@ -0,0 +1,91 @@
+#include "token_bucket/hierarchical_token_bucket.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "absl/log/check.h"
+
+namespace mogo {
+
+HierarchicalTokenBucket::HierarchicalTokenBucket(
+    const NodeOptions& root_options) {
+  nodes_.push_back(MakeNode(root_options, /*parent=*/-1, /*depth=*/1));
+}
+
+HierarchicalTokenBucket::Node HierarchicalTokenBucket::MakeNode(
+    const NodeOptions& options, NodeId parent, int depth) const {
+  CHECK_GT(options.refill_rate, 0);
+  CHECK_GE(options.burst, absl::ZeroDuration());
+  Node node;
+  // Starts full, same as the BurstTokenBucket. The first charge clamps the
+  // zero time to `now - burst`.
+  node.zero_time_ns = std::numeric_limits<int64_t>::min();
+  node.ns_per_token = 1e9 / options.refill_rate;
+  node.burst_ns = absl::ToInt64Nanoseconds(options.burst);
+  node.parent = parent;
+  node.depth = depth;
+  node.can_borrow = options.can_borrow;
+  return node;
+}
+
+HierarchicalTokenBucket::NodeId HierarchicalTokenBucket::AddNode(
+    NodeId parent, const NodeOptions& options) {
+  CHECK_GE(parent, 0);
+  CHECK_LT(parent, static_cast<NodeId>(nodes_.size()));
+  Node& p = nodes_[parent];
+  CHECK_LT(p.depth, kMaxDepth) << "The tree is too deep";
+  p.children_rate += options.refill_rate;
+  // A tiny slack for the floating point rounding of rates like 1/3.
+  CHECK_LE(p.children_rate, 1e9 / p.ns_per_token * (1 + 1e-9))
+      << "The children of node " << parent
+      << " are assured more than the node's own rate";
+  nodes_.push_back(MakeNode(options, parent, p.depth + 1));
+  return static_cast<NodeId>(nodes_.size()) - 1;
+}
+
+absl::Duration HierarchicalTokenBucket::TryGetTokens(NodeId node,
+                                                     absl::Time now,
+                                                     double token_count) {
+  DCHECK_GE(node, 0);
+  DCHECK_LT(node, static_cast<NodeId>(nodes_.size()));
+  const int64_t now_ns = absl::ToUnixNanos(now);
+
+  // Find the lender, the first node on the path to the root that has tokens,
+  // and remember the path to charge it on the way back.
+  Node* path[kMaxDepth];
+  int path_len = 0;
+  int lender = -1;
+  int64_t min_delay_ns = std::numeric_limits<int64_t>::max();
+  for (NodeId i = node; i >= 0;) {
+    Node& n = nodes_[i];
+    path[path_len] = &n;
+    if (lender < 0) {
+      if (now_ns >= n.zero_time_ns) {
+        lender = path_len;
+      } else {
+        min_delay_ns = std::min(min_delay_ns, n.zero_time_ns - now_ns);
+        if (!n.can_borrow) {
+          // Nobody above is going to lend to this node.
+          return absl::Nanoseconds(min_delay_ns);
+        }
+      }
+    }
+    ++path_len;
+    i = n.parent;
+  }
+  if (lender < 0) {
+    return absl::Nanoseconds(min_delay_ns);
+  }
+
+  // Charge the lender and all its ancestors. The ancestors may not have tokens
+  // and go into debt, their children's assured rates are honored regardless.
+  for (int i = lender; i < path_len; ++i) {
+    Node& n = *path[i];
+    n.zero_time_ns = std::max(n.zero_time_ns, now_ns - n.burst_ns) +
+                     static_cast<int64_t>(token_count * n.ns_per_token);
+  }
+  return absl::ZeroDuration();
+}
+
+}  // namespace mogo
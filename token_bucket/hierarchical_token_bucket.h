@@ -0,0 +1,91 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_HIERARCHICAL_TOKEN_BUCKET_H
+#define MOGO_EXP_TOKEN_BUCKET_HIERARCHICAL_TOKEN_BUCKET_H
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/time/time.h"
+
+namespace mogo {
+
+/*
+HierarchicalTokenBucket limits a tree of rates, for example
+global -> tenant -> client, in a single call.
+
+Every node has a token bucket refilling at the node's assured rate. The assured
+rates of the children of a node must not add up to more than the rate of the
+node itself.
+
+A request issued by a node is admitted if some node on the path from the node
+to the root has tokens. The first such node is the lender:
+* If the node itself has tokens the request uses the node's assured rate.
+* Otherwise the node borrows from the closest ancestor that has tokens. The
+  assured share of idle siblings stays in the ancestor's bucket, so it is lent
+  to the busy ones rather than stranded.
+The lender and all its ancestors are charged for the request, potentially going
+into debt, which is how the parents learn about the rate their subtree is
+using. The nodes below the lender had no tokens and are not charged.
+
+A node created with `can_borrow = false` never borrows from its ancestors and is
+capped at its assured rate.
+
+The tree is built upfront with AddNode. TryGetTokens walks the path to the root
+once and doesn't allocate.
+
+Not thread-safe. This class is thread-compatible.
+*/
+class HierarchicalTokenBucket {
+ public:
+  using NodeId = int;
+
+  // The maximum number of nodes on the path from a node to the root, including
+  // both.
+  static constexpr int kMaxDepth = 8;
+
+  struct NodeOptions {
+    // The assured rate of the node in tokens per second.
+    double refill_rate = 1;
+    // Tokens, in units of time at `refill_rate`, the node is allowed to
+    // accumulate while idle. Same as in the BurstTokenBucket.
+    absl::Duration burst = absl::ZeroDuration();
+    // Whether the node may use tokens of its ancestors once it runs out of its
+    // own.
+    bool can_borrow = true;
+  };
+
+  // All nodes start with a full bucket.
+  explicit HierarchicalTokenBucket(const NodeOptions& root_options);
+
+  NodeId root() const { return 0; }
+
+  // Adds a child to `parent` and returns its id.
+  NodeId AddNode(NodeId parent, const NodeOptions& options);
+
+  // Attempts to extract the specified tokens on behalf of `node`.
+  // Returns absl::ZeroDuration() if the extraction was successful.
+  // Returns a delay that the caller should wait for until tokens are going to
+  // be available to `node`.
+  absl::Duration TryGetTokens(NodeId node, absl::Time now, double token_count);
+
+ private:
+  struct Node {
+    // The time when the node's bucket returns back to zero, in nanoseconds
+    // since the unix epoch. The node has tokens when `now_ns >= zero_time_ns`.
+    int64_t zero_time_ns;
+    double ns_per_token;
+    int64_t burst_ns;
+    NodeId parent;
+    int depth;
+    bool can_borrow;
+    // The sum of the assured rates of the children, used to validate the tree.
+    double children_rate = 0;
+  };
+
+  Node MakeNode(const NodeOptions& options, NodeId parent, int depth) const;
+
+  std::vector<Node> nodes_;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_HIERARCHICAL_TOKEN_BUCKET_H
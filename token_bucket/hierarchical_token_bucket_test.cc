@@ -0,0 +1,137 @@
+/*
+bazel test token_bucket:hierarchical_token_bucket_test
+*/
+
+#include "token_bucket/hierarchical_token_bucket.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace mogo {
+namespace {
+
+using NodeId = HierarchicalTokenBucket::NodeId;
+
+HierarchicalTokenBucket::NodeOptions Rate(double refill_rate) {
+  HierarchicalTokenBucket::NodeOptions options;
+  options.refill_rate = refill_rate;
+  return options;
+}
+
+// Simulates callers on the given nodes issuing requests as fast as they are
+// allowed for `duration`. Returns the admitted rate of every caller.
+std::vector<double> RunSimulation(HierarchicalTokenBucket& t, absl::Time& now,
+                                  const std::vector<NodeId>& callers,
+                                  absl::Duration duration) {
+  const absl::Time start_time = now;
+  const absl::Time end_time = now + duration;
+  std::vector<absl::Time> next_request(callers.size(), now);
+  std::vector<int64_t> request_count(callers.size(), 0);
+  while (now < end_time) {
+    size_t c = 0;
+    for (size_t i = 1; i < callers.size(); ++i) {
+      if (next_request[i] < next_request[c]) c = i;
+    }
+    now = next_request[c];
+    absl::Duration d = t.TryGetTokens(callers[c], now, 1);
+    if (d == absl::ZeroDuration()) {
+      ++request_count[c];
+      next_request[c] = now + absl::Microseconds(1);
+    } else {
+      next_request[c] = now + d;
+    }
+  }
+  std::vector<double> rates;
+  for (int64_t count : request_count) {
+    rates.push_back(count / absl::ToDoubleSeconds(now - start_time));
+  }
+  return rates;
+}
+
+class HierarchicalTokenBucketTest : public ::testing::Test {
+ protected:
+  // global: 1000 r/s
+  //   tenant_a: 500 r/s
+  //     client_a1: 250 r/s
+  //     client_a2: 250 r/s
+  //   tenant_b: 500 r/s
+  //     client_b1: 100 r/s, can't borrow
+  HierarchicalTokenBucketTest() : t_(Rate(1000)) {
+    tenant_a_ = t_.AddNode(t_.root(), Rate(500));
+    client_a1_ = t_.AddNode(tenant_a_, Rate(250));
+    client_a2_ = t_.AddNode(tenant_a_, Rate(250));
+    tenant_b_ = t_.AddNode(t_.root(), Rate(500));
+    auto no_borrow = Rate(100);
+    no_borrow.can_borrow = false;
+    client_b1_ = t_.AddNode(tenant_b_, no_borrow);
+  }
+
+  absl::Time now_ = absl::UnixEpoch();
+  HierarchicalTokenBucket t_;
+  NodeId tenant_a_;
+  NodeId client_a1_;
+  NodeId client_a2_;
+  NodeId tenant_b_;
+  NodeId client_b1_;
+};
+
+TEST_F(HierarchicalTokenBucketTest, SingleClientBorrowsEverything) {
+  auto rates = RunSimulation(t_, now_, {client_a1_}, absl::Seconds(10));
+  LOG(INFO) << "a1: " << rates[0];
+  ASSERT_NEAR(rates[0], 1000, 1);
+}
+
+TEST_F(HierarchicalTokenBucketTest, TenantsSplitTheGlobalRate) {
+  auto rates =
+      RunSimulation(t_, now_, {client_a1_, tenant_b_}, absl::Seconds(10));
+  LOG(INFO) << "a1: " << rates[0] << " b: " << rates[1];
+  ASSERT_NEAR(rates[0], 500, 5);
+  ASSERT_NEAR(rates[1], 500, 5);
+  ASSERT_NEAR(rates[0] + rates[1], 1000, 1);
+}
+
+TEST_F(HierarchicalTokenBucketTest, AssuredRatesAreHonored) {
+  auto rates = RunSimulation(t_, now_, {client_a1_, client_a2_, tenant_b_},
+                             absl::Seconds(10));
+  LOG(INFO) << "a1: " << rates[0] << " a2: " << rates[1]
+            << " b: " << rates[2];
+  ASSERT_GE(rates[0], 250 - 5);
+  ASSERT_GE(rates[1], 250 - 5);
+  ASSERT_GE(rates[2], 500 - 5);
+  ASSERT_NEAR(rates[0] + rates[1] + rates[2], 1000, 1);
+}
+
+TEST_F(HierarchicalTokenBucketTest, NoBorrowIsCapped) {
+  auto rates = RunSimulation(t_, now_, {client_b1_}, absl::Seconds(10));
+  LOG(INFO) << "b1: " << rates[0];
+  ASSERT_NEAR(rates[0], 100, 1);
+}
+
+TEST_F(HierarchicalTokenBucketTest, ChargesThePath) {
+  // The client has its own tokens, but the request is charged to the whole
+  // path so the tenant and the global bucket know about it.
+  ASSERT_EQ(absl::ZeroDuration(), t_.TryGetTokens(client_a1_, now_, 1));
+  // The client is in debt for 4ms, the tenant for 2ms, the global bucket for
+  // 1ms. The global bucket is the first one to lend again.
+  ASSERT_EQ(absl::Milliseconds(1), t_.TryGetTokens(client_a1_, now_, 1));
+
+  // The other tenant's client uses its assured rate even though the global
+  // bucket is in debt, the global bucket goes deeper into debt.
+  ASSERT_EQ(absl::ZeroDuration(), t_.TryGetTokens(client_b1_, now_, 1));
+  ASSERT_EQ(absl::Milliseconds(2), t_.TryGetTokens(client_a1_, now_, 1));
+  // The client can't borrow, so only its own bucket matters.
+  ASSERT_EQ(absl::Milliseconds(10), t_.TryGetTokens(client_b1_, now_, 1));
+}
+
+TEST(HierarchicalTokenBucketDeathTest, OversubscribedChildren) {
+  HierarchicalTokenBucket t(Rate(1000));
+  t.AddNode(t.root(), Rate(600));
+  ASSERT_DEATH(t.AddNode(t.root(), Rate(600)), "");
+}
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,359 @@
+#include "token_bucket/keyed_token_bucket.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "absl/base/prefetch.h"
+#include "absl/log/check.h"
+#include "absl/numeric/bits.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+
+namespace mogo {
+
+namespace {
+
+// Four 64-bit lanes. With AVX2 every operation below is a single instruction,
+// on narrower targets the compiler splits or scalarizes them, still without
+// branches.
+typedef int64_t Int64x4 __attribute__((vector_size(32)));
+
+constexpr int kLanes = sizeof(Int64x4) / sizeof(int64_t);
+
+constexpr char kSnapshotMagic[8] = {'T', 'B', 'K', 'E', 'Y', 'E', 'D', '1'};
+
+// The snapshot is this header followed by the table image. The header is as
+// large as a group so that the mapped groups stay aligned.
+struct SnapshotHeader {
+  char magic[8];
+  int64_t group_count;
+  int64_t burst_ns;
+  // The time of the snapshot in the time frame of the table.
+  int64_t snapshot_table_ns;
+  char reserved[32];
+};
+
+absl::Status WriteAll(int fd, const void* data, size_t size,
+                      const std::string& path) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t written = write(fd, p, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return absl::ErrnoToStatus(errno, absl::StrCat("write ", path));
+    }
+    p += written;
+    size -= written;
+  }
+  return absl::OkStatus();
+}
+
+// Makes a rename into the directory of `path` durable.
+absl::Status SyncDirectory(const std::string& path) {
+  const size_t slash = path.rfind('/');
+  std::string dir = ".";
+  if (slash == 0) {
+    dir = "/";
+  } else if (slash != std::string::npos) {
+    dir = path.substr(0, slash);
+  }
+  const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("open ", dir));
+  }
+  absl::Status status;
+  if (fsync(fd) != 0) {
+    status = absl::ErrnoToStatus(errno, absl::StrCat("fsync ", dir));
+  }
+  close(fd);
+  return status;
+}
+
+}  // namespace
+
+void KeyedTokenBucket::GroupsDeleter::operator()(Group* groups) const {
+  if (mapped_bytes == 0) {
+    delete[] groups;
+  } else {
+    munmap(reinterpret_cast<char*>(groups) - sizeof(SnapshotHeader),
+           mapped_bytes);
+  }
+}
+
+uint64_t KeyedTokenBucket::GroupCount(int64_t capacity) {
+  CHECK_GT(capacity, 0);
+  // At least two groups, a key may live in its home group or the next one.
+  return absl::bit_ceil(static_cast<uint64_t>(
+      std::max<int64_t>(2, (capacity + kSlotsPerGroup - 1) / kSlotsPerGroup)));
+}
+
+KeyedTokenBucket::KeyedTokenBucket(int64_t capacity,
+                                   absl::Duration burst_tokens)
+    : KeyedTokenBucket(absl::ToInt64Nanoseconds(burst_tokens),
+                       GroupCount(capacity),
+                       // Value-initialization zeroes the keys, marking all
+                       // slots empty.
+                       GroupsPtr(new Group[GroupCount(capacity)](),
+                                 GroupsDeleter{/*mapped_bytes=*/0}),
+                       /*time_offset_ns=*/0) {}
+
+KeyedTokenBucket::KeyedTokenBucket(int64_t burst_ns, uint64_t group_count,
+                                   GroupsPtr groups, int64_t time_offset_ns)
+    : burst_ns_(burst_ns),
+      group_mask_(group_count - 1),
+      group_shift_(64 - absl::countr_zero(group_count)),
+      time_offset_ns_(time_offset_ns),
+      groups_(std::move(groups)) {
+  CHECK_GE(burst_ns_, 0);
+  CHECK(absl::has_single_bit(group_count) && group_count >= 2) << group_count;
+}
+
+absl::Status KeyedTokenBucket::WriteSnapshot(const std::string& path,
+                                             absl::Time now) const {
+  static_assert(sizeof(SnapshotHeader) == sizeof(Group));
+  SnapshotHeader header = {};
+  memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.group_count = group_mask_ + 1;
+  header.burst_ns = burst_ns_;
+  header.snapshot_table_ns = absl::ToUnixNanos(now) - time_offset_ns_;
+
+  // Written next to the destination, synced and renamed over it, a crash
+  // never leaves a partial snapshot behind. The directory is synced after the
+  // rename so that the new name survives a power loss too.
+  const std::string tmp_path = absl::StrCat(path, ".tmp");
+  const int fd =
+      open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("open ", tmp_path));
+  }
+  absl::Status status = WriteAll(fd, &header, sizeof(header), tmp_path);
+  if (status.ok()) {
+    status = WriteAll(fd, groups_.get(), memory_usage(), tmp_path);
+  }
+  if (status.ok() && fsync(fd) != 0) {
+    status = absl::ErrnoToStatus(errno, absl::StrCat("fsync ", tmp_path));
+  }
+  if (close(fd) != 0 && status.ok()) {
+    status = absl::ErrnoToStatus(errno, absl::StrCat("close ", tmp_path));
+  }
+  if (status.ok() && rename(tmp_path.c_str(), path.c_str()) != 0) {
+    status = absl::ErrnoToStatus(errno, absl::StrCat("rename ", tmp_path));
+  }
+  if (!status.ok()) {
+    unlink(tmp_path.c_str());
+    return status;
+  }
+  return SyncDirectory(path);
+}
+
+absl::StatusOr<std::unique_ptr<KeyedTokenBucket>> KeyedTokenBucket::Restore(
+    const std::string& path, absl::Time now) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("open ", path));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    const int err = errno;
+    close(fd);
+    return absl::ErrnoToStatus(err, absl::StrCat("fstat ", path));
+  }
+  const size_t size = st.st_size;
+  if (size < sizeof(SnapshotHeader)) {
+    close(fd);
+    return absl::DataLossError(absl::StrCat(path, " is truncated"));
+  }
+  // Private, the buckets are updated in memory and the file stays as it is.
+  void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  const int err = errno;
+  // The mapping keeps the file alive.
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return absl::ErrnoToStatus(err, absl::StrCat("mmap ", path));
+  }
+  const SnapshotHeader& header = *static_cast<const SnapshotHeader*>(addr);
+  absl::Status status;
+  if (memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0) {
+    status = absl::DataLossError(
+        absl::StrCat(path, " is not a KeyedTokenBucket snapshot"));
+  } else if (header.group_count < 2 ||
+             !absl::has_single_bit(
+                 static_cast<uint64_t>(header.group_count)) ||
+             header.burst_ns < 0 ||
+             size != sizeof(SnapshotHeader) +
+                         static_cast<uint64_t>(header.group_count) *
+                             sizeof(Group)) {
+    status = absl::DataLossError(absl::StrCat(path, " is corrupted"));
+  }
+  if (!status.ok()) {
+    munmap(addr, size);
+    return status;
+  }
+
+  GroupsPtr groups(reinterpret_cast<Group*>(static_cast<char*>(addr) +
+                                            sizeof(SnapshotHeader)),
+                   GroupsDeleter{size});
+  // Re-base: the snapshot time maps to `now`.
+  const int64_t time_offset_ns =
+      absl::ToUnixNanos(now) - header.snapshot_table_ns;
+  return std::unique_ptr<KeyedTokenBucket>(
+      new KeyedTokenBucket(header.burst_ns, header.group_count,
+                           std::move(groups), time_offset_ns));
+}
+
+KeyedTokenBucket::Slot& KeyedTokenBucket::FindOrInsert(uint64_t key,
+                                                       int64_t now_ns) {
+  DCHECK_NE(key, kEmptyKey);
+  // A bucket with the zero time at or before `full_ns` is full.
+  const int64_t full_ns = now_ns - burst_ns_;
+  // The slot to claim if the key is not in the table, preferring the first
+  // full bucket, otherwise the bucket closest to being full.
+  Slot* victim = nullptr;
+  bool victim_is_full = false;
+
+  uint64_t g = HomeGroup(key);
+  for (int probe = 0; probe < 2; ++probe) {
+    Group& group = groups_[g];
+    for (Slot& slot : group.slots) {
+      if (slot.key == key) {
+        return slot;
+      }
+      if (slot.key == kEmptyKey) {
+        // Slots are never emptied, so the key can't be further down the probe
+        // sequence.
+        if (!victim_is_full) {
+          victim = &slot;
+        }
+        victim->key = key;
+        victim->zero_time_ns = full_ns;
+        return *victim;
+      }
+      if (victim_is_full) {
+        continue;
+      }
+      if (slot.zero_time_ns <= full_ns) {
+        victim = &slot;
+        victim_is_full = true;
+      } else if (victim == nullptr ||
+                 slot.zero_time_ns < victim->zero_time_ns) {
+        victim = &slot;
+      }
+    }
+    g = (g + 1) & group_mask_;
+  }
+
+  if (ABSL_PREDICT_FALSE(!victim_is_full)) {
+    ++forced_evictions_;
+  }
+  victim->key = key;
+  victim->zero_time_ns = full_ns;
+  return *victim;
+}
+
+int64_t KeyedTokenBucket::TryGetTokensTableNs(uint64_t key, int64_t now_ns,
+                                              int64_t tokens_ns) {
+  Slot& slot = FindOrInsert(key, now_ns);
+  // Same as BurstTokenBucket: allow the request through if the bucket is not
+  // in debt, never accumulate more than `burst_ns_` of tokens.
+  if (now_ns >= slot.zero_time_ns) {
+    slot.zero_time_ns =
+        std::max(slot.zero_time_ns, now_ns - burst_ns_) + tokens_ns;
+    return 0;
+  }
+  return slot.zero_time_ns - now_ns;
+}
+
+void KeyedTokenBucket::Prefetch(uint64_t key) const {
+  absl::PrefetchToLocalCache(&groups_[HomeGroup(key)]);
+}
+
+void KeyedTokenBucket::TryGetTokensChunk(const Request* requests,
+                                         Slot* const* slots, int len,
+                                         int64_t now_ns, int64_t* delays_ns) {
+  static_assert(kBatchChunkSize % kLanes == 0);
+  // Unused lanes are padded with a bucket in debt and are never written back.
+  alignas(sizeof(Int64x4)) int64_t zero_time_ns[kBatchChunkSize];
+  alignas(sizeof(Int64x4)) int64_t tokens_ns[kBatchChunkSize];
+  alignas(sizeof(Int64x4)) int64_t delay_ns[kBatchChunkSize];
+  for (int i = 0; i < kBatchChunkSize; ++i) {
+    zero_time_ns[i] = i < len ? slots[i]->zero_time_ns : now_ns + 1;
+    tokens_ns[i] = i < len ? requests[i].tokens_ns : 0;
+  }
+
+  // The vectorized version of TryGetTokensNs:
+  // admit = now >= zero_time
+  // zero_time = admit ? max(zero_time, now - burst) + tokens : zero_time
+  // delay = admit ? 0 : zero_time - now
+  Int64x4 now = {};
+  now += now_ns;
+  const Int64x4 full = now - burst_ns_;
+  for (int i = 0; i < kBatchChunkSize; i += kLanes) {
+    Int64x4 zero_time;
+    Int64x4 tokens;
+    memcpy(&zero_time, &zero_time_ns[i], sizeof(zero_time));
+    memcpy(&tokens, &tokens_ns[i], sizeof(tokens));
+    // The comparisons produce all-ones lanes for true, the selects are masks.
+    const Int64x4 admit = now >= zero_time;
+    const Int64x4 not_full = zero_time > full;
+    const Int64x4 charged =
+        ((not_full & zero_time) | (~not_full & full)) + tokens;
+    const Int64x4 delay = ~admit & (zero_time - now);
+    zero_time = (admit & charged) | (~admit & zero_time);
+    memcpy(&zero_time_ns[i], &zero_time, sizeof(zero_time));
+    memcpy(&delay_ns[i], &delay, sizeof(delay));
+  }
+
+  for (int i = 0; i < len; ++i) {
+    slots[i]->zero_time_ns = zero_time_ns[i];
+    delays_ns[i] = delay_ns[i];
+  }
+}
+
+void KeyedTokenBucket::TryGetTokensBatch(absl::Span<const Request> requests,
+                                         int64_t now_ns,
+                                         absl::Span<int64_t> delays_ns) {
+  DCHECK_EQ(requests.size(), delays_ns.size());
+  now_ns -= time_offset_ns_;
+  const size_t n = requests.size();
+  for (size_t i = 0; i < std::min<size_t>(n, kPrefetchDistance); ++i) {
+    Prefetch(requests[i].key);
+  }
+
+  Slot* slots[kBatchChunkSize];
+  for (size_t start = 0; start < n; start += kBatchChunkSize) {
+    const int len = std::min<size_t>(kBatchChunkSize, n - start);
+    bool duplicate = false;
+    for (int i = 0; i < len; ++i) {
+      if (start + i + kPrefetchDistance < n) {
+        Prefetch(requests[start + i + kPrefetchDistance].key);
+      }
+      slots[i] = &FindOrInsert(requests[start + i].key, now_ns);
+      for (int j = 0; j < i; ++j) {
+        duplicate |= slots[i] == slots[j];
+      }
+    }
+    if (ABSL_PREDICT_FALSE(duplicate)) {
+      // The same bucket is charged several times, or a slot was claimed by a
+      // later key, the requests have to be evaluated in order.
+      for (int i = 0; i < len; ++i) {
+        const Request& r = requests[start + i];
+        delays_ns[start + i] = TryGetTokensTableNs(r.key, now_ns, r.tokens_ns);
+      }
+      continue;
+    }
+    TryGetTokensChunk(&requests[start], slots, len, now_ns, &delays_ns[start]);
+  }
+}
+
+}  // namespace mogo
@@ -0,0 +1,165 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_KEYED_TOKEN_BUCKET_H
+#define MOGO_EXP_TOKEN_BUCKET_KEYED_TOKEN_BUCKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+
+namespace mogo {
+
+/*
+KeyedTokenBucket keeps one BurstTokenBucket per key, for example per API key,
+in a fixed-size open-addressed table.
+
+Each bucket is 16 bytes: the 64-bit key and the 64-bit zero time. Keys are
+typically fingerprints of the real client identifier, key 0 is reserved.
+
+A bucket that has fully refilled, i.e. its zero time is at or before
+`now - burst`, is indistinguishable from a fresh bucket. Such buckets are not
+removed eagerly, their slots are simply reused by new keys. The table never
+grows, so memory stays flat no matter how many distinct keys pass through it.
+
+Slots are grouped by four into cache-line sized groups and a key only ever
+lives in its home group or the group after it, so an admission usually costs a
+single cache miss. If both groups are full of buckets that are still in debt,
+the bucket closest to being full is evicted and forgets its debt. Size the
+table so that the number of keys active within a `burst` fits comfortably, the
+number of such evictions is reported by `forced_evictions()`.
+
+The table can be carried across a restart so that buckets don't all come back
+full. WriteSnapshot writes the table image to a file with one sequential write,
+Restore maps the file copy-on-write and uses it as the table directly, so
+restoring takes the same time for 10M keys as for 10, pages are read lazily on
+first access. Times are re-based to the restoring process's `now`: every bucket
+owes exactly the debt it had when the snapshot was written, the downtime
+doesn't refill it. The snapshot is in native byte order.
+
+Not thread-safe. This class is thread-compatible.
+*/
+class KeyedTokenBucket {
+ public:
+  // `capacity` is the number of buckets, rounded up to a power of two.
+  KeyedTokenBucket(int64_t capacity, absl::Duration burst_tokens);
+
+  // Restores a table written by WriteSnapshot, with the capacity and burst of
+  // the table that wrote it.
+  static absl::StatusOr<std::unique_ptr<KeyedTokenBucket>> Restore(
+      const std::string& path, absl::Time now);
+
+  // Writes the state of all buckets at `now` to `path`. The file is replaced
+  // atomically and is durable once this returns OK.
+  absl::Status WriteSnapshot(const std::string& path, absl::Time now) const;
+
+  // Attempts to extract the specified tokens from the bucket of `key`.
+  // Returns absl::ZeroDuration() if the extraction was successful.
+  // Returns a delay that the caller should wait for until tokens are going to
+  // be available.
+  absl::Duration TryGetTokens(uint64_t key, absl::Time now,
+                              absl::Duration tokens) {
+    return absl::Nanoseconds(TryGetTokensNs(key, absl::ToUnixNanos(now),
+                                            absl::ToInt64Nanoseconds(tokens)));
+  }
+
+  // Same as TryGetTokens, but in nanoseconds since the unix epoch.
+  int64_t TryGetTokensNs(uint64_t key, int64_t now_ns, int64_t tokens_ns) {
+    return TryGetTokensTableNs(key, now_ns - time_offset_ns_, tokens_ns);
+  }
+
+  struct Request {
+    uint64_t key;
+    int64_t tokens_ns;
+  };
+
+  // Same as calling TryGetTokensNs for every request in order, all at
+  // `now_ns`. `delays_ns[i]` receives the result for `requests[i]`. The only
+  // difference is in which buckets get evicted when the table overflows.
+  //
+  // Prefetches the groups of the upcoming requests while the current ones are
+  // processed and evaluates the buckets of kBatchChunkSize requests at a time
+  // with branch-free vector compare/select. Chunks that touch the same bucket
+  // more than once fall back to the one-by-one evaluation.
+  void TryGetTokensBatch(absl::Span<const Request> requests, int64_t now_ns,
+                         absl::Span<int64_t> delays_ns);
+
+  int64_t capacity() const { return (group_mask_ + 1) * kSlotsPerGroup; }
+
+  // The number of buckets that were evicted before they fully refilled.
+  int64_t forced_evictions() const { return forced_evictions_; }
+
+  // Bytes used by the table.
+  int64_t memory_usage() const { return (group_mask_ + 1) * sizeof(Group); }
+
+ private:
+  struct Slot {
+    uint64_t key;
+    // The time when the bucket returns back to zero, in nanoseconds since the
+    // unix epoch.
+    int64_t zero_time_ns;
+  };
+
+  static constexpr int kSlotsPerGroup = 4;
+  // The number of requests evaluated together by TryGetTokensBatch.
+  static constexpr int kBatchChunkSize = 8;
+  // How many requests ahead TryGetTokensBatch prefetches.
+  static constexpr int kPrefetchDistance = 16;
+  static constexpr uint64_t kEmptyKey = 0;
+
+  struct alignas(ABSL_CACHELINE_SIZE) Group {
+    Slot slots[kSlotsPerGroup];
+  };
+
+  struct GroupsDeleter {
+    void operator()(Group* groups) const;
+
+    // The size of the mapping when the groups live in a restored snapshot,
+    // zero when they are allocated.
+    size_t mapped_bytes = 0;
+  };
+
+  using GroupsPtr = std::unique_ptr<Group[], GroupsDeleter>;
+
+  static uint64_t GroupCount(int64_t capacity);
+
+  KeyedTokenBucket(int64_t burst_ns, uint64_t group_count, GroupsPtr groups,
+                   int64_t time_offset_ns);
+
+  // TryGetTokensNs in the time frame of the table.
+  int64_t TryGetTokensTableNs(uint64_t key, int64_t table_ns,
+                              int64_t tokens_ns);
+
+  uint64_t HomeGroup(uint64_t key) const {
+    // Fibonacci hashing, the high bits of the product are the best mixed.
+    return (key * 0x9E3779B97F4A7C15ull) >> group_shift_;
+  }
+
+  // Returns the slot of `key`. If the key is not in the table claims a slot
+  // for it with a full bucket.
+  Slot& FindOrInsert(uint64_t key, int64_t now_ns);
+
+  void Prefetch(uint64_t key) const;
+
+  // Evaluates up to kBatchChunkSize requests that are known to use distinct
+  // slots.
+  void TryGetTokensChunk(const Request* requests, Slot* const* slots, int len,
+                         int64_t now_ns, int64_t* delays_ns);
+
+  const int64_t burst_ns_;
+  int64_t group_mask_;
+  int group_shift_;
+  // The zero times in the table are `time_offset_ns_` behind the time callers
+  // pass in. Zero unless the table was restored from a snapshot.
+  const int64_t time_offset_ns_;
+  int64_t forced_evictions_ = 0;
+  GroupsPtr groups_;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_KEYED_TOKEN_BUCKET_H
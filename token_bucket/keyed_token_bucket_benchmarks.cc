@@ -0,0 +1,161 @@
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "benchmark/benchmark.h"
+#include "token_bucket/keyed_token_bucket.h"
+
+/*
+sudo cpufreq-set -g performance
+
+bazel test -c opt --copt=-mavx2 --dynamic_mode=off --test_output=streamed \
+  --cache_test_results=no token_bucket:keyed_token_bucket_benchmarks \
+  --test_arg=--benchmark_filter=all \
+  --test_arg=--benchmark_repetitions=1 \
+  --test_arg=--benchmark_enable_random_interleaving=false
+
+sudo cpufreq-set -g powersave
+
+Both benchmarks process the same batches of random keys drawn from a key
+population much larger than the CPU caches, `items_per_second` is requests per
+second.
+*/
+
+namespace mogo {
+namespace {
+
+constexpr int64_t kCapacity = 1 << 22;
+constexpr uint64_t kKeyCount = kCapacity / 2;
+// Requests are replayed from a pre-generated pool large enough to miss the CPU
+// caches.
+constexpr int kRequestCount = 1 << 18;
+
+class KeyedBenchmarkState {
+ public:
+  explicit KeyedBenchmarkState(int batch_size)
+      : tb_(kCapacity, absl::Microseconds(100)), batch_size_(batch_size) {
+    absl::InsecureBitGen gen;
+    for (int i = 0; i < kRequestCount; ++i) {
+      requests_.push_back(
+          {absl::Uniform<uint64_t>(gen, 1, kKeyCount + 1), /*tokens_ns=*/10});
+    }
+    delays_ns_.resize(batch_size);
+  }
+
+  KeyedTokenBucket& tb() { return tb_; }
+
+  absl::Span<const KeyedTokenBucket::Request> Batch(int64_t i) const {
+    return absl::MakeConstSpan(requests_).subspan(
+        (i % (kRequestCount / batch_size_)) * batch_size_, batch_size_);
+  }
+
+  absl::Span<int64_t> delays_ns() { return absl::MakeSpan(delays_ns_); }
+
+ private:
+  KeyedTokenBucket tb_;
+  const int batch_size_;
+  std::vector<KeyedTokenBucket::Request> requests_;
+  std::vector<int64_t> delays_ns_;
+};
+
+void BM_KeyedScalarLoop(benchmark::State& state) {
+  KeyedBenchmarkState b(state.range(0));
+  int64_t now_ns = 1000000000;
+  int64_t i = 0;
+  int64_t admits = 0;
+  for (auto s : state) {
+    for (const auto& r : b.Batch(i++)) {
+      admits += b.tb().TryGetTokensNs(r.key, now_ns, r.tokens_ns) == 0;
+    }
+    now_ns += 1000;
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  VLOG(2) << admits;
+}
+BENCHMARK(BM_KeyedScalarLoop)->Arg(64)->Arg(256);
+
+void BM_KeyedBatch(benchmark::State& state) {
+  KeyedBenchmarkState b(state.range(0));
+  int64_t now_ns = 1000000000;
+  int64_t i = 0;
+  for (auto s : state) {
+    b.tb().TryGetTokensBatch(b.Batch(i++), now_ns, b.delays_ns());
+    benchmark::DoNotOptimize(b.delays_ns().data());
+    now_ns += 1000;
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_KeyedBatch)->Arg(64)->Arg(256);
+
+// Writing and restoring a snapshot of a table with 10M keys.
+class SnapshotBenchmarkState {
+ public:
+  static constexpr int64_t kKeys = 10000000;
+
+  SnapshotBenchmarkState()
+      : tb_(kKeys * 3 / 2, absl::Microseconds(100)),
+        path_(absl::StrCat(getenv("TEST_TMPDIR") ? getenv("TEST_TMPDIR")
+                                                 : "/tmp",
+                           "/keyed_snapshot_benchmark")) {
+    for (uint64_t key = 1; key <= kKeys; ++key) {
+      tb_.TryGetTokensNs(key, now_ns_, 1000);
+    }
+  }
+
+  ~SnapshotBenchmarkState() { unlink(path_.c_str()); }
+
+  KeyedTokenBucket& tb() { return tb_; }
+  const std::string& path() const { return path_; }
+  absl::Time now() const { return absl::FromUnixNanos(now_ns_); }
+
+ private:
+  const int64_t now_ns_ = 1000000000;
+  KeyedTokenBucket tb_;
+  const std::string path_;
+};
+
+void BM_KeyedWriteSnapshot(benchmark::State& state) {
+  SnapshotBenchmarkState b;
+  for (auto s : state) {
+    absl::Status status = b.tb().WriteSnapshot(b.path(), b.now());
+    CHECK(status.ok()) << status;
+  }
+  state.SetBytesProcessed(state.iterations() * b.tb().memory_usage());
+}
+BENCHMARK(BM_KeyedWriteSnapshot)->Unit(benchmark::kMillisecond);
+
+// Restore alone, and restore followed by a lookup of every key, which reads
+// all pages of the snapshot.
+void BM_KeyedRestore(benchmark::State& state) {
+  SnapshotBenchmarkState b;
+  absl::Status status = b.tb().WriteSnapshot(b.path(), b.now());
+  CHECK(status.ok()) << status;
+  const bool touch_all = state.range(0);
+  for (auto s : state) {
+    absl::StatusOr<std::unique_ptr<KeyedTokenBucket>> r =
+        KeyedTokenBucket::Restore(b.path(), b.now());
+    CHECK(r.ok()) << r.status();
+    if (touch_all) {
+      int64_t now_ns = absl::ToUnixNanos(b.now());
+      for (uint64_t key = 1; key <= SnapshotBenchmarkState::kKeys; ++key) {
+        benchmark::DoNotOptimize((*r)->TryGetTokensNs(key, now_ns, 1000));
+      }
+    }
+  }
+}
+BENCHMARK(BM_KeyedRestore)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,184 @@
+/*
+bazel test token_bucket:keyed_token_bucket_test
+*/
+
+#include "token_bucket/keyed_token_bucket.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "token_bucket/burst_token_bucket.h"
+
+namespace mogo {
+namespace {
+
+TEST(KeyedTokenBucketTest, MatchesBurstTokenBucket) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  absl::Duration burst = token * 3;
+  KeyedTokenBucket kb(/*capacity=*/16, burst);
+  BurstTokenBucket btb(now, burst);
+
+  for (int i = 0; i < 10000; ++i) {
+    absl::Duration expected = btb.TryGetTokens(now, token);
+    ASSERT_EQ(expected, kb.TryGetTokens(/*key=*/42, now, token)) << i;
+    // An irregular sequence of time steps, sometimes long enough to refill.
+    now += absl::Microseconds((i * 7919) % 1500);
+  }
+  ASSERT_EQ(0, kb.forced_evictions());
+}
+
+TEST(KeyedTokenBucketTest, KeysAreIndependent) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  KeyedTokenBucket kb(/*capacity=*/16, /*burst_tokens=*/absl::ZeroDuration());
+
+  ASSERT_EQ(absl::ZeroDuration(), kb.TryGetTokens(1, now, token));
+  ASSERT_EQ(token, kb.TryGetTokens(1, now, token));
+  ASSERT_EQ(absl::ZeroDuration(), kb.TryGetTokens(2, now, token));
+  ASSERT_EQ(token, kb.TryGetTokens(2, now, token));
+  now += token;
+  ASSERT_EQ(absl::ZeroDuration(), kb.TryGetTokens(1, now, token));
+  ASSERT_EQ(absl::ZeroDuration(), kb.TryGetTokens(2, now, token));
+}
+
+TEST(KeyedTokenBucketTest, ChurnDoesNotLoseDebt) {
+  absl::Time now = absl::UnixEpoch();
+  const absl::Duration token = absl::Milliseconds(1);
+  const absl::Duration burst = token * 10;
+  KeyedTokenBucket kb(/*capacity=*/1024, burst);
+  const int64_t memory_usage = kb.memory_usage();
+  LOG(INFO) << "Capacity: " << kb.capacity()
+            << " memory usage: " << memory_usage;
+
+  // A client that stays in debt for the whole test.
+  const uint64_t kHeavyKey = 1;
+  const absl::Time heavy_zero_time = now + absl::Seconds(200);
+  ASSERT_EQ(absl::ZeroDuration(),
+            kb.TryGetTokens(kHeavyKey, now, absl::Seconds(200) + burst));
+
+  // 1M distinct keys, every key is used once and is full again after 10 more
+  // keys, so its slot can be reused.
+  for (uint64_t key = 2; key < 1000000; ++key) {
+    ASSERT_EQ(absl::ZeroDuration(), kb.TryGetTokens(key, now, token));
+    now += burst / 100;
+    if (key % 1000 == 0) {
+      ASSERT_EQ(heavy_zero_time - now, kb.TryGetTokens(kHeavyKey, now, token));
+    }
+  }
+  ASSERT_EQ(0, kb.forced_evictions());
+  ASSERT_EQ(memory_usage, kb.memory_usage());
+}
+
+TEST(KeyedTokenBucketTest, Overflow) {
+  absl::Time now = absl::UnixEpoch();
+  const absl::Duration token = absl::Milliseconds(1);
+  KeyedTokenBucket kb(/*capacity=*/8, /*burst_tokens=*/absl::ZeroDuration());
+  // More keys in debt than the table can hold, the ones closest to the zero
+  // time are evicted.
+  for (uint64_t key = 1; key <= 100; ++key) {
+    ASSERT_EQ(absl::ZeroDuration(), kb.TryGetTokens(key, now, token * key));
+  }
+  LOG(INFO) << "Forced evictions: " << kb.forced_evictions();
+  ASSERT_EQ(100 - kb.capacity(), kb.forced_evictions());
+}
+
+TEST(KeyedTokenBucketTest, BatchMatchesOneByOne) {
+  absl::BitGen gen;
+  const int64_t burst_ns = 1000;
+  KeyedTokenBucket batch(/*capacity=*/256, absl::Nanoseconds(burst_ns));
+  KeyedTokenBucket one_by_one(/*capacity=*/256, absl::Nanoseconds(burst_ns));
+  int64_t now_ns = 1000000;
+  std::vector<KeyedTokenBucket::Request> requests;
+  std::vector<int64_t> delays_ns;
+  for (int round = 0; round < 1000; ++round) {
+    // Few distinct keys, so the batches regularly charge the same bucket more
+    // than once.
+    const int batch_size = absl::Uniform(gen, 1, 300);
+    requests.clear();
+    for (int i = 0; i < batch_size; ++i) {
+      requests.push_back({absl::Uniform<uint64_t>(gen, 1, 100),
+                          absl::Uniform<int64_t>(gen, 0, 2 * burst_ns)});
+    }
+    delays_ns.assign(batch_size, -1);
+    batch.TryGetTokensBatch(requests, now_ns, absl::MakeSpan(delays_ns));
+    for (int i = 0; i < batch_size; ++i) {
+      ASSERT_EQ(one_by_one.TryGetTokensNs(requests[i].key, now_ns,
+                                          requests[i].tokens_ns),
+                delays_ns[i])
+          << "round: " << round << " i: " << i;
+    }
+    now_ns += absl::Uniform<int64_t>(gen, 0, 2 * burst_ns);
+  }
+  // Once buckets in debt get evicted the order of evaluation affects which
+  // ones, the results are only comparable without such evictions.
+  ASSERT_EQ(0, batch.forced_evictions());
+}
+
+TEST(KeyedTokenBucketTest, SnapshotRestore) {
+  absl::Time now = absl::UnixEpoch() + absl::Hours(1);
+  const absl::Duration token = absl::Milliseconds(1);
+  const absl::Duration burst = token * 3;
+  const std::string path =
+      absl::StrCat(::testing::TempDir(), "/keyed_snapshot");
+  KeyedTokenBucket kb(/*capacity=*/1024, burst);
+  // Key `k` goes below zero by `k` tokens.
+  for (uint64_t key = 1; key <= 100; ++key) {
+    ASSERT_EQ(absl::ZeroDuration(), kb.TryGetTokens(key, now, burst));
+    ASSERT_EQ(absl::ZeroDuration(), kb.TryGetTokens(key, now, token * key));
+  }
+  ASSERT_TRUE(kb.WriteSnapshot(path, now).ok());
+
+  // Restored a day later, the buckets still owe their debt.
+  now += absl::Hours(24);
+  absl::StatusOr<std::unique_ptr<KeyedTokenBucket>> restored =
+      KeyedTokenBucket::Restore(path, now);
+  ASSERT_TRUE(restored.ok()) << restored.status();
+  KeyedTokenBucket& r = **restored;
+  ASSERT_EQ(kb.capacity(), r.capacity());
+  for (uint64_t key = 1; key <= 100; ++key) {
+    ASSERT_EQ(token * key, r.TryGetTokens(key, now, token)) << key;
+  }
+  // Unknown keys and the batch path see the re-based time as well.
+  std::vector<KeyedTokenBucket::Request> requests = {
+      {1, absl::ToInt64Nanoseconds(token)},
+      {1000, absl::ToInt64Nanoseconds(token)}};
+  std::vector<int64_t> delays_ns(requests.size());
+  now += token;
+  r.TryGetTokensBatch(requests, absl::ToUnixNanos(now),
+                      absl::MakeSpan(delays_ns));
+  ASSERT_EQ(std::vector<int64_t>({0, 0}), delays_ns);
+
+  // A snapshot of the restored table restores to the same state.
+  ASSERT_TRUE(r.WriteSnapshot(path, now).ok());
+  now += absl::Hours(1);
+  restored = KeyedTokenBucket::Restore(path, now);
+  ASSERT_TRUE(restored.ok()) << restored.status();
+  ASSERT_EQ(token, (*restored)->TryGetTokens(1, now, token));
+  ASSERT_EQ(token * 49, (*restored)->TryGetTokens(50, now, token));
+}
+
+TEST(KeyedTokenBucketTest, RestoreRejectsOtherFiles) {
+  const std::string path = absl::StrCat(::testing::TempDir(), "/not_snapshot");
+  FILE* f = fopen(path.c_str(), "w");
+  ASSERT_NE(nullptr, f);
+  fputs("hello", f);
+  fclose(f);
+  ASSERT_EQ(absl::StatusCode::kDataLoss,
+            KeyedTokenBucket::Restore(path, absl::Now()).status().code());
+  ASSERT_FALSE(KeyedTokenBucket::Restore(path + "_missing", absl::Now()).ok());
+}
+
+}  // namespace
+}  // namespace mogo
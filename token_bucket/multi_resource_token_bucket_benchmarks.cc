@@ -0,0 +1,83 @@
+#include <cstdint>
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "token_bucket/burst_token_bucket.h"
+#include "token_bucket/clock_domain.h"
+#include "token_bucket/multi_resource_token_bucket.h"
+
+/*
+sudo cpufreq-set -g performance
+
+bazel test -c opt --dynamic_mode=off --test_output=streamed \
+  --cache_test_results=no token_bucket:multi_resource_token_bucket_benchmarks \
+  --test_arg=--benchmark_filter=all \
+  --test_arg=--benchmark_repetitions=1 \
+  --test_arg=--benchmark_enable_random_interleaving=false
+
+sudo cpufreq-set -g powersave
+
+A bytes and an ops limit checked in one MultiResourceTokenBucket against two
+BurstTokenBucket checked one after the other, which charges the bytes bucket
+even when the ops bucket refuses. The ops limit is the bottleneck. Op sizes
+alternate between 4KB and 64KB, the synthetic clock moves by a fixed step.
+*/
+
+namespace mogo {
+namespace {
+
+constexpr double kBytesRate = 1e9;
+constexpr double kOpsRate = 1e4;
+constexpr absl::Duration kStep = absl::Nanoseconds(500);
+constexpr absl::Duration kBurst = absl::Microseconds(100);
+
+template <typename Domain>
+void BM_MultiResource(benchmark::State& state) {
+  const auto step = Domain::FromDuration(kStep);
+  const auto burst = Domain::FromDuration(kBurst);
+  auto now = Domain::Now();
+  BasicMultiResourceTokenBucket<Domain, 2> t(now, {kBytesRate, kOpsRate},
+                                             {burst, burst});
+  typename Domain::TokenCount op_size = 4096;
+  int64_t admits = 0;
+  for (auto s : state) {
+    now += step;
+    op_size = 4096 + 65536 - op_size;
+    admits += t.TryGetTokens(now, {op_size, 1}) == Domain::Zero();
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["admits"] = benchmark::Counter(
+      admits, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_MultiResource<AbslTimeDomain>);
+BENCHMARK(BM_MultiResource<NanosDomain>);
+
+template <typename Domain>
+void BM_TwoBuckets(benchmark::State& state) {
+  const auto step = Domain::FromDuration(kStep);
+  const auto burst = Domain::FromDuration(kBurst);
+  const auto byte_cost = Domain::CostPerToken(kBytesRate);
+  const auto op_cost = Domain::CostPerToken(kOpsRate);
+  auto now = Domain::Now();
+  BasicBurstTokenBucket<Domain> bytes(now, burst);
+  BasicBurstTokenBucket<Domain> ops(now, burst);
+  typename Domain::TokenCount op_size = 4096;
+  int64_t admits = 0;
+  for (auto s : state) {
+    now += step;
+    op_size = 4096 + 65536 - op_size;
+    admits += bytes.TryGetTokens(now, Domain::CostOf(byte_cost, op_size)) ==
+                  Domain::Zero() &&
+              ops.TryGetTokens(now, Domain::CostOf(op_cost, 1)) ==
+                  Domain::Zero();
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["admits"] = benchmark::Counter(
+      admits, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_TwoBuckets<AbslTimeDomain>);
+BENCHMARK(BM_TwoBuckets<NanosDomain>);
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,87 @@
+/*
+bazel test token_bucket:multi_resource_token_bucket_test
+*/
+
+#include "token_bucket/multi_resource_token_bucket.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "token_bucket/clock_domain.h"
+
+namespace mogo {
+namespace {
+
+TEST(MultiResourceTokenBucketTest, AllLanesMustAllow) {
+  absl::Time now = absl::UnixEpoch();
+  // 1MB/s and 100 ops/s, no burst.
+  MultiResourceTokenBucket<2> t(now, {1e6, 100},
+                                {absl::ZeroDuration(), absl::ZeroDuration()});
+  LOG(INFO) << t;
+
+  // A 100KB op owes 100ms of bytes and 10ms of ops.
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, {100000, 1}));
+  ASSERT_EQ(absl::Milliseconds(100), t.TryGetTokens(now, {1000, 1}));
+  now += absl::Milliseconds(100);
+  // Small ops are limited by the ops lane.
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, {1000, 1}));
+  ASSERT_EQ(absl::Milliseconds(10), t.TryGetTokens(now, {1000, 1}));
+  now += absl::Milliseconds(10);
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, {1000, 1}));
+}
+
+// A refused request doesn't charge any lane.
+TEST(MultiResourceTokenBucketTest, RefusalChargesNothing) {
+  absl::Time now = absl::UnixEpoch();
+  MultiResourceTokenBucket<2> t(now, {1e6, 100},
+                                {absl::ZeroDuration(), absl::ZeroDuration()});
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, {0, 1}));
+  // The bytes lane would allow, the ops lane refuses.
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_EQ(absl::Milliseconds(10), t.TryGetTokens(now, {100000, 1}));
+  }
+  now += absl::Milliseconds(10);
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, {100000, 1}));
+}
+
+TEST(MultiResourceTokenBucketTest, Burst) {
+  absl::Time now = absl::UnixEpoch();
+  MultiResourceTokenBucket<2> t(
+      now, {1e6, 100}, {absl::Milliseconds(100), absl::Milliseconds(30)});
+  // 3 ops of burst and one more that goes below zero.
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, {1000, 1})) << i;
+  }
+  ASSERT_EQ(absl::Milliseconds(10), t.TryGetTokens(now, {1000, 1}));
+}
+
+// Unlimited demand against 40MB/s and 5000 ops/s. 4KB ops are limited by the
+// ops lane, 64KB ops by the bytes lane.
+TEST(MultiResourceTokenBucketTest, NanosDomainBottleneck) {
+  using Bucket = BasicMultiResourceTokenBucket<NanosDomain, 2>;
+  for (int64_t op_size : {4096, 65536}) {
+    const int64_t start = 1000000000;
+    int64_t now = start;
+    Bucket t(now, {40e6, 5000}, {0, 0});
+    const int64_t end = now + 10 * int64_t{1000000000};
+    int64_t ops = 0;
+    while (now < end) {
+      int64_t d = t.TryGetTokens(now, {op_size, 1});
+      if (d == 0) {
+        ++ops;
+      } else {
+        now += d;
+      }
+    }
+    const double seconds = (now - start) / 1e9;
+    const double ops_rate = ops / seconds;
+    LOG(INFO) << "op size: " << op_size << " ops/s: " << ops_rate;
+    ASSERT_NEAR(std::min(5000.0, 40e6 / op_size), ops_rate, 1);
+  }
+}
+
+}  // namespace
+}  // namespace mogo
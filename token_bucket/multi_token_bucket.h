@@ -1,6 +1,9 @@
 #ifndef MOGO_EXP_TOKEN_BUCKET_MULTI_TOKEN_BUCKET_H
 #define MOGO_EXP_TOKEN_BUCKET_MULTI_TOKEN_BUCKET_H
 
+#include <algorithm>
+#include <vector>
+
 #include "absl/container/inlined_vector.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
@@ -16,72 +19,79 @@ the bucket returns back to zero. This can create large delays due to head of
 line blocking. To mitigate this problem MultiTokenBucket will smear token
 acquisition over a longer period of time allowing for multiple (by default 10)
 in flight requests.
+
+With `max_in_flight` = N every admitted request decreases the refill rate by
+1/N of the nominal rate, so a request for `d` tokens is smeared over N * d. The
+bucket is at zero while all N shares of the rate are taken. The shares behave
+like N lanes: a lane is busy until the request using it has been paid for. The
+lanes are kept in a min-heap of the times they become free, admitting a request
+replaces the earliest free lane, O(log N) regardless of how many requests are
+in flight.
 */
 class MultiTokenBucket {
  public:
-  explicit MultiTokenBucket(absl::Time now)
-      : rates_{{/*rate_multiplier=*/0.0, /*end_time=*/now},
-               {/*rate_multiplier=1*/ 1.0,
-                /*end_time=*/absl::InfiniteFuture()}} {}
+  static constexpr int kDefaultMaxInFlight = 10;
+
+  explicit MultiTokenBucket(absl::Time now,
+                            int max_in_flight = kDefaultMaxInFlight);
 
   absl::Duration TryGetTokens(absl::Time now, absl::Duration d);
 
+  int max_in_flight() const { return lane_free_times_.size(); }
+
   template <typename Sink>
   friend void AbslStringify(Sink& sink, MultiTokenBucket mtb) {
-    absl::Time zero_time = mtb.rates_[mtb.head_].end_time;
-    sink.Append(absl::StrCat("{MultitokenBucket head=", mtb.head_, " "));
-
-    auto i = mtb.head_;
-    while (true) {
-      ++i;
-      i %= mtb.kRateBucketCount;
-      if (i == mtb.head_) {
-        sink.Append(" overflow! ");
-        break;
-      }
-      sink.Append(absl::StrCat("{", mtb.rates_[i].rate_multiplier, ",",
-                               mtb.rates_[i].end_time - zero_time, "}"));
-      if (mtb.rates_[i].end_time == absl::InfiniteFuture()) {
-        break;
-      }
-    };
-
+    std::vector<RateAndEndTime> rates = mtb.RateSchedule();
+    const absl::Time zero_time = rates.front().end_time;
+    sink.Append("{MultitokenBucket");
+    for (const RateAndEndTime& r : rates) {
+      sink.Append(absl::StrCat(" {", r.rate_multiplier, ",",
+                               r.end_time - zero_time, "}"));
+    }
     sink.Append("}");
   }
 
  private:
-  template<typename T>
-  void IncIdx(T& idx) { idx = (idx + 1) % kRateBucketCount; }
-
-  template<typename T>
-  void DecIdx(T& idx) {
-    idx = (idx + kRateBucketCount - 1) % kRateBucketCount;
-  }
-
   // Describes the refill rate over and interval of time.
   struct RateAndEndTime {
     double rate_multiplier;
     // The interval is open, as in, applies only for now < end_time.
     absl::Time end_time;
   };
-  // A circular buffer would be better with the last element always being {1.0,
-  // InfiniteFuture()}
-  static constexpr int kRateBucketCount = 16;
-  // `head_` points to the next rate scope to be used.
-  // The next rate scope end time is the delay required always points to the
-  // rate == 0 cell;
-  int head_ = 0;
 
-  // A circular buffer with the refill rates and the time span associated with
-  // them. `rates_[head_]` always points to a span with a refill rate of zero
-  // and the end time of that span is the time when requests are going to start
-  // to be unblocked. The last span ends at InfiniteFuture and has a refill rate
-  // of 1.
-  RateAndEndTime rates_[kRateBucketCount];
+  // Returns the refill rate schedule implied by the lanes. The first span
+  // always has a refill rate of zero and ends at the zero time, the last span
+  // ends at InfiniteFuture and has a refill rate of 1. O(N log N), only used
+  // for debugging.
+  std::vector<RateAndEndTime> RateSchedule() const {
+    std::vector<absl::Time> lanes(lane_free_times_.begin(),
+                                  lane_free_times_.end());
+    for (absl::Time& t : lanes) {
+      // Lanes that became free before the last admitted request are free
+      // since then.
+      t = std::max(t, last_admit_time_);
+    }
+    std::sort(lanes.begin(), lanes.end());
+    std::vector<RateAndEndTime> rates;
+    for (size_t i = 0; i < lanes.size(); ++i) {
+      if (i == 0 || lanes[i] != lanes[i - 1]) {
+        rates.push_back(
+            {static_cast<double>(i) / lanes.size(), lanes[i]});
+      }
+    }
+    rates.push_back({1.0, absl::InfiniteFuture()});
+    return rates;
+  }
+
+  // A min-heap of the times each lane becomes free. The top is the time when
+  // the bucket returns back to zero and starts allowing requests through.
+  absl::InlinedVector<absl::Time, kDefaultMaxInFlight> lane_free_times_;
+  // Only used to print the schedule.
+  absl::Time last_admit_time_;
 
   friend class MultiTokenBucketIntrospector;
 };
 
 }  // namespace mogo
 
-#endif  // MOGO_EXP_TOKEN_BUCKET_MULTI_TOKEN_BUCKET_H
\ No newline at end of file
+#endif  // MOGO_EXP_TOKEN_BUCKET_MULTI_TOKEN_BUCKET_H
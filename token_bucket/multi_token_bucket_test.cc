@@ -23,13 +23,9 @@ class MultiTokenBucketIntrospector {
   explicit MultiTokenBucketIntrospector(MultiTokenBucket& b) : b_(b) {}
   std::vector<RateAndEndTime> GetRates() {
     std::vector<RateAndEndTime> v;
-    auto i = b_.head_;
-    do {
-      v.push_back({b_.rates_[i].rate_multiplier, b_.rates_[i].end_time});
-      ++i;
-      i %= b_.kRateBucketCount;
-    } while (v.back().end_time < absl::InfiniteFuture());
-
+    for (const auto& r : b_.RateSchedule()) {
+      v.push_back({r.rate_multiplier, r.end_time});
+    }
     return v;
   }
 
@@ -138,5 +134,43 @@ TEST(MultiTokenBucketTest, Test50s) {
   }
 }
 
+// With 128 lanes 128 large requests are in flight at the same time, each one
+// paid for over 128 times its size.
+TEST(MultiTokenBucketTest, ManyInFlight) {
+  constexpr int kInFlight = 128;
+  absl::Time now = absl::UnixEpoch() + absl::Hours(1);
+  MultiTokenBucket b(now, kInFlight);
+  ASSERT_EQ(kInFlight, b.max_in_flight());
+  for (int i = 0; i < kInFlight; ++i) {
+    ASSERT_EQ(absl::ZeroDuration(),
+              b.TryGetTokens(now + absl::Milliseconds(i), absl::Seconds(1)));
+  }
+  now += absl::Milliseconds(kInFlight);
+  // All lanes are taken, the first one frees up 128s after it was taken.
+  ASSERT_EQ(absl::Seconds(kInFlight) - absl::Milliseconds(kInFlight),
+            b.TryGetTokens(now, absl::Seconds(1)));
+
+  // The lanes free up one by one, 1ms apart.
+  now = absl::UnixEpoch() + absl::Hours(1) + absl::Seconds(kInFlight);
+  for (int i = 0; i < kInFlight - 1; ++i) {
+    ASSERT_EQ(absl::ZeroDuration(), b.TryGetTokens(now, absl::Seconds(1)));
+    ASSERT_EQ(absl::Milliseconds(1), b.TryGetTokens(now, absl::Seconds(1)));
+    now += absl::Milliseconds(1);
+  }
+
+  // Over a long time the admitted tokens match the nominal rate.
+  absl::Duration admitted;
+  const absl::Time start = now;
+  while (now < start + absl::Seconds(10000)) {
+    absl::Duration d = b.TryGetTokens(now, absl::Seconds(3));
+    if (d == absl::ZeroDuration()) {
+      admitted += absl::Seconds(3);
+    } else {
+      now += d;
+    }
+  }
+  ASSERT_NEAR(1.0, absl::FDivDuration(admitted, now - start), 0.05);
+}
+
 }  // namespace
 }  // namespace mogo
@@ -0,0 +1,7 @@
+#include "token_bucket/priority_token_bucket.h"
+
+namespace mogo {
+
+template class BasicPriorityTokenBucket<AbslTimeDomain>;
+
+}  // namespace mogo
@@ -0,0 +1,102 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_PRIORITY_TOKEN_BUCKET_H
+#define MOGO_EXP_TOKEN_BUCKET_PRIORITY_TOKEN_BUCKET_H
+
+#include <array>
+#include <cstdint>
+
+#include "absl/log/check.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "token_bucket/burst_token_bucket.h"
+#include "token_bucket/clock_domain.h"
+
+namespace mogo {
+
+enum class RequestPriority {
+  // Control plane and other requests that must get through during overload.
+  kCritical = 0,
+  // Bulk traffic, the first to be refused.
+  kSheddable = 1,
+};
+
+inline constexpr int kRequestPriorityCount = 2;
+
+/*
+BasicPriorityTokenBucket is a BasicBurstTokenBucket shared by critical and
+sheddable requests. Sheddable requests are refused once the bucket falls below
+`sheddable_headroom`, critical requests can use the headroom and the rest of the
+burst, and go below zero by one request same as in BasicBurstTokenBucket.
+
+During an overload sheddable traffic drains the bucket down to the headroom and
+no further, so critical requests find tokens without waiting as long as they
+use less than the refill rate.
+
+The bucket keeps separate counters for every priority. Admission is O(1), the
+headroom is looked up by priority.
+
+Not thread-safe. This class is thread-compatible.
+*/
+template <typename Domain>
+class BasicPriorityTokenBucket {
+ public:
+  using Time = typename Domain::Time;
+  using Duration = typename Domain::Duration;
+
+  struct PriorityStats {
+    int64_t admitted = 0;
+    int64_t refused = 0;
+    Duration admitted_tokens = Domain::Zero();
+  };
+
+  BasicPriorityTokenBucket(Time now, Duration burst_tokens,
+                           Duration sheddable_headroom)
+      : tb_(now, burst_tokens), headroom_{Domain::Zero(), sheddable_headroom} {
+    CHECK_LE(sheddable_headroom, burst_tokens);
+  }
+
+  // Attempts to extract the specified tokens from the token bucket.
+  // Returns Domain::Zero() if the extraction was successful.
+  // Returns a delay that the caller should wait for until tokens are going to
+  // be available for `priority`.
+  Duration TryGetTokens(Time now, Duration tokens, RequestPriority priority) {
+    const int p = static_cast<int>(priority);
+    Duration delay = tb_.TryGetTokensAboveHeadroom(now, tokens, headroom_[p]);
+    PriorityStats& stats = stats_[p];
+    if (delay == Domain::Zero()) {
+      ++stats.admitted;
+      stats.admitted_tokens += tokens;
+    } else {
+      ++stats.refused;
+    }
+    return delay;
+  }
+
+  const PriorityStats& stats(RequestPriority priority) const {
+    return stats_[static_cast<int>(priority)];
+  }
+
+  template <typename Sink>
+  friend void AbslStringify(Sink& sink, const BasicPriorityTokenBucket& t) {
+    absl::Format(&sink, "{PriorityTokenBucket %v", t.tb_);
+    for (int p = 0; p < kRequestPriorityCount; ++p) {
+      absl::Format(&sink, ", priority %d admitted: %d refused: %d", p,
+                   t.stats_[p].admitted, t.stats_[p].refused);
+    }
+    absl::Format(&sink, "}");
+  }
+
+ private:
+  BasicBurstTokenBucket<Domain> tb_;
+  // The tokens that have to stay in the bucket for a request of the priority
+  // to be admitted.
+  const std::array<Duration, kRequestPriorityCount> headroom_;
+  std::array<PriorityStats, kRequestPriorityCount> stats_;
+};
+
+extern template class BasicPriorityTokenBucket<AbslTimeDomain>;
+
+using PriorityTokenBucket = BasicPriorityTokenBucket<AbslTimeDomain>;
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_PRIORITY_TOKEN_BUCKET_H
@@ -0,0 +1,80 @@
+/*
+bazel test token_bucket:priority_token_bucket_test
+*/
+
+#include "token_bucket/priority_token_bucket.h"
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace mogo {
+namespace {
+
+TEST(PriorityTokenBucketTest, SheddableStopsAtHeadroom) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  PriorityTokenBucket t(now, 5 * token, 2 * token);
+
+  // Sheddable requests are admitted while the headroom is left.
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_EQ(absl::ZeroDuration(),
+              t.TryGetTokens(now, token, RequestPriority::kSheddable));
+  }
+  ASSERT_EQ(token, t.TryGetTokens(now, token, RequestPriority::kSheddable));
+  // Critical requests use the rest and go below zero by one request.
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(absl::ZeroDuration(),
+              t.TryGetTokens(now, token, RequestPriority::kCritical));
+  }
+  ASSERT_EQ(token, t.TryGetTokens(now, token, RequestPriority::kCritical));
+  ASSERT_EQ(3 * token, t.TryGetTokens(now, token, RequestPriority::kSheddable));
+
+  now += token;
+  ASSERT_EQ(absl::ZeroDuration(),
+            t.TryGetTokens(now, token, RequestPriority::kCritical));
+
+  EXPECT_EQ(4, t.stats(RequestPriority::kSheddable).admitted);
+  EXPECT_EQ(2, t.stats(RequestPriority::kSheddable).refused);
+  EXPECT_EQ(4 * token, t.stats(RequestPriority::kSheddable).admitted_tokens);
+  EXPECT_EQ(3, t.stats(RequestPriority::kCritical).admitted);
+  EXPECT_EQ(1, t.stats(RequestPriority::kCritical).refused);
+  LOG(INFO) << t;
+}
+
+TEST(PriorityTokenBucketTest, ZeroHeadroomIsBurstTokenBucket) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Microseconds(100);
+  PriorityTokenBucket t(now, 10 * token, absl::ZeroDuration());
+  BurstTokenBucket b(now, 10 * token);
+  for (int i = 0; i < 10000; ++i) {
+    now += absl::Microseconds(i % 7 * 30);
+    ASSERT_EQ(b.TryGetTokens(now, token),
+              t.TryGetTokens(now, token, i % 2 == 0
+                                             ? RequestPriority::kCritical
+                                             : RequestPriority::kSheddable));
+  }
+}
+
+// Sheddable traffic far above the rate, critical traffic at a tenth of it.
+// Critical requests never wait and sheddable ones get the rest of the rate.
+TEST(PriorityTokenBucketTest, CriticalUnaffectedByOverload) {
+  const absl::Time start_time = absl::UnixEpoch();
+  const absl::Duration token = absl::Microseconds(100);  // 10k requests/sec
+  PriorityTokenBucket t(start_time, 20 * token, 10 * token);
+  const absl::Time end_time = start_time + absl::Seconds(10);
+  for (absl::Time now = start_time; now < end_time;
+       now += absl::Microseconds(10)) {
+    t.TryGetTokens(now, token, RequestPriority::kSheddable);
+    if ((now - start_time) % absl::Milliseconds(1) == absl::ZeroDuration()) {
+      ASSERT_EQ(absl::ZeroDuration(),
+                t.TryGetTokens(now, token, RequestPriority::kCritical));
+    }
+  }
+  LOG(INFO) << t;
+  ASSERT_EQ(0, t.stats(RequestPriority::kCritical).refused);
+  ASSERT_NEAR(90000, t.stats(RequestPriority::kSheddable).admitted, 10);
+}
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,194 @@
+#include "token_bucket/quota_lease_client.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "token_bucket/quota_protocol.h"
+
+namespace mogo {
+
+namespace {
+
+absl::StatusOr<int> ConnectSocket(const std::string& path,
+                                  absl::Duration rpc_timeout) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Socket path too long: ", path));
+  }
+  std::memcpy(addr.sun_path, path.data(), path.size());
+
+  const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return absl::ErrnoToStatus(errno, "socket");
+  }
+  const timeval timeout = absl::ToTimeval(rpc_timeout);
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) !=
+          0 ||
+      connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) !=
+          0) {
+    const int err = errno;
+    close(fd);
+    return absl::ErrnoToStatus(err, absl::StrCat("Can't connect to ", path));
+  }
+  return fd;
+}
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<QuotaLeaseClient>> QuotaLeaseClient::Connect(
+    const std::string& path, absl::Time now, const Options& options) {
+  std::unique_ptr<QuotaLeaseClient> client(
+      new QuotaLeaseClient(path, now, options));
+  absl::Status status = client->Renew(now);
+  if (!status.ok()) {
+    return status;
+  }
+  return client;
+}
+
+QuotaLeaseClient::QuotaLeaseClient(const std::string& path, absl::Time now,
+                                   const Options& options)
+    : path_(path),
+      options_(options),
+      demand_(now, options.measurement_interval),
+      tb_(now, /*refill_rate=*/options.min_rate),
+      lease_expiry_(now),
+      renew_time_(now) {
+  CHECK_GT(options_.min_rate, 0);
+  CHECK_GT(options_.renew_fraction, 0);
+  CHECK_LT(options_.renew_fraction, 1);
+}
+
+QuotaLeaseClient::~QuotaLeaseClient() { Disconnect(); }
+
+absl::Status QuotaLeaseClient::Renew(absl::Time now) {
+  in_flight_ = false;
+  absl::Status status = SendRequest(now);
+  if (status.ok()) {
+    status = ReceiveResponse(/*flags=*/0);
+  }
+  if (status.ok()) {
+    status = ApplyResponse(now);
+  }
+  if (!status.ok()) {
+    RetryLater(now);
+  }
+  return status;
+}
+
+void QuotaLeaseClient::RenewAsync(absl::Time now) {
+  if (!in_flight_) {
+    if (!SendRequest(now).ok()) {
+      RetryLater(now);
+    }
+    // The response is picked up by the calls that follow, renew_time_ stays
+    // in the past until then.
+    return;
+  }
+  absl::Status status = ReceiveResponse(MSG_DONTWAIT);
+  if (absl::IsDeadlineExceeded(status)) {
+    if (now - request_time_ >= options_.rpc_timeout) {
+      RetryLater(now);
+    }
+    return;
+  }
+  if (status.ok()) {
+    status = ApplyResponse(now);
+  }
+  if (!status.ok()) {
+    RetryLater(now);
+  }
+}
+
+absl::Status QuotaLeaseClient::SendRequest(absl::Time now) {
+  if (fd_ < 0) {
+    absl::StatusOr<int> fd = ConnectSocket(path_, options_.rpc_timeout);
+    if (!fd.ok()) {
+      return fd.status();
+    }
+    fd_ = *fd;
+  }
+  // A response that arrived after an earlier renewal was abandoned would be
+  // taken for the answer to this one, with a lease that started earlier.
+  while (recv(fd_, &response_, sizeof(response_), MSG_DONTWAIT) > 0) {
+  }
+
+  QuotaRequest request;
+  request.client_id = options_.client_id;
+  request.requested_rate =
+      std::max(options_.min_rate,
+               demand_.GetBytesPerSecond(now) * options_.demand_headroom);
+  absl::Status status = SendQuotaMessage(fd_, &request, sizeof(request));
+  if (!status.ok()) {
+    // The connection is broken, the next renewal reconnects.
+    Disconnect();
+    return status;
+  }
+  in_flight_ = true;
+  request_time_ = now;
+  return absl::OkStatus();
+}
+
+absl::Status QuotaLeaseClient::ReceiveResponse(int flags) {
+  absl::Status status =
+      ReceiveQuotaMessage(fd_, &response_, sizeof(response_), flags);
+  if (status.ok()) {
+    in_flight_ = false;
+  } else if (!absl::IsDeadlineExceeded(status)) {
+    Disconnect();
+  }
+  return status;
+}
+
+absl::Status QuotaLeaseClient::ApplyResponse(absl::Time now) {
+  if (response_.magic != kQuotaMagic) {
+    // Whatever else is on the connection can't be trusted either.
+    Disconnect();
+    return absl::DataLossError("Bad quota response magic");
+  }
+  if (response_.lease_ns <= 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Quota lease must be positive, got ", response_.lease_ns,
+                     "ns"));
+  }
+  // The lease is counted from the time the request was sent, never later than
+  // the server's.
+  const absl::Duration lease = absl::Nanoseconds(response_.lease_ns);
+  lease_expiry_ = request_time_ + lease;
+  renew_time_ = request_time_ + lease * options_.renew_fraction;
+  leased_rate_ = response_.granted_rate;
+  if (leased_rate_ > 0) {
+    tb_.SetRefillRate(now, leased_rate_);
+  }
+  return absl::OkStatus();
+}
+
+void QuotaLeaseClient::RetryLater(absl::Time now) {
+  in_flight_ = false;
+  renew_time_ = now + options_.retry_interval;
+}
+
+void QuotaLeaseClient::Disconnect() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  in_flight_ = false;
+}
+
+}  // namespace mogo
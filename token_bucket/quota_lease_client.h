@@ -0,0 +1,145 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_QUOTA_LEASE_CLIENT_H
+#define MOGO_EXP_TOKEN_BUCKET_QUOTA_LEASE_CLIENT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "stat/approx_counter.h"
+#include "token_bucket/quota_protocol.h"
+#include "token_bucket/rate_token_bucket.h"
+
+namespace mogo {
+
+/*
+QuotaLeaseClient enforces a share of a cluster-wide rate limit without a remote
+call per request. It leases a slice of the global rate from a quota server, see
+QuotaServer, and admits requests against a local RateTokenBucket refilling at
+the leased rate.
+
+The lease is renewed once `renew_fraction` of it has passed, ahead of the
+expiry, by the TryGetTokens call that notices it. That call sends the renewal
+request and returns, the calls that follow pick the response up with a
+non-blocking receive, so no request waits for the server. Every other call is a
+RateTokenBucket call plus an ApproxCounter update. Renew is the blocking
+alternative, e.g. for a background thread with external synchronization.
+
+The rate asked for is the demand, the tokens requested over the last
+`measurement_interval` whether admitted or not, times `demand_headroom`, so
+that a growing client asks for more than it has. A client that gets no lease,
+or whose lease expired because the server was unreachable, admits nothing;
+the global limit is never exceeded because of a lost server. A renewal that
+failed or got no response within `rpc_timeout` is retried every
+`retry_interval`, reconnecting if needed, while the old lease lasts. A response
+with a lease that isn't positive is an error, the old lease stays.
+
+Not thread-safe. This class is thread-compatible.
+*/
+class QuotaLeaseClient {
+ public:
+  struct Options {
+    // Identifies the lease on the server, unique among the clients.
+    uint64_t client_id = 0;
+    // The lowest rate asked for, also the rate asked for initially.
+    double min_rate = 1;
+    double demand_headroom = 1.2;
+    double renew_fraction = 0.5;
+    absl::Duration retry_interval = absl::Milliseconds(100);
+    // How long a renewal waits for the server.
+    absl::Duration rpc_timeout = absl::Milliseconds(100);
+    absl::Duration measurement_interval = absl::Seconds(1);
+  };
+
+  // Connects to the server at `path` and obtains the first lease. A broken
+  // connection is re-established by the next renewal.
+  static absl::StatusOr<std::unique_ptr<QuotaLeaseClient>> Connect(
+      const std::string& path, absl::Time now, const Options& options);
+
+  QuotaLeaseClient(const QuotaLeaseClient&) = delete;
+  QuotaLeaseClient& operator=(const QuotaLeaseClient&) = delete;
+
+  ~QuotaLeaseClient();
+
+  // Attempts to extract the specified tokens from the leased rate.
+  // Returns absl::ZeroDuration() if the extraction was successful.
+  // Returns a delay that the caller should wait for until tokens are going to
+  // be available.
+  absl::Duration TryGetTokens(absl::Time now, int64_t token_count) {
+    demand_.RecordRequest(token_count, now);
+    if (ABSL_PREDICT_FALSE(now >= renew_time_)) {
+      RenewAsync(now);
+    }
+    if (ABSL_PREDICT_FALSE(now >= lease_expiry_ || leased_rate_ <= 0)) {
+      // Nothing to admit from until the next renewal, or until its response
+      // while it is in flight.
+      return std::max(renew_time_ - now, kPollInterval);
+    }
+    return tb_.TryGetTokens(now, token_count);
+  }
+
+  // Renews the lease now, waiting up to `rpc_timeout` for the response. A
+  // renewal in flight is abandoned. On failure the current lease stays until
+  // it expires and the renewal is retried after `retry_interval`.
+  absl::Status Renew(absl::Time now);
+
+  // The rate of the current lease in tokens per second.
+  double leased_rate() const { return leased_rate_; }
+  absl::Time lease_expiry() const { return lease_expiry_; }
+
+  // The tokens per second requested over the measurement interval.
+  double demand_rate(absl::Time now) const {
+    return demand_.GetBytesPerSecond(now);
+  }
+
+ private:
+  QuotaLeaseClient(const std::string& path, absl::Time now,
+                   const Options& options);
+
+  // How soon a caller with no lease should come back while a renewal is in
+  // flight.
+  static constexpr absl::Duration kPollInterval = absl::Microseconds(100);
+
+  // Sends the renewal request if none is in flight, otherwise picks up the
+  // response if it arrived. Failures are retried after `retry_interval`.
+  void RenewAsync(absl::Time now);
+
+  // Sends the renewal request, reconnecting first if the connection broke.
+  absl::Status SendRequest(absl::Time now);
+
+  // Receives the response to the request in flight into `response_`, `flags`
+  // as for ReceiveQuotaMessage.
+  absl::Status ReceiveResponse(int flags);
+
+  // Takes the lease from `response_`.
+  absl::Status ApplyResponse(absl::Time now);
+
+  // The request in flight is abandoned, a late response is dropped by the
+  // next SendRequest.
+  void RetryLater(absl::Time now);
+
+  void Disconnect();
+
+  const std::string path_;
+  const Options options_;
+  // -1 while disconnected.
+  int fd_ = -1;
+  QuotaResponse response_;
+  // Set while a request was sent and its response not received.
+  bool in_flight_ = false;
+  // When the request in flight was sent, the lease starts then.
+  absl::Time request_time_;
+  ApproxCounter demand_;
+  RateTokenBucket tb_;
+  double leased_rate_ = 0;
+  absl::Time lease_expiry_;
+  absl::Time renew_time_;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_QUOTA_LEASE_CLIENT_H
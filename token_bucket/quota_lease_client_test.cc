@@ -0,0 +1,313 @@
+/*
+bazel test token_bucket:quota_lease_client_test
+*/
+
+#include "token_bucket/quota_lease_client.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "token_bucket/quota_protocol.h"
+#include "token_bucket/quota_server.h"
+
+namespace mogo {
+namespace {
+
+std::string SocketPath(const std::string& test) {
+  return absl::StrCat(testing::TempDir(), "/quota_", test, "_", getpid());
+}
+
+class ServerThread {
+ public:
+  explicit ServerThread(std::unique_ptr<QuotaServer> server)
+      : server_(std::move(server)), thread_([this] { server_->Run(); }) {}
+  ~ServerThread() {
+    server_->Stop();
+    thread_.join();
+  }
+
+  QuotaServer& server() { return *server_; }
+
+ private:
+  std::unique_ptr<QuotaServer> server_;
+  std::thread thread_;
+};
+
+// Serves one connection, answers request i with responses[i] once it is
+// released.
+class FakeServer {
+ public:
+  FakeServer(const std::string& path, std::vector<QuotaResponse> responses,
+             int released)
+      : responses_(std::move(responses)), released_(released) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    CHECK_LT(path.size(), sizeof(addr.sun_path));
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    CHECK_GE(listen_fd_, 0);
+    unlink(path.c_str());
+    CHECK_EQ(0, bind(listen_fd_, reinterpret_cast<const sockaddr*>(&addr),
+                     sizeof(addr)));
+    CHECK_EQ(0, listen(listen_fd_, 1));
+    path_ = path;
+    thread_ = std::thread([this] { Serve(); });
+  }
+
+  // The client must be gone by now.
+  ~FakeServer() {
+    Release(INT_MAX);
+    shutdown(listen_fd_, SHUT_RDWR);
+    thread_.join();
+    close(listen_fd_);
+    unlink(path_.c_str());
+  }
+
+  void Release(int released) {
+    absl::MutexLock lock(&mu_);
+    released_ = released;
+  }
+
+  void WaitForRequests(int requests) {
+    absl::MutexLock lock(&mu_);
+    std::pair<const int*, int> arg(&requests_, requests);
+    mu_.Await(absl::Condition(AtLeast, &arg));
+  }
+
+ private:
+  static bool AtLeast(std::pair<const int*, int>* arg) {
+    return *arg->first >= arg->second;
+  }
+
+  void Serve() {
+    const int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      return;
+    }
+    for (int i = 0; i < static_cast<int>(responses_.size()); ++i) {
+      QuotaRequest request;
+      if (!ReceiveQuotaMessage(fd, &request, sizeof(request)).ok()) {
+        break;
+      }
+      absl::MutexLock lock(&mu_);
+      ++requests_;
+      std::pair<const int*, int> arg(&released_, i + 1);
+      mu_.Await(absl::Condition(AtLeast, &arg));
+      if (!SendQuotaMessage(fd, &responses_[i], sizeof(QuotaResponse)).ok()) {
+        break;
+      }
+    }
+    // Waits for the client to disconnect.
+    char c;
+    while (recv(fd, &c, sizeof(c), 0) > 0) {
+    }
+    close(fd);
+  }
+
+  const std::vector<QuotaResponse> responses_;
+  std::string path_;
+  int listen_fd_;
+  std::thread thread_;
+  absl::Mutex mu_;
+  int released_ ABSL_GUARDED_BY(mu_);
+  int requests_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+QuotaResponse Grant(double rate, absl::Duration lease) {
+  QuotaResponse response;
+  response.granted_rate = rate;
+  response.lease_ns = absl::ToInt64Nanoseconds(lease);
+  return response;
+}
+
+TEST(QuotaLeaseClientTest, AdmitsAtTheLeasedRate) {
+  const std::string path = SocketPath("rate");
+  absl::StatusOr<std::unique_ptr<QuotaServer>> server =
+      QuotaServer::Listen(path, /*global_rate=*/1000,
+                          /*lease_duration=*/absl::Milliseconds(200));
+  ASSERT_TRUE(server.ok()) << server.status();
+  ServerThread st(*std::move(server));
+
+  absl::Time now = absl::Now();
+  QuotaLeaseClient::Options options;
+  options.client_id = 1;
+  options.min_rate = 100;
+  absl::StatusOr<std::unique_ptr<QuotaLeaseClient>> client =
+      QuotaLeaseClient::Connect(path, now, options);
+  ASSERT_TRUE(client.ok()) << client.status();
+  ASSERT_EQ(100, (*client)->leased_rate());
+
+  // A client asking for more than the global rate grows to it through
+  // renewals and doesn't exceed it.
+  const absl::Time start = now;
+  int64_t admitted = 0;
+  while (now < start + absl::Seconds(2)) {
+    absl::Duration d = (*client)->TryGetTokens(now, 1);
+    if (d == absl::ZeroDuration()) {
+      ++admitted;
+    }
+    absl::SleepFor(absl::Microseconds(100));
+    now = absl::Now();
+  }
+  LOG(INFO) << "admitted: " << admitted
+            << " leased_rate: " << (*client)->leased_rate();
+  EXPECT_EQ(1000, (*client)->leased_rate());
+  EXPECT_LE(admitted, 2000 + 1);
+  EXPECT_GT(admitted, 1000);
+}
+
+TEST(QuotaLeaseClientTest, ClientsShareTheGlobalRate) {
+  const std::string path = SocketPath("share");
+  absl::StatusOr<std::unique_ptr<QuotaServer>> server =
+      QuotaServer::Listen(path, /*global_rate=*/1000,
+                          /*lease_duration=*/absl::Milliseconds(200));
+  ASSERT_TRUE(server.ok()) << server.status();
+  ServerThread st(*std::move(server));
+
+  constexpr int kClients = 3;
+  const absl::Time start = absl::Now();
+  std::vector<std::unique_ptr<QuotaLeaseClient>> clients;
+  for (int i = 0; i < kClients; ++i) {
+    QuotaLeaseClient::Options options;
+    options.client_id = i;
+    options.min_rate = 10;
+    absl::StatusOr<std::unique_ptr<QuotaLeaseClient>> client =
+        QuotaLeaseClient::Connect(path, start, options);
+    ASSERT_TRUE(client.ok()) << client.status();
+    clients.push_back(*std::move(client));
+  }
+
+  std::vector<int64_t> admitted(kClients, 0);
+  absl::Time now = start;
+  while (now < start + absl::Seconds(2)) {
+    for (int i = 0; i < kClients; ++i) {
+      if (clients[i]->TryGetTokens(now, 1) == absl::ZeroDuration()) {
+        ++admitted[i];
+      }
+    }
+    absl::SleepFor(absl::Microseconds(100));
+    now = absl::Now();
+  }
+  int64_t total = 0;
+  for (int i = 0; i < kClients; ++i) {
+    LOG(INFO) << "client " << i << " admitted: " << admitted[i]
+              << " leased_rate: " << clients[i]->leased_rate();
+    total += admitted[i];
+  }
+  EXPECT_LE(st.server().leased_rate(absl::Now()), 1000 + 1e-6);
+  // The leases overshoot by at most the fair shares for one lease duration.
+  EXPECT_LE(total, 2000 + 1000 * 0.2);
+  EXPECT_GT(total, 1000);
+}
+
+TEST(QuotaLeaseClientTest, NothingAdmittedWithoutServer) {
+  const std::string path = SocketPath("lost");
+  absl::StatusOr<std::unique_ptr<QuotaServer>> server =
+      QuotaServer::Listen(path, /*global_rate=*/1000,
+                          /*lease_duration=*/absl::Milliseconds(200));
+  ASSERT_TRUE(server.ok()) << server.status();
+  auto st = std::make_unique<ServerThread>(*std::move(server));
+
+  absl::Time now = absl::Now();
+  QuotaLeaseClient::Options options;
+  options.min_rate = 1000;
+  absl::StatusOr<std::unique_ptr<QuotaLeaseClient>> client =
+      QuotaLeaseClient::Connect(path, now, options);
+  ASSERT_TRUE(client.ok()) << client.status();
+  ASSERT_EQ(absl::ZeroDuration(), (*client)->TryGetTokens(now, 1));
+
+  st.reset();
+  // The lease is still good.
+  now += absl::Milliseconds(150);
+  ASSERT_EQ(absl::ZeroDuration(), (*client)->TryGetTokens(now, 1));
+  // Expired and not renewed.
+  now += absl::Milliseconds(100);
+  ASSERT_NE(absl::ZeroDuration(), (*client)->TryGetTokens(now, 1));
+  ASSERT_FALSE((*client)->Renew(now).ok());
+
+  EXPECT_FALSE(QuotaLeaseClient::Connect(path, now, options).ok());
+}
+
+TEST(QuotaLeaseClientTest, RenewalDoesNotWaitForTheServer) {
+  const std::string path = SocketPath("async");
+  FakeServer server(path,
+                    {Grant(1000, absl::Milliseconds(200)),
+                     Grant(500, absl::Milliseconds(200))},
+                    /*released=*/1);
+  const absl::Time start = absl::Now();
+  QuotaLeaseClient::Options options;
+  options.rpc_timeout = absl::Seconds(10);
+  absl::StatusOr<std::unique_ptr<QuotaLeaseClient>> client =
+      QuotaLeaseClient::Connect(path, start, options);
+  ASSERT_TRUE(client.ok()) << client.status();
+
+  // Past the renewal time, the call sends the request and admits from the old
+  // lease without waiting for the held response.
+  const absl::Time sent = start + absl::Milliseconds(150);
+  const absl::Time before = absl::Now();
+  EXPECT_EQ(absl::ZeroDuration(), (*client)->TryGetTokens(sent, 1));
+  EXPECT_LT(absl::Now() - before, absl::Seconds(1));
+  server.WaitForRequests(2);
+  EXPECT_EQ(absl::ZeroDuration(),
+            (*client)->TryGetTokens(sent + absl::Milliseconds(1), 1));
+  EXPECT_EQ(1000, (*client)->leased_rate());
+
+  // A later call picks the response up, the lease counts from `sent`.
+  server.Release(2);
+  absl::Time now = sent + absl::Milliseconds(2);
+  for (int i = 0; i < 1000 && (*client)->leased_rate() != 500; ++i) {
+    absl::SleepFor(absl::Milliseconds(1));
+    (*client)->TryGetTokens(now, 1);
+    now += absl::Microseconds(10);
+  }
+  EXPECT_EQ(500, (*client)->leased_rate());
+  EXPECT_EQ(sent + absl::Milliseconds(200), (*client)->lease_expiry());
+}
+
+TEST(QuotaLeaseClientTest, RejectsNonPositiveLease) {
+  const std::string path = SocketPath("zero");
+  {
+    FakeServer server(path, {Grant(1000, absl::ZeroDuration())},
+                      /*released=*/1);
+    absl::StatusOr<std::unique_ptr<QuotaLeaseClient>> client =
+        QuotaLeaseClient::Connect(path, absl::Now(), {});
+    EXPECT_TRUE(absl::IsInvalidArgument(client.status())) << client.status();
+  }
+
+  // A bad renewal keeps the old lease and doesn't admit past it.
+  FakeServer server(path,
+                    {Grant(1000, absl::Milliseconds(200)),
+                     Grant(1000, absl::Nanoseconds(-1))},
+                    /*released=*/2);
+  const absl::Time start = absl::Now();
+  absl::StatusOr<std::unique_ptr<QuotaLeaseClient>> client =
+      QuotaLeaseClient::Connect(path, start, {});
+  ASSERT_TRUE(client.ok()) << client.status();
+  EXPECT_TRUE(
+      absl::IsInvalidArgument((*client)->Renew(start + absl::Milliseconds(1))));
+  EXPECT_EQ(start + absl::Milliseconds(200), (*client)->lease_expiry());
+  EXPECT_NE(absl::ZeroDuration(),
+            (*client)->TryGetTokens(start + absl::Milliseconds(200), 1));
+}
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,52 @@
+#include "token_bucket/quota_protocol.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstdint>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+
+namespace mogo {
+
+absl::Status SendQuotaMessage(int fd, const void* data, int64_t size) {
+  ssize_t sent;
+  do {
+    sent = send(fd, data, size, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  if (sent < 0) {
+    return absl::ErrnoToStatus(errno, "send");
+  }
+  if (sent != size) {
+    return absl::DataLossError(
+        absl::StrCat("Sent ", sent, " bytes out of ", size));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ReceiveQuotaMessage(int fd, void* data, int64_t size,
+                                 int flags) {
+  ssize_t received;
+  do {
+    // MSG_TRUNC returns the real size of a longer packet.
+    received = recv(fd, data, size, MSG_TRUNC | flags);
+  } while (received < 0 && errno == EINTR);
+  if (received < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return absl::DeadlineExceededError("recv timed out");
+    }
+    return absl::ErrnoToStatus(errno, "recv");
+  }
+  if (received == 0) {
+    return absl::UnavailableError("Connection closed");
+  }
+  if (received != size) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Expected a ", size, " byte message, got ", received));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace mogo
@@ -0,0 +1,47 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_QUOTA_PROTOCOL_H
+#define MOGO_EXP_TOKEN_BUCKET_QUOTA_PROTOCOL_H
+
+#include <cstdint>
+
+#include "absl/status/status.h"
+
+namespace mogo {
+
+/*
+The protocol between QuotaLeaseClient and QuotaServer. Both ends are on the
+same host and talk over a SOCK_SEQPACKET Unix-domain socket, every message is a
+single fixed-size packet in the host's byte order. The client sends a
+QuotaRequest and the server answers with a QuotaResponse, one request in flight
+per connection.
+*/
+
+inline constexpr uint64_t kQuotaMagic = 0x31766c61746f7571;  // "quotalv1"
+
+struct QuotaRequest {
+  uint64_t magic = kQuotaMagic;
+  // Identifies the lease, a client renews the lease with the same id.
+  uint64_t client_id;
+  // The rate the client would like to consume in tokens per second.
+  double requested_rate;
+};
+
+struct QuotaResponse {
+  uint64_t magic = kQuotaMagic;
+  // The rate the client may consume in tokens per second, may be 0.
+  double granted_rate;
+  // How long the grant is valid after the request was sent.
+  int64_t lease_ns;
+};
+
+// Sends `size` bytes as a single packet.
+absl::Status SendQuotaMessage(int fd, const void* data, int64_t size);
+
+// Receives a single packet of exactly `size` bytes. A closed connection is
+// UnavailableError, a timeout DeadlineExceededError. `flags` are passed to
+// recv, with MSG_DONTWAIT DeadlineExceededError means there is no packet yet.
+absl::Status ReceiveQuotaMessage(int fd, void* data, int64_t size,
+                                 int flags = 0);
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_QUOTA_PROTOCOL_H
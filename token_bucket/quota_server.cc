@@ -0,0 +1,175 @@
+#include "token_bucket/quota_server.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "token_bucket/quota_protocol.h"
+
+namespace mogo {
+
+QuotaAllocator::QuotaAllocator(double global_rate,
+                               absl::Duration lease_duration)
+    : global_rate_(global_rate), lease_duration_(lease_duration) {
+  CHECK_GT(global_rate_, 0);
+  CHECK_GT(lease_duration_, absl::ZeroDuration());
+}
+
+void QuotaAllocator::Expire(absl::Time now) {
+  absl::erase_if(leases_, [now](const auto& entry) {
+    return entry.second.expiry <= now;
+  });
+}
+
+double QuotaAllocator::Grant(absl::Time now, uint64_t client_id,
+                             double requested_rate) {
+  Expire(now);
+  double others = 0;
+  for (const auto& [id, lease] : leases_) {
+    if (id != client_id) {
+      others += lease.rate;
+    }
+  }
+  const int64_t clients = leases_.size() + (leases_.contains(client_id) ? 0 : 1);
+  const double fair_share = global_rate_ / clients;
+  const double left = std::max(0.0, global_rate_ - others);
+  const double rate =
+      std::max(0.0, std::min(requested_rate, std::max(left, fair_share)));
+  leases_[client_id] = {rate, now + lease_duration_};
+  return rate;
+}
+
+double QuotaAllocator::leased_rate(absl::Time now) const {
+  double rate = 0;
+  for (const auto& [id, lease] : leases_) {
+    if (lease.expiry > now) {
+      rate += lease.rate;
+    }
+  }
+  return rate;
+}
+
+absl::StatusOr<std::unique_ptr<QuotaServer>> QuotaServer::Listen(
+    const std::string& path, double global_rate,
+    absl::Duration lease_duration) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Socket path too long: ", path));
+  }
+  std::memcpy(addr.sun_path, path.data(), path.size());
+
+  const int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return absl::ErrnoToStatus(errno, "socket");
+  }
+  // A socket left behind by a server that didn't shut down cleanly.
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    const int err = errno;
+    close(fd);
+    return absl::ErrnoToStatus(err, absl::StrCat("Can't listen on ", path));
+  }
+  return std::unique_ptr<QuotaServer>(
+      new QuotaServer(path, fd, global_rate, lease_duration));
+}
+
+QuotaServer::QuotaServer(const std::string& path, int listen_fd,
+                         double global_rate, absl::Duration lease_duration)
+    : path_(path),
+      listen_fd_(listen_fd),
+      allocator_(global_rate, lease_duration) {}
+
+QuotaServer::~QuotaServer() {
+  close(listen_fd_);
+  unlink(path_.c_str());
+}
+
+double QuotaServer::leased_rate(absl::Time now) const {
+  absl::MutexLock lock(&mu_);
+  return allocator_.leased_rate(now);
+}
+
+bool QuotaServer::Serve(int fd) {
+  QuotaRequest request;
+  absl::Status status = ReceiveQuotaMessage(fd, &request, sizeof(request));
+  if (!status.ok()) {
+    if (!absl::IsUnavailable(status)) {
+      LOG(WARNING) << "Dropping quota client: " << status;
+    }
+    return false;
+  }
+  if (request.magic != kQuotaMagic) {
+    LOG(WARNING) << "Dropping quota client with a bad magic: "
+                 << request.magic;
+    return false;
+  }
+  QuotaResponse response;
+  {
+    absl::MutexLock lock(&mu_);
+    response.granted_rate = allocator_.Grant(absl::Now(), request.client_id,
+                                             request.requested_rate);
+    response.lease_ns =
+        absl::ToInt64Nanoseconds(allocator_.lease_duration());
+  }
+  status = SendQuotaMessage(fd, &response, sizeof(response));
+  if (!status.ok()) {
+    LOG(WARNING) << "Dropping quota client: " << status;
+    return false;
+  }
+  return true;
+}
+
+void QuotaServer::Run() {
+  constexpr int kPollIntervalMs = 20;
+  // The listening socket comes first, the connections follow.
+  std::vector<pollfd> fds = {{listen_fd_, POLLIN, 0}};
+  while (!stop_.load(std::memory_order_relaxed)) {
+    const int ready = poll(fds.data(), fds.size(), kPollIntervalMs);
+    if (ready < 0) {
+      CHECK_EQ(errno, EINTR) << "poll: " << std::strerror(errno);
+      continue;
+    }
+    for (size_t i = 1; i < fds.size();) {
+      if (fds[i].revents != 0 && !Serve(fds[i].fd)) {
+        close(fds[i].fd);
+        fds[i] = fds.back();
+        fds.pop_back();
+        continue;
+      }
+      ++i;
+    }
+    if (fds[0].revents & POLLIN) {
+      const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        fds.push_back({fd, POLLIN, 0});
+      } else {
+        LOG(WARNING) << "accept: " << std::strerror(errno);
+      }
+    }
+  }
+  for (size_t i = 1; i < fds.size(); ++i) {
+    close(fds[i].fd);
+  }
+}
+
+}  // namespace mogo
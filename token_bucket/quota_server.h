@@ -0,0 +1,105 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_QUOTA_SERVER_H
+#define MOGO_EXP_TOKEN_BUCKET_QUOTA_SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace mogo {
+
+/*
+QuotaAllocator splits a global rate into leases, the server side of
+QuotaLeaseClient.
+
+A lease grants a client a rate until it expires, a client that stops renewing
+drops out after one lease duration. A request is granted in full while the
+rest of the clients leave enough of the global rate. Otherwise the client gets
+the larger of what is left and its fair share, the global rate divided by the
+number of clients. Clients above their fair share are cut down to it when they
+renew, so the leases converge to max-min fair shares within one lease duration.
+Until then the sum of the leases may exceed the global rate by the fair shares
+handed out, bounded and only for a lease duration.
+
+Not thread-safe. This class is thread-compatible.
+*/
+class QuotaAllocator {
+ public:
+  QuotaAllocator(double global_rate, absl::Duration lease_duration);
+
+  // Grants or renews the lease of `client_id`. Returns the granted rate, valid
+  // for lease_duration().
+  double Grant(absl::Time now, uint64_t client_id, double requested_rate);
+
+  // The sum of the rates of the leases that haven't expired.
+  double leased_rate(absl::Time now) const;
+
+  double global_rate() const { return global_rate_; }
+  absl::Duration lease_duration() const { return lease_duration_; }
+
+ private:
+  struct Lease {
+    double rate;
+    absl::Time expiry;
+  };
+
+  void Expire(absl::Time now);
+
+  const double global_rate_;
+  const absl::Duration lease_duration_;
+  absl::flat_hash_map<uint64_t, Lease> leases_;
+};
+
+/*
+QuotaServer is the reference quota server, a QuotaAllocator served over a
+SOCK_SEQPACKET Unix-domain socket, see quota_protocol.h. Enough to run a whole
+lease-based setup on one box, for tests and for local experiments with
+quota_server_main.
+
+Run serves all connections from a single thread with poll(), a request takes
+one allocator call. Stop may be called from any thread.
+*/
+class QuotaServer {
+ public:
+  // Creates the socket at `path`, replacing a stale one.
+  static absl::StatusOr<std::unique_ptr<QuotaServer>> Listen(
+      const std::string& path, double global_rate,
+      absl::Duration lease_duration);
+
+  QuotaServer(const QuotaServer&) = delete;
+  QuotaServer& operator=(const QuotaServer&) = delete;
+
+  // Closes the connections and removes the socket.
+  ~QuotaServer();
+
+  // Serves requests until Stop is called.
+  void Run();
+
+  // Makes Run return within the poll interval.
+  void Stop() { stop_.store(true, std::memory_order_relaxed); }
+
+  // The sum of the leased rates, see QuotaAllocator::leased_rate.
+  double leased_rate(absl::Time now) const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  QuotaServer(const std::string& path, int listen_fd, double global_rate,
+              absl::Duration lease_duration);
+
+  // Returns false when the connection should be closed.
+  bool Serve(int fd);
+
+  const std::string path_;
+  const int listen_fd_;
+  std::atomic<bool> stop_{false};
+  mutable absl::Mutex mu_;
+  QuotaAllocator allocator_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_QUOTA_SERVER_H
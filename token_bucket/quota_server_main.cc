@@ -0,0 +1,57 @@
+/*
+# Serve a global rate of 10k tokens per second to the clients on this host:
+bazel run token_bucket:quota_server_main -- --stderrthreshold=0 \
+  --socket=/tmp/quota.sock --global_rate=10000
+*/
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/flags.h"
+#include "absl/log/initialize.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "token_bucket/quota_server.h"
+
+ABSL_FLAG(std::string, socket, "/tmp/quota.sock",
+          "The Unix-domain socket to listen on.");
+ABSL_FLAG(double, global_rate, 1000,
+          "The rate in tokens per second split between the clients.");
+ABSL_FLAG(absl::Duration, lease, absl::Seconds(1),
+          "How long a granted rate is valid.");
+
+namespace mogo {
+
+absl::Status RunServer() {
+  absl::StatusOr<std::unique_ptr<QuotaServer>> server =
+      QuotaServer::Listen(absl::GetFlag(FLAGS_socket),
+                          absl::GetFlag(FLAGS_global_rate),
+                          absl::GetFlag(FLAGS_lease));
+  if (!server.ok()) {
+    return server.status();
+  }
+  LOG(INFO) << "Serving " << absl::GetFlag(FLAGS_global_rate)
+            << " tokens/s on " << absl::GetFlag(FLAGS_socket);
+  (*server)->Run();
+  return absl::OkStatus();
+}
+
+}  // namespace mogo
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  absl::InitializeLog();
+
+  absl::Status status = mogo::RunServer();
+  if (status.ok()) {
+    return EXIT_SUCCESS;
+  } else {
+    LOG(ERROR) << status;
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,46 @@
+/*
+bazel test token_bucket:quota_server_test
+*/
+
+#include "token_bucket/quota_server.h"
+
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace mogo {
+namespace {
+
+TEST(QuotaAllocatorTest, GrantsWhatIsLeft) {
+  absl::Time now = absl::UnixEpoch();
+  QuotaAllocator a(/*global_rate=*/1000, /*lease_duration=*/absl::Seconds(1));
+  ASSERT_EQ(300, a.Grant(now, /*client_id=*/1, 300));
+  ASSERT_EQ(600, a.Grant(now, /*client_id=*/2, 600));
+  // Only 100 left, but the fair share is 333.
+  ASSERT_NEAR(1000.0 / 3, a.Grant(now, /*client_id=*/3, 500), 1e-9);
+  ASSERT_NEAR(1000 + 1000.0 / 3 - 100, a.leased_rate(now), 1e-9);
+
+  // Client 2 is cut down to what the others leave when it renews.
+  ASSERT_NEAR(1000 - 300 - 1000.0 / 3, a.Grant(now, /*client_id=*/2, 600),
+              1e-9);
+  ASSERT_NEAR(1000.0 / 3, a.Grant(now, /*client_id=*/3, 500), 1e-9);
+  ASSERT_EQ(300, a.Grant(now, /*client_id=*/1, 300));
+  ASSERT_LE(a.leased_rate(now), 1000 + 1e-9);
+}
+
+TEST(QuotaAllocatorTest, ExpiredLeasesAreReleased) {
+  absl::Time now = absl::UnixEpoch();
+  QuotaAllocator a(/*global_rate=*/1000, /*lease_duration=*/absl::Seconds(1));
+  ASSERT_EQ(1000, a.Grant(now, /*client_id=*/1, 5000));
+  ASSERT_EQ(500, a.Grant(now, /*client_id=*/2, 700));
+
+  // Client 1 doesn't renew.
+  now += absl::Milliseconds(500);
+  ASSERT_EQ(500, a.Grant(now, /*client_id=*/2, 700));
+  now += absl::Milliseconds(500);
+  ASSERT_EQ(500, a.leased_rate(now));
+  ASSERT_EQ(700, a.Grant(now, /*client_id=*/2, 700));
+  ASSERT_EQ(300, a.Grant(now, /*client_id=*/3, 300));
+}
+
+}  // namespace
+}  // namespace mogo
@@ -2,28 +2,58 @@
 #define MOGO_EXP_TOKEN_BUCKET_RATE_TOKEN_BUCKET_H
 
 #include "absl/time/time.h"
+#include "token_bucket/clock_domain.h"
 #include "token_bucket/simple_token_bucket.h"
 
 namespace mogo {
 
-class RateTokenBucket {
+// TryGetTokens calls are recorded in `Metrics` with the cost of the tokens, see
+// NoTokenBucketMetrics.
+template <typename Domain, typename Metrics = NoTokenBucketMetrics>
+class BasicRateTokenBucket {
  public:
-  RateTokenBucket(absl::Time now, double refill_rate)
-      : tb_(now), duration_per_token_(absl::Seconds(1) / refill_rate) {}
+  using Time = typename Domain::Time;
+  using Duration = typename Domain::Duration;
+  using TokenCount = typename Domain::TokenCount;
+  using TokenCost = typename Domain::TokenCost;
+
+  constexpr BasicRateTokenBucket(Time now, double refill_rate)
+      : BasicRateTokenBucket(now, Domain::CostPerToken(refill_rate)) {}
+
+  // Takes a token cost precomputed with Domain::CostPerToken, for example a
+  // constexpr one.
+  constexpr BasicRateTokenBucket(Time now, TokenCost cost_per_token)
+      : tb_(now), cost_per_token_(cost_per_token) {}
 
   // Attempts to extract the specified tokens from the token bucket.
-  // Returns absl::Zero duration if the extraction was successful.
+  // Returns Domain::Zero() if the extraction was successful.
   // Returns a delay that the caller should wait for until tokens are going to
   // be available.
-  absl::Duration TryGetTokens(absl::Time now, double token_count) {
-    return tb_.TryGetTokens(now, token_count * duration_per_token_);
+  Duration TryGetTokens(Time now, TokenCount token_count) {
+    return tb_.TryGetTokens(now, Domain::CostOf(cost_per_token_, token_count));
+  }
+
+  const Metrics& metrics() const { return tb_.metrics(); }
+
+  // Changes the refill rate from `now` on. The tokens that were already
+  // extracted and not refilled yet stay owed, they refill at the new rate.
+  void SetRefillRate(Time now, double refill_rate) {
+    SetCostPerToken(now, Domain::CostPerToken(refill_rate));
+  }
+
+  void SetCostPerToken(Time now, TokenCost cost_per_token) {
+    tb_.SetDebt(now, Domain::Rescale(tb_.Debt(now), cost_per_token_,
+                                     cost_per_token));
+    cost_per_token_ = cost_per_token;
   }
 
  private:
-  SimpleTokenBucket tb_;
-  absl::Duration duration_per_token_;
+  BasicSimpleTokenBucket<Domain, Metrics> tb_;
+  TokenCost cost_per_token_;
 };
 
+using RateTokenBucket = BasicRateTokenBucket<AbslTimeDomain>;
+
 }  // namespace mogo
 
-#endif  // MOGO_EXP_TOKEN_BUCKET_RATE_TOKEN_BUCKET_H
\ No newline at end of file
+#endif  // MOGO_EXP_TOKEN_BUCKET_RATE_TOKEN_BUCKET_H
@@ -43,5 +43,19 @@ TEST(RateTokenBucketTest, Test50s) {
   ASSERT_NEAR(total_rate, rate, /*abs_error=*/1);
 }
 
+TEST(RateTokenBucketTest, SetRefillRateKeepsDebt) {
+  absl::Time now = absl::UnixEpoch();
+  mogo::RateTokenBucket t(now, 1000);
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, 10));
+  now += absl::Milliseconds(5);
+  ASSERT_EQ(absl::Milliseconds(5), t.TryGetTokens(now, 1));
+  // The 5 tokens owed refill at the new rate.
+  t.SetRefillRate(now, 100);
+  ASSERT_EQ(absl::Milliseconds(50), t.TryGetTokens(now, 1));
+  now += absl::Milliseconds(50);
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, 1));
+  ASSERT_EQ(absl::Milliseconds(10), t.TryGetTokens(now, 1));
+}
+
 }  // namespace
 }  // namespace mogo
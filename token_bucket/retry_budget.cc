@@ -0,0 +1,18 @@
+#include "token_bucket/retry_budget.h"
+
+#include "absl/log/check.h"
+#include "absl/time/time.h"
+
+namespace mogo {
+
+RetryBudget::RetryBudget(absl::Time now, const Options& options)
+    : options_(options),
+      min_retries_per_interval_(options.min_retries_per_second *
+                                absl::ToDoubleSeconds(options.interval)),
+      attempts_(now, options.interval),
+      retries_(now, options.interval) {
+  CHECK_GE(options_.retry_ratio, 0);
+  CHECK_GE(options_.min_retries_per_second, 0);
+}
+
+}  // namespace mogo
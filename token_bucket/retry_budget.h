@@ -0,0 +1,95 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_RETRY_BUDGET_H
+#define MOGO_EXP_TOKEN_BUCKET_RETRY_BUDGET_H
+
+#include <cstdint>
+
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "stat/approx_counter.h"
+
+namespace mogo {
+
+/*
+RetryBudget keeps retries to a fraction of the traffic so that retries can't
+multiply the load on a struggling backend, the retry storm that turns a
+brownout into an outage.
+
+A retry is allowed while the retries over the last `interval` stay below
+`retry_ratio` of the first attempts over the same interval plus
+`min_retries_per_second`. The floor lets a client with little traffic retry at
+all. Both are counted with an ApproxCounter, a check is two sums over its 16
+spans, cheap enough for every failed request.
+
+Callers record every first attempt with RecordAttempt and ask TryRetry before
+every retry. To also rate limit the retries, pass a token bucket to TryRetry:
+the retry is admitted only if both the budget and the bucket allow it.
+
+Not thread-safe. This class is thread-compatible.
+*/
+class RetryBudget {
+ public:
+  struct Options {
+    double retry_ratio = 0.1;
+    double min_retries_per_second = 1;
+    absl::Duration interval = absl::Seconds(10);
+  };
+
+  RetryBudget(absl::Time now, const Options& options);
+
+  void RecordAttempt(absl::Time now) { attempts_.RecordRequest(1, now); }
+
+  // Returns true and counts the retry if the budget allows it.
+  bool TryRetry(absl::Time now) {
+    if (!CanRetry(now)) {
+      ++refused_;
+      return false;
+    }
+    retries_.RecordRequest(1, now);
+    return true;
+  }
+
+  // Same as TryRetry, but the retry also needs `tokens` from `bucket`, any of
+  // the token buckets. Returns absl::InfiniteDuration() if the budget is
+  // exhausted, the retry should be given up rather than delayed. Otherwise
+  // returns the delay of the bucket, the retry is counted once it gets the
+  // tokens.
+  template <typename Bucket, typename Tokens>
+  absl::Duration TryRetry(absl::Time now, Bucket& bucket, Tokens tokens) {
+    if (!CanRetry(now)) {
+      ++refused_;
+      return absl::InfiniteDuration();
+    }
+    const absl::Duration d = bucket.TryGetTokens(now, tokens);
+    if (d == absl::ZeroDuration()) {
+      retries_.RecordRequest(1, now);
+    }
+    return d;
+  }
+
+  // Whether a retry at `now` is within the budget. Doesn't count it.
+  bool CanRetry(absl::Time now) const {
+    return retries_.GetBytesPerInterval(now) <
+           options_.retry_ratio * attempts_.GetBytesPerInterval(now) +
+               min_retries_per_interval_;
+  }
+
+  // The number of retries refused by the budget.
+  int64_t refused() const { return refused_; }
+
+  template <typename Sink>
+  friend void AbslStringify(Sink& sink, const RetryBudget& b) {
+    absl::Format(&sink, "{RetryBudget retry_ratio: %v, refused: %d}",
+                 b.options_.retry_ratio, b.refused_);
+  }
+
+ private:
+  const Options options_;
+  const double min_retries_per_interval_;
+  ApproxCounter attempts_;
+  ApproxCounter retries_;
+  int64_t refused_ = 0;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_RETRY_BUDGET_H
@@ -0,0 +1,59 @@
+#include <cstdint>
+
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "token_bucket/retry_budget.h"
+#include "token_bucket/simple_token_bucket.h"
+
+/*
+sudo cpufreq-set -g performance
+
+bazel test -c opt --dynamic_mode=off --test_output=streamed \
+  --cache_test_results=no token_bucket:retry_budget_benchmarks \
+  --test_arg=--benchmark_filter=all \
+  --test_arg=--benchmark_repetitions=1 \
+  --test_arg=--benchmark_enable_random_interleaving=false
+
+sudo cpufreq-set -g powersave
+
+Every request is a first attempt that fails and asks for a retry, the budget
+refuses most of them. The synthetic clock moves by a fixed step.
+*/
+
+namespace mogo {
+namespace {
+
+constexpr absl::Duration kStep = absl::Microseconds(1);
+
+void BM_TryRetry(benchmark::State& state) {
+  absl::Time now = absl::UnixEpoch();
+  RetryBudget b(now, RetryBudget::Options());
+  int64_t retries = 0;
+  for (auto s : state) {
+    b.RecordAttempt(now);
+    retries += b.TryRetry(now);
+    now += kStep;
+  }
+  state.counters["retries"] =
+      benchmark::Counter(retries, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_TryRetry);
+
+void BM_TryRetryWithBucket(benchmark::State& state) {
+  absl::Time now = absl::UnixEpoch();
+  RetryBudget b(now, RetryBudget::Options());
+  SimpleTokenBucket tb(now);
+  int64_t retries = 0;
+  for (auto s : state) {
+    b.RecordAttempt(now);
+    retries += b.TryRetry(now, tb, absl::Microseconds(20)) ==
+               absl::ZeroDuration();
+    now += kStep;
+  }
+  state.counters["retries"] =
+      benchmark::Counter(retries, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_TryRetryWithBucket);
+
+}  // namespace
+}  // namespace mogo
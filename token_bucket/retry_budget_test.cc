@@ -0,0 +1,86 @@
+/*
+bazel test token_bucket:retry_budget_test
+*/
+
+#include "token_bucket/retry_budget.h"
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "token_bucket/simple_token_bucket.h"
+
+namespace mogo {
+namespace {
+
+TEST(RetryBudgetTest, RetriesAreAFractionOfAttempts) {
+  absl::Time now = absl::UnixEpoch();
+  RetryBudget::Options options;
+  options.retry_ratio = 0.1;
+  options.min_retries_per_second = 0;
+  options.interval = absl::Seconds(1);
+  RetryBudget b(now, options);
+
+  // No attempts, no retries.
+  ASSERT_FALSE(b.TryRetry(now));
+
+  // 1000 requests per second, every one of them fails and is retried.
+  int64_t retries = 0;
+  for (int i = 0; i < 10000; ++i) {
+    b.RecordAttempt(now);
+    if (b.TryRetry(now)) {
+      ++retries;
+    }
+    now += absl::Milliseconds(1);
+  }
+  LOG(INFO) << b << " retries: " << retries;
+  EXPECT_NEAR(retries, 1000, 20);
+  EXPECT_EQ(10000 - retries + 1, b.refused());
+}
+
+TEST(RetryBudgetTest, Floor) {
+  absl::Time now = absl::UnixEpoch();
+  RetryBudget::Options options;
+  options.retry_ratio = 0.1;
+  options.min_retries_per_second = 2;
+  options.interval = absl::Seconds(10);
+  RetryBudget b(now, options);
+
+  // 20 retries per interval without any attempts.
+  int64_t retries = 0;
+  for (int i = 0; i < 100; ++i) {
+    if (b.TryRetry(now)) {
+      ++retries;
+    }
+  }
+  EXPECT_EQ(20, retries);
+  // The retries expire with the interval.
+  now += absl::Seconds(11);
+  EXPECT_TRUE(b.CanRetry(now));
+}
+
+TEST(RetryBudgetTest, WithTokenBucket) {
+  absl::Time now = absl::UnixEpoch();
+  RetryBudget::Options options;
+  options.min_retries_per_second = 0;
+  RetryBudget b(now, options);
+  SimpleTokenBucket tb(now);
+  const absl::Duration cost = absl::Milliseconds(10);
+
+  for (int i = 0; i < 100; ++i) {
+    b.RecordAttempt(now);
+  }
+  // The budget allows 10 retries, the bucket one every 10ms.
+  ASSERT_EQ(absl::ZeroDuration(), b.TryRetry(now, tb, cost));
+  ASSERT_EQ(cost, b.TryRetry(now, tb, cost));
+  for (int i = 0; i < 9; ++i) {
+    now += cost;
+    ASSERT_EQ(absl::ZeroDuration(), b.TryRetry(now, tb, cost));
+  }
+  now += cost;
+  ASSERT_EQ(absl::InfiniteDuration(), b.TryRetry(now, tb, cost));
+  // The bucket refilled but the budget refused, no tokens were taken.
+  ASSERT_EQ(absl::ZeroDuration(), tb.TryGetTokens(now, cost));
+}
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,122 @@
+#include "token_bucket/sharded_token_bucket.h"
+
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "absl/log/check.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace mogo {
+
+namespace {
+
+int DefaultShardCount() {
+  int cpus = static_cast<int>(std::thread::hardware_concurrency());
+  return cpus > 0 ? cpus : 1;
+}
+
+}  // namespace
+
+ShardedTokenBucket::ShardedTokenBucket(absl::Time now, const Options& options)
+    : shard_count_(options.shard_count > 0 ? options.shard_count
+                                           : DefaultShardCount()),
+      global_ns_per_token_(1e9 / options.refill_rate),
+      rebalance_interval_ns_(
+          absl::ToInt64Nanoseconds(options.rebalance_interval)),
+      min_share_(options.max_rate_error / shard_count_),
+      next_rebalance_ns_(absl::ToUnixNanos(now + options.rebalance_interval)),
+      shards_(new Shard[shard_count_]),
+      demand_(shard_count_),
+      new_share_(shard_count_) {
+  CHECK_GT(options.refill_rate, 0);
+  // Every shard needs a non-zero share to have a finite token cost.
+  CHECK_GT(options.max_rate_error, 0);
+  CHECK_LE(options.max_rate_error, 1);
+  // Until there is some demand to go by the rate is split evenly.
+  for (int i = 0; i < shard_count_; ++i) {
+    shards_[i].ns_per_token.store(global_ns_per_token_ * shard_count_,
+                                  std::memory_order_relaxed);
+  }
+}
+
+int ShardedTokenBucket::CurrentShard() const {
+#ifdef __linux__
+  int cpu = sched_getcpu();
+  if (ABSL_PREDICT_TRUE(cpu >= 0)) {
+    return cpu % shard_count_;
+  }
+#endif
+  return std::hash<std::thread::id>()(std::this_thread::get_id()) %
+         shard_count_;
+}
+
+absl::Duration ShardedTokenBucket::TryGetTokensOnShard(int shard,
+                                                       absl::Time now,
+                                                       double token_count) {
+  DCHECK_GE(shard, 0);
+  DCHECK_LT(shard, shard_count_);
+  const int64_t now_ns = absl::ToUnixNanos(now);
+  MaybeRebalance(now_ns);
+
+  Shard& s = shards_[shard];
+  s.demand_ns.fetch_add(static_cast<int64_t>(token_count * global_ns_per_token_),
+                        std::memory_order_relaxed);
+  const int64_t cost_ns = static_cast<int64_t>(
+      token_count * s.ns_per_token.load(std::memory_order_relaxed));
+  return absl::Nanoseconds(s.tb.TryGetTokensNs(now_ns, cost_ns));
+}
+
+void ShardedTokenBucket::MaybeRebalance(int64_t now_ns) {
+  int64_t next_rebalance_ns =
+      next_rebalance_ns_.load(std::memory_order_relaxed);
+  if (ABSL_PREDICT_TRUE(now_ns < next_rebalance_ns)) {
+    return;
+  }
+  // Only the thread that moves the rebalance deadline forward rebalances.
+  if (next_rebalance_ns_.compare_exchange_strong(
+          next_rebalance_ns, now_ns + rebalance_interval_ns_,
+          std::memory_order_relaxed)) {
+    Rebalance(now_ns);
+  }
+}
+
+void ShardedTokenBucket::Rebalance(int64_t now_ns) {
+  int64_t total_demand = 0;
+  for (int i = 0; i < shard_count_; ++i) {
+    demand_[i] = shards_[i].demand_ns.exchange(0, std::memory_order_relaxed);
+    total_demand += demand_[i];
+  }
+  if (total_demand == 0) {
+    // Nothing to go by, keep the current assignment.
+    return;
+  }
+
+  // Each shard keeps `min_share_`, the rest is split proportionally to the
+  // demand.
+  const double distributed_share = 1.0 - min_share_ * shard_count_;
+  for (int i = 0; i < shard_count_; ++i) {
+    new_share_[i] = min_share_ + distributed_share *
+                                     static_cast<double>(demand_[i]) /
+                                     static_cast<double>(total_demand);
+  }
+
+  // Concurrent requests observe the shares changing one by one. Shrink the
+  // shares first so the sum of the shares never exceeds 1 on the way.
+  for (int i = 0; i < shard_count_; ++i) {
+    if (new_share_[i] < share(i)) {
+      SetShare(i, new_share_[i], now_ns);
+    }
+  }
+  for (int i = 0; i < shard_count_; ++i) {
+    if (new_share_[i] >= share(i)) {
+      SetShare(i, new_share_[i], now_ns);
+    }
+  }
+}
+
+}  // namespace mogo
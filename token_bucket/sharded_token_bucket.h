@@ -0,0 +1,139 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_SHARDED_TOKEN_BUCKET_H
+#define MOGO_EXP_TOKEN_BUCKET_SHARDED_TOKEN_BUCKET_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/base/optimization.h"
+#include "absl/time/time.h"
+#include "token_bucket/concurrent_token_bucket.h"
+
+namespace mogo {
+
+/*
+ShardedTokenBucket splits a global refill rate between a number of shards,
+by default one per CPU. A request only touches the shard of the CPU it runs on,
+so admission doesn't bounce a cache line between cores the way a single
+ConcurrentTokenBucket does.
+
+Each shard is a ConcurrentTokenBucket that refills at a fraction (share) of the
+global rate. The shares always sum up to at most 1, so the sharded bucket never
+admits more than the global rate, apart from the single request each shard
+allows through when it returns back to zero.
+
+A shard that is idle strands its share of the rate. To keep the stranded
+capacity low the shares are periodically rebalanced towards the shards that
+received the most demand during the last `rebalance_interval`. Every shard
+keeps a floor of `max_rate_error / shard_count` so an idle shard can still
+admit requests until the next rebalance, which bounds the capacity lost to
+idle shards by `max_rate_error` of the global rate.
+
+Thread-safe.
+*/
+class ShardedTokenBucket {
+ public:
+  struct Options {
+    // The global refill rate in tokens per second.
+    double refill_rate = 1;
+    // The number of shards, zero means one shard per CPU.
+    int shard_count = 0;
+    // How often the shares are recomputed from the observed demand.
+    absl::Duration rebalance_interval = absl::Milliseconds(100);
+    // The fraction of the global rate that is allowed to be stranded on idle
+    // shards, must be in (0, 1].
+    double max_rate_error = 0.01;
+  };
+
+  ShardedTokenBucket(absl::Time now, const Options& options);
+
+  // Attempts to extract the specified tokens from the shard of the current
+  // CPU.
+  // Returns absl::ZeroDuration() if the extraction was successful.
+  // Returns a delay that the caller should wait for until tokens are going to
+  // be available on this shard.
+  absl::Duration TryGetTokens(absl::Time now, double token_count) {
+    return TryGetTokensOnShard(CurrentShard(), now, token_count);
+  }
+
+  // Same as TryGetTokens, but for callers that pick the shard themselves, for
+  // example one shard per worker thread.
+  absl::Duration TryGetTokensOnShard(int shard, absl::Time now,
+                                     double token_count);
+
+  // Recomputes the shares from the demand recorded since the previous
+  // rebalance. Invoked automatically from TryGetTokens every
+  // `rebalance_interval`, exposed for tests and for callers that prefer to
+  // rebalance from a background thread. Such callers should set
+  // `rebalance_interval` to absl::InfiniteDuration(), Rebalance calls must not
+  // overlap with each other.
+  void Rebalance(absl::Time now) { Rebalance(absl::ToUnixNanos(now)); }
+
+  int shard_count() const { return shard_count_; }
+
+  // The fraction of the global rate currently assigned to `shard`.
+  double share(int shard) const {
+    return global_ns_per_token_ /
+           shards_[shard].ns_per_token.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct alignas(ABSL_CACHELINE_SIZE) Shard {
+    // Like SimpleTokenBucket the shards allow the first request through.
+    ConcurrentTokenBucket tb{absl::InfinitePast()};
+    // The cost of one token on this shard, in nanoseconds of shard time.
+    std::atomic<double> ns_per_token{0};
+    // The cost of all requests, admitted or not, received by the shard since
+    // the previous rebalance, in nanoseconds at the global rate.
+    std::atomic<int64_t> demand_ns{0};
+  };
+
+  int CurrentShard() const;
+
+  void MaybeRebalance(int64_t now_ns);
+
+  void Rebalance(int64_t now_ns);
+
+  // The tokens the shard already handed out are charged at the new price as
+  // well. Otherwise a shard that got a large request at the floor share stays
+  // blocked for long after its share grows.
+  //
+  // The price and the debt can't change together. The step that makes tokens
+  // more expensive goes first, so that requests charged in between pay at
+  // least the new price: a rising price is published before the debt is
+  // rescaled, and requests that already paid the new price are rescaled once
+  // more; a falling price is published after, and requests in between pay the
+  // old one. What remains is a request that read the old price before the
+  // change and is charged after the rescale, at most one per caller thread.
+  void SetShare(int shard, double share, int64_t now_ns) {
+    Shard& s = shards_[shard];
+    const double ns_per_token = global_ns_per_token_ / share;
+    const double old_ns_per_token =
+        s.ns_per_token.load(std::memory_order_relaxed);
+    const double factor = ns_per_token / old_ns_per_token;
+    if (factor > 1) {
+      s.ns_per_token.store(ns_per_token, std::memory_order_relaxed);
+      s.tb.ScaleDebtNs(now_ns, factor);
+    } else {
+      s.tb.ScaleDebtNs(now_ns, factor);
+      s.ns_per_token.store(ns_per_token, std::memory_order_relaxed);
+    }
+  }
+
+  const int shard_count_;
+  const double global_ns_per_token_;
+  const int64_t rebalance_interval_ns_;
+  // The share every shard keeps regardless of its demand.
+  const double min_share_;
+
+  std::atomic<int64_t> next_rebalance_ns_;
+  std::unique_ptr<Shard[]> shards_;
+  // Scratch space of Rebalance, one entry per shard.
+  std::vector<int64_t> demand_;
+  std::vector<double> new_share_;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_SHARDED_TOKEN_BUCKET_H
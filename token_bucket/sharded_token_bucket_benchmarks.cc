@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/log/log.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "token_bucket/concurrent_token_bucket.h"
+#include "token_bucket/sharded_token_bucket.h"
+
+/*
+sudo cpufreq-set -g performance
+
+bazel test -c opt --dynamic_mode=off --test_output=streamed \
+  --cache_test_results=no token_bucket:sharded_token_bucket_benchmarks \
+  --test_arg=--benchmark_filter=all \
+  --test_arg=--benchmark_repetitions=1 \
+  --test_arg=--benchmark_enable_random_interleaving=false
+
+sudo cpufreq-set -g powersave
+
+`admits` is the aggregate number of admitted requests per second across all
+threads. `rate_ratio` is the admitted rate divided by the configured global
+rate, 1 means the global rate is enforced exactly. The configured rate is lower
+than what a single thread can issue, so every configuration is saturated.
+*/
+
+namespace mogo {
+namespace {
+
+constexpr double kRate = 1e6;
+
+absl::Duration TryGetOne(ConcurrentTokenBucket& tb, absl::Time now) {
+  return tb.TryGetTokens(now, absl::Seconds(1) / kRate);
+}
+
+absl::Duration TryGetOne(ShardedTokenBucket& tb, absl::Time now) {
+  return tb.TryGetTokens(now, 1);
+}
+
+template <typename TokenBucket>
+TokenBucket* NewTokenBucket(absl::Time now);
+
+template <>
+ConcurrentTokenBucket* NewTokenBucket<ConcurrentTokenBucket>(absl::Time now) {
+  return new ConcurrentTokenBucket(now);
+}
+
+template <>
+ShardedTokenBucket* NewTokenBucket<ShardedTokenBucket>(absl::Time now) {
+  ShardedTokenBucket::Options options;
+  options.refill_rate = kRate;
+  return new ShardedTokenBucket(now, options);
+}
+
+// The admits of all the threads of a run. The run lasts until the last thread
+// leaves the timing loop, the threads don't all take the same time.
+class RunTotals {
+ public:
+  // Thread 0 calls it before the timing loop, the other threads can't add
+  // before the loop ends.
+  void Reset(absl::Time start_time, int threads) {
+    absl::MutexLock lock(&mu_);
+    start_time_ = start_time;
+    end_time_ = start_time;
+    admits_ = 0;
+    pending_ = threads;
+  }
+
+  void Add(int64_t admits, absl::Time end_time) {
+    absl::MutexLock lock(&mu_);
+    admits_ += admits;
+    end_time_ = std::max(end_time_, end_time);
+    --pending_;
+  }
+
+  // Waits for all the threads to add theirs, returns the admitted requests
+  // per second.
+  double AdmitRate() {
+    absl::MutexLock lock(&mu_);
+    mu_.Await(absl::Condition(this, &RunTotals::AllAdded));
+    return admits_ / absl::ToDoubleSeconds(end_time_ - start_time_);
+  }
+
+ private:
+  bool AllAdded() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return pending_ == 0;
+  }
+
+  absl::Mutex mu_;
+  absl::Time start_time_ ABSL_GUARDED_BY(mu_);
+  absl::Time end_time_ ABSL_GUARDED_BY(mu_);
+  int64_t admits_ ABSL_GUARDED_BY(mu_) = 0;
+  int pending_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+template <typename TokenBucket>
+void BM_SaturatedAdmit(benchmark::State& state) {
+  // Shared between all benchmark threads, the instance from the previous run
+  // is destroyed before the timing loop of the next run starts.
+  static TokenBucket* tb = nullptr;
+  static RunTotals totals;
+  if (state.thread_index() == 0) {
+    delete tb;
+    const absl::Time now = absl::Now();
+    tb = NewTokenBucket<TokenBucket>(now);
+    totals.Reset(now, state.threads());
+  }
+  int64_t admits = 0;
+  for (auto s : state) {
+    if (TryGetOne(*tb, absl::Now()) == absl::ZeroDuration()) {
+      ++admits;
+    }
+  }
+  totals.Add(admits, absl::Now());
+  // Only thread 0 reports, the framework sums the counters.
+  if (state.thread_index() == 0) {
+    const double admit_rate = totals.AdmitRate();
+    state.counters["admits"] = admit_rate;
+    state.counters["rate_ratio"] = admit_rate / kRate;
+  }
+  VLOG(2) << admits;
+}
+BENCHMARK(BM_SaturatedAdmit<ConcurrentTokenBucket>)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+BENCHMARK(BM_SaturatedAdmit<ShardedTokenBucket>)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,148 @@
+/*
+bazel test token_bucket:sharded_token_bucket_test
+*/
+
+#include "token_bucket/sharded_token_bucket.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/time/clock.h"
+#include "gtest/gtest.h"
+
+namespace mogo {
+namespace {
+
+constexpr int kShardCount = 4;
+constexpr double kRate = 10000;
+
+ShardedTokenBucket::Options TestOptions() {
+  ShardedTokenBucket::Options options;
+  options.refill_rate = kRate;
+  options.shard_count = kShardCount;
+  options.rebalance_interval = absl::Milliseconds(100);
+  options.max_rate_error = 0.01;
+  return options;
+}
+
+// Simulates `busy_shards` callers that issue requests of `token_count` tokens
+// as fast as the shard allows for `duration`. Returns the total admitted rate
+// in tokens per second.
+double RunSimulation(ShardedTokenBucket& t, absl::Time& now,
+                     int busy_shards, absl::Duration duration,
+                     double token_count = 1) {
+  const absl::Time start_time = now;
+  const absl::Time end_time = now + duration;
+  // The time when each simulated caller is going to issue the next request.
+  std::vector<absl::Time> next_request(busy_shards, now);
+  int64_t request_count = 0;
+  while (now < end_time) {
+    // Advance to the earliest caller.
+    int shard = 0;
+    for (int i = 1; i < busy_shards; ++i) {
+      if (next_request[i] < next_request[shard]) shard = i;
+    }
+    now = next_request[shard];
+    absl::Duration d = t.TryGetTokensOnShard(shard, now, token_count);
+    if (d == absl::ZeroDuration()) {
+      ++request_count;
+      // Not too fast, so the other shards get a chance to run.
+      next_request[shard] = now + absl::Microseconds(1);
+    } else {
+      next_request[shard] = now + d;
+    }
+  }
+  return request_count * token_count /
+         absl::ToDoubleSeconds(now - start_time);
+}
+
+TEST(ShardedTokenBucketTest, AllShardsBusy) {
+  absl::Time now = absl::UnixEpoch();
+  ShardedTokenBucket t(now, TestOptions());
+  double rate = RunSimulation(t, now, kShardCount, absl::Seconds(10));
+  LOG(INFO) << "Total rate: " << rate << " r/s";
+  ASSERT_NEAR(rate, kRate, kRate * 0.01);
+  for (int i = 0; i < kShardCount; ++i) {
+    ASSERT_NEAR(t.share(i), 1.0 / kShardCount, 0.01);
+  }
+}
+
+TEST(ShardedTokenBucketTest, RebalancesTowardsBusyShard) {
+  absl::Time now = absl::UnixEpoch();
+  ShardedTokenBucket t(now, TestOptions());
+  // Before the first rebalance only a quarter of the rate is available.
+  double rate = RunSimulation(t, now, 1, absl::Milliseconds(99));
+  LOG(INFO) << "Rate before rebalance: " << rate << " r/s";
+  ASSERT_LT(rate, kRate / 2);
+
+  // Warm-up, let the shares converge.
+  RunSimulation(t, now, 1, absl::Seconds(1));
+  LOG(INFO) << "Shares: " << t.share(0) << " " << t.share(1) << " "
+            << t.share(2) << " " << t.share(3);
+  ASSERT_GT(t.share(0), 0.99);
+
+  rate = RunSimulation(t, now, 1, absl::Seconds(10));
+  LOG(INFO) << "Total rate: " << rate << " r/s";
+  // Never more than the global rate, at most `max_rate_error` less.
+  ASSERT_LE(rate, kRate + 1);
+  ASSERT_GE(rate, kRate * (1 - 0.01) - 1);
+}
+
+TEST(ShardedTokenBucketTest, SharesFollowTheLoad) {
+  absl::Time now = absl::UnixEpoch();
+  ShardedTokenBucket t(now, TestOptions());
+  RunSimulation(t, now, 1, absl::Seconds(1));
+  ASSERT_GT(t.share(0), 0.99);
+
+  // The load moves to all shards, the rate gets split evenly again.
+  RunSimulation(t, now, kShardCount, absl::Seconds(1));
+  double rate = RunSimulation(t, now, kShardCount, absl::Seconds(10));
+  LOG(INFO) << "Total rate: " << rate << " r/s";
+  ASSERT_NEAR(rate, kRate, kRate * 0.01);
+}
+
+TEST(ShardedTokenBucketTest, LoadMovesToAFloorShare) {
+  ShardedTokenBucket::Options options = TestOptions();
+  options.shard_count = 64;
+  absl::Time now = absl::UnixEpoch();
+  ShardedTokenBucket t(now, options);
+  RunSimulation(t, now, 1, absl::Seconds(1), /*token_count=*/100);
+  ASSERT_GT(t.share(0), 0.99);
+
+  // The caller moves to shard 1, like a thread migrating to another CPU, and
+  // checks back at least every 10ms. At the floor share its first request
+  // costs 64 seconds of the shard's time, rebalancing has to bring that down
+  // together with the share.
+  const absl::Time measure_from = now + absl::Seconds(1);
+  const absl::Time end_time = measure_from + absl::Seconds(5);
+  int64_t admitted_tokens = 0;
+  while (now < end_time) {
+    absl::Duration d = t.TryGetTokensOnShard(1, now, 100);
+    if (d == absl::ZeroDuration()) {
+      if (now >= measure_from) admitted_tokens += 100;
+      now += absl::Microseconds(1);
+    } else {
+      now += std::min(d, absl::Milliseconds(10));
+    }
+  }
+  ASSERT_GT(t.share(1), 0.99);
+  double rate = admitted_tokens / 5.0;
+  LOG(INFO) << "Total rate: " << rate << " r/s";
+  ASSERT_LE(rate, kRate + 100);
+  ASSERT_GE(rate, kRate * (1 - 0.02));
+}
+
+TEST(ShardedTokenBucketTest, CurrentCpuShard) {
+  ShardedTokenBucket::Options options = TestOptions();
+  options.shard_count = 0;
+  absl::Time now = absl::Now();
+  ShardedTokenBucket t(now, options);
+  ASSERT_GT(t.shard_count(), 0);
+  // The first request on any shard is allowed through.
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, 1));
+}
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,115 @@
+#include "token_bucket/shared_memory_token_bucket.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+
+namespace mogo {
+
+absl::StatusOr<std::unique_ptr<SharedMemoryTokenBucket>>
+SharedMemoryTokenBucket::Open(const std::string& name,
+                              absl::Duration burst_tokens) {
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("shm_open ", name));
+  }
+  return Map(fd, name, burst_tokens);
+}
+
+absl::StatusOr<std::unique_ptr<SharedMemoryTokenBucket>>
+SharedMemoryTokenBucket::OpenFile(const std::string& path,
+                                  absl::Duration burst_tokens) {
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("open ", path));
+  }
+  return Map(fd, path, burst_tokens);
+}
+
+absl::Status SharedMemoryTokenBucket::Unlink(const std::string& name) {
+  if (shm_unlink(name.c_str()) != 0) {
+    return absl::ErrnoToStatus(errno, absl::StrCat("shm_unlink ", name));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::unique_ptr<SharedMemoryTokenBucket>>
+SharedMemoryTokenBucket::Map(int fd, const std::string& name,
+                             absl::Duration burst_tokens) {
+  // Growing the file zero-fills it, which is a valid full bucket. If several
+  // processes race here they all grow it to the same size.
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      (st.st_size < static_cast<off_t>(sizeof(State)) &&
+       ftruncate(fd, sizeof(State)) != 0)) {
+    const int err = errno;
+    close(fd);
+    return absl::ErrnoToStatus(err, absl::StrCat("Can't size ", name));
+  }
+  void* addr =
+      mmap(nullptr, sizeof(State), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  const int err = errno;
+  // The mapping keeps the segment alive.
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return absl::ErrnoToStatus(err, absl::StrCat("mmap ", name));
+  }
+  State* state = static_cast<State*>(addr);
+
+  uint64_t magic = 0;
+  if (!state->magic.compare_exchange_strong(magic, State::kMagic) &&
+      magic != State::kMagic) {
+    munmap(addr, sizeof(State));
+    return absl::FailedPreconditionError(
+        absl::StrCat(name, " is not a shared token bucket"));
+  }
+
+  const int64_t burst_ns = absl::ToInt64Nanoseconds(burst_tokens);
+  int64_t recorded = 0;
+  if (!state->burst_ns_plus_one.compare_exchange_strong(recorded,
+                                                        burst_ns + 1) &&
+      recorded != burst_ns + 1) {
+    munmap(addr, sizeof(State));
+    return absl::FailedPreconditionError(
+        absl::StrCat(name, " has a burst of ",
+                     absl::FormatDuration(absl::Nanoseconds(recorded - 1)),
+                     ", not ", absl::FormatDuration(burst_tokens)));
+  }
+  return std::unique_ptr<SharedMemoryTokenBucket>(
+      new SharedMemoryTokenBucket(state, burst_ns));
+}
+
+SharedMemoryTokenBucket::~SharedMemoryTokenBucket() {
+  munmap(state_, sizeof(State));
+}
+
+int64_t SharedMemoryTokenBucket::TryGetTokensNs(int64_t now_ns,
+                                                int64_t tokens_ns) {
+  int64_t zero_time_ns = state_->zero_time_ns.load(std::memory_order_relaxed);
+  while (true) {
+    if (now_ns < zero_time_ns) {
+      return zero_time_ns - now_ns;
+    }
+    // Same as BurstTokenBucket: never accumulate more than `burst_ns_` of
+    // tokens. On failure `zero_time_ns` is reloaded and checked again.
+    if (ABSL_PREDICT_TRUE(state_->zero_time_ns.compare_exchange_weak(
+            zero_time_ns, std::max(zero_time_ns, now_ns - burst_ns_) + tokens_ns,
+            std::memory_order_relaxed, std::memory_order_relaxed))) {
+      return 0;
+    }
+  }
+}
+
+}  // namespace mogo
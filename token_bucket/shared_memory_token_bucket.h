@@ -0,0 +1,100 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_SHARED_MEMORY_TOKEN_BUCKET_H
+#define MOGO_EXP_TOKEN_BUCKET_SHARED_MEMORY_TOKEN_BUCKET_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/base/optimization.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+
+namespace mogo {
+
+/*
+SharedMemoryTokenBucket is a BurstTokenBucket whose state lives in shared
+memory, so all processes on a host draw from a single bucket, for example a
+per-host egress limit shared by all worker processes. There is no IPC on the
+hot path, admission is a compare-and-swap loop on a 64-bit atomic in the
+mapping, same as in ConcurrentTokenBucket.
+
+The segment is either a POSIX shared memory object (Open) or a regular file
+(OpenFile), e.g. one on a tmpfs. Processes that open the same name share the
+bucket. The segment outlives the processes until it is removed with Unlink.
+
+Robustness: every update of the shared state is a single atomic
+compare-and-swap, there are no locks and no multi-word updates. A process that
+dies at any point, even in the middle of TryGetTokens, leaves the bucket in a
+consistent state; at worst the tokens it took are never used. A freshly
+created, zero-filled segment is a valid full bucket, so there is no
+initialization step that could be interrupted either.
+
+The burst is recorded in the segment by the first process that opens it, all
+other processes must pass the same burst. Time is CLOCK_REALTIME (absl::Now),
+which is the same in all processes.
+
+Thread-safe.
+*/
+class SharedMemoryTokenBucket {
+ public:
+  // Opens the shared memory object `name` (see shm_open, e.g. "/egress"),
+  // creating it if it doesn't exist.
+  static absl::StatusOr<std::unique_ptr<SharedMemoryTokenBucket>> Open(
+      const std::string& name, absl::Duration burst_tokens);
+
+  // Same as Open, but the state lives in the file at `path`.
+  static absl::StatusOr<std::unique_ptr<SharedMemoryTokenBucket>> OpenFile(
+      const std::string& path, absl::Duration burst_tokens);
+
+  // Removes the shared memory object `name`. Processes that have it open keep
+  // using it, new ones get a fresh bucket.
+  static absl::Status Unlink(const std::string& name);
+
+  SharedMemoryTokenBucket(const SharedMemoryTokenBucket&) = delete;
+  SharedMemoryTokenBucket& operator=(const SharedMemoryTokenBucket&) = delete;
+
+  ~SharedMemoryTokenBucket();
+
+  // Attempts to extract the specified tokens from the token bucket.
+  // Returns absl::ZeroDuration() if the extraction was successful.
+  // Returns a delay that the caller should wait for until tokens are going to
+  // be available.
+  absl::Duration TryGetTokens(absl::Time now, absl::Duration tokens) {
+    return absl::Nanoseconds(TryGetTokensNs(absl::ToUnixNanos(now),
+                                            absl::ToInt64Nanoseconds(tokens)));
+  }
+
+  // Same as TryGetTokens, but in nanoseconds since the unix epoch.
+  int64_t TryGetTokensNs(int64_t now_ns, int64_t tokens_ns);
+
+ private:
+  // The layout of the segment. Zero-filled memory is a valid full bucket.
+  struct State {
+    static constexpr uint64_t kMagic = 0x544253484d454d31;  // "TBSHMEM1"
+
+    // Set once by the first process that opens the segment.
+    std::atomic<uint64_t> magic;
+    // burst_ns + 1, zero until recorded.
+    std::atomic<int64_t> burst_ns_plus_one;
+    // The time when the token bucket returns back to zero, in nanoseconds since
+    // the unix epoch. In its own cache line, it's the only contended field.
+    alignas(ABSL_CACHELINE_SIZE) std::atomic<int64_t> zero_time_ns;
+  };
+  static_assert(std::atomic<int64_t>::is_always_lock_free,
+                "Atomics in shared memory have to be address-free");
+
+  static absl::StatusOr<std::unique_ptr<SharedMemoryTokenBucket>> Map(
+      int fd, const std::string& name, absl::Duration burst_tokens);
+
+  SharedMemoryTokenBucket(State* state, int64_t burst_ns)
+      : state_(state), burst_ns_(burst_ns) {}
+
+  State* const state_;
+  const int64_t burst_ns_;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_SHARED_MEMORY_TOKEN_BUCKET_H
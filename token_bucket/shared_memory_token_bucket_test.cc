@@ -0,0 +1,169 @@
+/*
+bazel test token_bucket:shared_memory_token_bucket_test
+*/
+
+#include "token_bucket/shared_memory_token_bucket.h"
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace mogo {
+namespace {
+
+std::string UniqueName(const std::string& test) {
+  return absl::StrCat("/shm_token_bucket_test_", test, "_", getpid());
+}
+
+TEST(SharedMemoryTokenBucketTest, SharedBetweenInstances) {
+  const std::string name = UniqueName("instances");
+  const absl::Duration burst = absl::Milliseconds(2);
+  const absl::Duration token = absl::Milliseconds(1);
+  auto a = SharedMemoryTokenBucket::Open(name, burst);
+  ASSERT_TRUE(a.ok()) << a.status();
+  auto b = SharedMemoryTokenBucket::Open(name, burst);
+  ASSERT_TRUE(b.ok()) << b.status();
+
+  // A new bucket is full, the burst is shared by both instances.
+  absl::Time now = absl::Now();
+  ASSERT_EQ(absl::ZeroDuration(), (*a)->TryGetTokens(now, token));
+  ASSERT_EQ(absl::ZeroDuration(), (*b)->TryGetTokens(now, token));
+  ASSERT_EQ(absl::ZeroDuration(), (*a)->TryGetTokens(now, token));
+  ASSERT_EQ(token, (*b)->TryGetTokens(now, token));
+  now += token;
+  ASSERT_EQ(absl::ZeroDuration(), (*b)->TryGetTokens(now, token));
+  ASSERT_EQ(token, (*a)->TryGetTokens(now, token));
+
+  ASSERT_TRUE(SharedMemoryTokenBucket::Unlink(name).ok());
+  // Open instances keep working after Unlink.
+  now += 3 * token;
+  ASSERT_EQ(absl::ZeroDuration(), (*a)->TryGetTokens(now, token));
+}
+
+TEST(SharedMemoryTokenBucketTest, BurstMismatch) {
+  const std::string name = UniqueName("mismatch");
+  auto a = SharedMemoryTokenBucket::Open(name, absl::Milliseconds(2));
+  ASSERT_TRUE(a.ok()) << a.status();
+  auto b = SharedMemoryTokenBucket::Open(name, absl::Milliseconds(3));
+  ASSERT_EQ(absl::StatusCode::kFailedPrecondition, b.status().code())
+      << b.status();
+  ASSERT_TRUE(SharedMemoryTokenBucket::Unlink(name).ok());
+}
+
+TEST(SharedMemoryTokenBucketTest, OpenFile) {
+  const std::string path =
+      absl::StrCat(::testing::TempDir(), "/shm_token_bucket_", getpid());
+  const absl::Duration token = absl::Milliseconds(1);
+  auto a = SharedMemoryTokenBucket::OpenFile(path, absl::ZeroDuration());
+  ASSERT_TRUE(a.ok()) << a.status();
+  auto b = SharedMemoryTokenBucket::OpenFile(path, absl::ZeroDuration());
+  ASSERT_TRUE(b.ok()) << b.status();
+  absl::Time now = absl::Now();
+  ASSERT_EQ(absl::ZeroDuration(), (*a)->TryGetTokens(now, token));
+  ASSERT_EQ(token, (*b)->TryGetTokens(now, token));
+  unlink(path.c_str());
+}
+
+// Worker processes compete for a single bucket, together they must not get
+// more than the rate plus the burst.
+TEST(SharedMemoryTokenBucketTest, ProcessesNeverOverAdmit) {
+  constexpr int kProcessCount = 4;
+  const std::string name = UniqueName("processes");
+  const absl::Duration burst = absl::Milliseconds(1);
+  const absl::Duration request_cost = absl::Microseconds(10);
+  auto t = SharedMemoryTokenBucket::Open(name, burst);
+  ASSERT_TRUE(t.ok()) << t.status();
+
+  // Per process admitted counts, in an anonymous shared mapping.
+  void* mem = mmap(nullptr, sizeof(int64_t) * kProcessCount,
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(MAP_FAILED, mem);
+  int64_t* admitted = static_cast<int64_t*>(mem);
+
+  const absl::Time start_time = absl::Now();
+  const absl::Time end_time = start_time + absl::Milliseconds(200);
+  std::vector<pid_t> children;
+  for (int i = 0; i < kProcessCount; ++i) {
+    const pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      // Each process opens the bucket on its own, as independent workers do.
+      auto child = SharedMemoryTokenBucket::Open(name, burst);
+      if (!child.ok()) _exit(1);
+      int64_t count = 0;
+      while (true) {
+        absl::Time now = absl::Now();
+        if (now >= end_time) break;
+        if ((*child)->TryGetTokens(now, request_cost) ==
+            absl::ZeroDuration()) {
+          ++count;
+        }
+      }
+      admitted[i] = count;
+      _exit(0);
+    }
+    children.push_back(pid);
+  }
+  int64_t total = 0;
+  for (int i = 0; i < kProcessCount; ++i) {
+    int status;
+    ASSERT_EQ(children[i], waitpid(children[i], &status, 0));
+    ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    LOG(INFO) << "Process " << i << " admitted: " << admitted[i];
+    total += admitted[i];
+  }
+  const int64_t limit =
+      (end_time - start_time + burst) / request_cost + kProcessCount;
+  LOG(INFO) << "Admitted: " << total << " limit: " << limit;
+  ASSERT_LE(total, limit);
+  // The processes together keep the bucket busy.
+  ASSERT_GT(total, limit / 2);
+  munmap(mem, sizeof(int64_t) * kProcessCount);
+  ASSERT_TRUE(SharedMemoryTokenBucket::Unlink(name).ok());
+}
+
+// A worker killed in the middle of hammering the bucket leaves it usable.
+TEST(SharedMemoryTokenBucketTest, SurvivesKilledProcess) {
+  const std::string name = UniqueName("killed");
+  const absl::Duration token = absl::Microseconds(10);
+  auto t = SharedMemoryTokenBucket::Open(name, absl::ZeroDuration());
+  ASSERT_TRUE(t.ok()) << t.status();
+
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    auto child = SharedMemoryTokenBucket::Open(name, absl::ZeroDuration());
+    if (!child.ok()) _exit(1);
+    while (true) {
+      (*child)->TryGetTokens(absl::Now(), token);
+    }
+  }
+  absl::SleepFor(absl::Milliseconds(50));
+  ASSERT_EQ(0, kill(pid, SIGKILL));
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFSIGNALED(status));
+
+  // At most one token can be outstanding.
+  const absl::Time now = absl::Now();
+  ASSERT_LE((*t)->TryGetTokens(now, token), token);
+  ASSERT_EQ(absl::ZeroDuration(), (*t)->TryGetTokens(now + token, token));
+  ASSERT_TRUE(SharedMemoryTokenBucket::Unlink(name).ok());
+}
+
+}  // namespace
+}  // namespace mogo
@@ -1,35 +1,186 @@
 #ifndef MOGO_EXP_TOKEN_BUCKET_SIMPLE_TOKEN_BUCKET_H
 #define MOGO_EXP_TOKEN_BUCKET_SIMPLE_TOKEN_BUCKET_H
 
+#include <algorithm>
+#include <optional>
+
+#include "absl/base/attributes.h"
+#include "absl/log/check.h"
 #include "absl/strings/str_format.h"
 #include "absl/time/time.h"
+#include "token_bucket/clock_domain.h"
 
 namespace mogo {
 
+// The default Metrics of the token buckets, records nothing and takes no space.
+// A Metrics type is constructed from the bucket's `now` and provides
+// RecordAdmit(now, tokens) for every admitted TryGetTokens call and
+// RecordDelay(now, delay) for every delayed one, see token_bucket_metrics.h.
+struct NoTokenBucketMetrics {
+  template <typename Time>
+  constexpr explicit NoTokenBucketMetrics(Time) {}
+
+  template <typename Time, typename Duration>
+  void RecordAdmit(Time, Duration) {}
+  template <typename Time, typename Duration>
+  void RecordDelay(Time, Duration) {}
+};
+
+template <typename Domain, typename Metrics = NoTokenBucketMetrics>
+class BasicSimpleTokenBucket;
+
+// A slot reserved in a token bucket, see BasicSimpleTokenBucket::Reserve.
+template <typename Domain>
+struct TokenReservation {
+  using Time = typename Domain::Time;
+  using Duration = typename Domain::Duration;
+
+  // Identifies the reservation when refunding unused tokens.
+  class Ticket {
+   public:
+    Duration tokens() const { return tokens_; }
+
+   private:
+    template <typename D, typename M>
+    friend class BasicSimpleTokenBucket;
+
+    Ticket(Time reserved_from, Duration tokens)
+        : reserved_from_(reserved_from), tokens_(tokens) {}
+
+    // Where the reservation starts on the time line of the bucket that made
+    // it, refunds never move the bucket before that.
+    Time reserved_from_;
+    Duration tokens_;
+  };
+
+  // The time when the request may start.
+  Time start_time;
+  Ticket ticket;
+};
+
+// The outcome of a partial acquisition, see
+// BasicSimpleTokenBucket::TryGetPartialTokens.
+template <typename Domain>
+struct TokenGrant {
+  using Duration = typename Domain::Duration;
+
+  // The tokens extracted, Domain::Zero() if the bucket is below zero.
+  Duration granted;
+  // The tokens of the request still to be acquired.
+  Duration remaining;
+  // How long until the bucket hands out more tokens, Domain::Zero() when
+  // nothing remains.
+  Duration delay;
+};
+
 // Refills at one second per second.
-// Tokens extracted in units of absl::Duration.
+// Tokens extracted in units of the clock domain's Duration, see clock_domain.h.
 // Has no burst, but the first request is going to be allowed through.
-class SimpleTokenBucket {
+// TryGetTokens calls are recorded in `Metrics`, reservations are not.
+template <typename Domain, typename Metrics>
+class BasicSimpleTokenBucket {
  public:
-  explicit SimpleTokenBucket(absl::Time now) : zero_time_(now) {}
+  using Time = typename Domain::Time;
+  using Duration = typename Domain::Duration;
+
+  constexpr explicit BasicSimpleTokenBucket(Time now)
+      : zero_time_(now), metrics_(now) {}
 
   // Attempts to extract the specified tokens from the token bucket.
-  // Returns absl::ZeroDuration() if the extraction was successful.
+  // Returns Domain::Zero() if the extraction was successful.
   // Returns a delay that the caller should wait for until tokens are going to
   // be available.
-  absl::Duration TryGetTokens(absl::Time now, absl::Duration d);
+  Duration TryGetTokens(Time now, Duration d) {
+    if (now >= zero_time_) {
+      // If the bucket has already returned back to zero, extract tokens and
+      // allow the request through.
+      zero_time_ = now + d;
+      metrics_.RecordAdmit(now, d);
+      return Domain::Zero();
+    } else {
+      metrics_.RecordDelay(now, zero_time_ - now);
+      return zero_time_ - now;
+    }
+  }
+
+  using Grant = TokenGrant<Domain>;
+
+  // Extracts at most `max_chunk` of the requested tokens, a large request
+  // acquired chunk by chunk delays the requests behind it by one chunk instead
+  // of by the whole request. Each chunk is admitted like a TryGetTokens call.
+  Grant TryGetPartialTokens(Time now, Duration tokens, Duration max_chunk) {
+    DCHECK_GT(max_chunk, Domain::Zero());
+    const Duration chunk = std::min(tokens, max_chunk);
+    const Duration delay = TryGetTokens(now, chunk);
+    if (delay != Domain::Zero()) {
+      return {Domain::Zero(), tokens, delay};
+    }
+    const Duration remaining = tokens - chunk;
+    return {chunk, remaining,
+            remaining == Domain::Zero() ? Domain::Zero()
+                                        : EarliestStart(now) - now};
+  }
+
+  const Metrics& metrics() const { return metrics_; }
+
+  using Reservation = TokenReservation<Domain>;
+
+  // Returns the time when a request arriving at `now` would get its tokens.
+  // Doesn't change the bucket.
+  Time EarliestStart(Time now) const { return std::max(now, zero_time_); }
+
+  // Reserves the tokens for a request arriving at `now`, always succeeds. The
+  // request may start at the returned start time, later reservations start
+  // after it.
+  Reservation Reserve(Time now, Duration d) {
+    const Time start = EarliestStart(now);
+    zero_time_ = start + d;
+    return {start, {start, d}};
+  }
+
+  // Same as Reserve, but if the request can't start by `deadline` returns
+  // std::nullopt and leaves the bucket unchanged.
+  std::optional<Reservation> TryReserve(Time now, Duration d, Time deadline) {
+    if (EarliestStart(now) > deadline) {
+      return std::nullopt;
+    }
+    return Reserve(now, d);
+  }
+
+  // Credits back `unused` tokens of a reservation, e.g. when a request charged
+  // for its estimated size turned out smaller. The tokens go to the next
+  // reservations, the start times already handed out don't change. Each ticket
+  // should be refunded at most once.
+  void Refund(const typename Reservation::Ticket& ticket, Duration unused) {
+    DCHECK_GE(unused, Domain::Zero());
+    DCHECK_LE(unused, ticket.tokens_);
+    zero_time_ = std::max(zero_time_ - unused, ticket.reserved_from_);
+  }
+
+  // The tokens extracted and not refilled yet at `now`.
+  Duration Debt(Time now) const {
+    return now < zero_time_ ? zero_time_ - now : Domain::Zero();
+  }
+
+  // Replaces the tokens owed at `now` with `debt`.
+  void SetDebt(Time now, Duration debt) { zero_time_ = now + debt; }
 
   template <typename Sink>
-  friend void AbslStringify(Sink& sink, SimpleTokenBucket stb) {
+  friend void AbslStringify(Sink& sink, const BasicSimpleTokenBucket& stb) {
     absl::Format(&sink, "{SimpleTokenBucket zero_time: %v} ", stb.zero_time_);
   }
 
  private:
   // The time when the token bucket returns back to zero and starts allowing
   // requests through.
-  absl::Time zero_time_;
+  Time zero_time_;
+  ABSL_ATTRIBUTE_NO_UNIQUE_ADDRESS Metrics metrics_;
 };
 
+extern template class BasicSimpleTokenBucket<AbslTimeDomain>;
+
+using SimpleTokenBucket = BasicSimpleTokenBucket<AbslTimeDomain>;
+
 }  // namespace mogo
 
-#endif  // MOGO_EXP_TOKEN_BUCKET_SIMPLE_TOKEN_BUCKET_H
\ No newline at end of file
+#endif  // MOGO_EXP_TOKEN_BUCKET_SIMPLE_TOKEN_BUCKET_H
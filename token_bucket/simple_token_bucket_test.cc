@@ -4,6 +4,8 @@ bazel test token_bucket:simple_token_bucket_test
 
 #include "token_bucket/simple_token_bucket.h"
 
+#include <optional>
+
 #include "absl/log/log.h"
 #include "absl/time/clock.h"
 #include "gtest/gtest.h"
@@ -44,5 +46,88 @@ TEST(SimpleTokenBucketTest, Test50s) {
               /*abs_error=*/1);
 }
 
+TEST(SimpleTokenBucketTest, Reserve) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  mogo::SimpleTokenBucket t(now);
+
+  SimpleTokenBucket::Reservation r1 = t.Reserve(now, 10 * token);
+  ASSERT_EQ(now, r1.start_time);
+  SimpleTokenBucket::Reservation r2 = t.Reserve(now, 10 * token);
+  ASSERT_EQ(now + 10 * token, r2.start_time);
+  ASSERT_EQ(now + 20 * token, t.EarliestStart(now));
+
+  // Doesn't fit before the deadline, nothing changes.
+  ASSERT_FALSE(t.TryReserve(now, token, now + 19 * token).has_value());
+  ASSERT_EQ(now + 20 * token, t.EarliestStart(now));
+
+  // The first request used 2 out of 10 tokens. The second one keeps its start
+  // time, the credit goes to the next reservation.
+  t.Refund(r1.ticket, 8 * token);
+  ASSERT_EQ(now + 12 * token, t.EarliestStart(now));
+  std::optional<SimpleTokenBucket::Reservation> r3 =
+      t.TryReserve(now, token, now + 12 * token);
+  ASSERT_TRUE(r3.has_value());
+  ASSERT_EQ(now + 12 * token, r3->start_time);
+
+  // A refund never moves the bucket before the start of the reservation.
+  t.Refund(r3->ticket, token);
+  t.Refund(r2.ticket, 10 * token);
+  ASSERT_EQ(now + 10 * token, t.EarliestStart(now));
+}
+
+// Requests are charged 10 tokens up front and use 2. With refunds the bucket
+// admits 5 times as many of them, close to the configured rate.
+TEST(SimpleTokenBucketTest, RefundRaisesUtilization) {
+  absl::Time start_time = absl::UnixEpoch();
+  absl::Time now = start_time;
+  const absl::Duration estimate = absl::Microseconds(100);
+  const absl::Duration actual = absl::Microseconds(20);
+  mogo::SimpleTokenBucket t(now);
+  absl::Time end_time = now + absl::Seconds(1);
+  int request_count = 0;
+  while (now < end_time) {
+    SimpleTokenBucket::Reservation r = t.Reserve(now, estimate);
+    now = r.start_time;
+    ++request_count;
+    t.Refund(r.ticket, estimate - actual);
+  }
+  ASSERT_NEAR(request_count, absl::Seconds(1) / actual, 1);
+}
+
+// A large request taken in chunks delays a small request arriving in between by
+// at most one chunk.
+TEST(SimpleTokenBucketTest, PartialTokens) {
+  absl::Time now = absl::UnixEpoch();
+  const absl::Duration chunk = absl::Milliseconds(10);
+  mogo::SimpleTokenBucket t(now);
+
+  SimpleTokenBucket::Grant g =
+      t.TryGetPartialTokens(now, absl::Milliseconds(25), chunk);
+  ASSERT_EQ(chunk, g.granted);
+  ASSERT_EQ(absl::Milliseconds(15), g.remaining);
+  ASSERT_EQ(chunk, g.delay);
+
+  // Below zero, nothing is granted.
+  g = t.TryGetPartialTokens(now, g.remaining, chunk);
+  ASSERT_EQ(absl::ZeroDuration(), g.granted);
+  ASSERT_EQ(absl::Milliseconds(15), g.remaining);
+  ASSERT_EQ(chunk, g.delay);
+
+  // A small request gets in between the chunks.
+  now += chunk;
+  ASSERT_EQ(absl::ZeroDuration(), t.TryGetTokens(now, absl::Milliseconds(1)));
+  now += absl::Milliseconds(1);
+
+  g = t.TryGetPartialTokens(now, g.remaining, chunk);
+  ASSERT_EQ(chunk, g.granted);
+  now += g.delay;
+  g = t.TryGetPartialTokens(now, g.remaining, chunk);
+  ASSERT_EQ(absl::Milliseconds(5), g.granted);
+  ASSERT_EQ(absl::ZeroDuration(), g.remaining);
+  ASSERT_EQ(absl::ZeroDuration(), g.delay);
+  ASSERT_EQ(absl::Milliseconds(5), t.TryGetTokens(now, absl::Milliseconds(1)));
+}
+
 }  // namespace
 }  // namespace mogo
@@ -0,0 +1,184 @@
+#include "token_bucket/timer_wheel.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "absl/log/check.h"
+#include "absl/numeric/bits.h"
+
+namespace mogo {
+
+TimerWheel::TimerWheel(absl::Time now, absl::Duration tick)
+    : tick_ns_(absl::ToInt64Nanoseconds(tick)),
+      cur_tick_(absl::ToUnixNanos(now) / tick_ns_) {
+  CHECK_GT(tick_ns_, 0);
+  for (Level& level : levels_) {
+    level.heads.fill(kNil);
+  }
+}
+
+TimerWheel::TimerId TimerWheel::InsertTick(int64_t expiry_tick,
+                                           uint64_t payload) {
+  uint32_t index;
+  if (free_head_ != kNil) {
+    index = free_head_;
+    free_head_ = nodes_[index].next;
+  } else {
+    CHECK_LT(nodes_.size(), kNil) << "Too many pending timers";
+    index = nodes_.size();
+    nodes_.push_back({});
+  }
+  Node& n = nodes_[index];
+  n.expiry_tick = expiry_tick;
+  n.payload = payload;
+  Place(index);
+  ++size_;
+  return (static_cast<uint64_t>(n.generation) << 32) | index;
+}
+
+void TimerWheel::Place(uint32_t index) {
+  Node& n = nodes_[index];
+  const int64_t delta = n.expiry_tick - cur_tick_;
+  int level = 0;
+  int slot;
+  if (delta < 0) {
+    // Already due, goes into the slot processed next.
+    slot = cur_tick_ & kSlotMask;
+  } else {
+    // Timers that are too far in the future wait in the top level and are
+    // placed again once they are cascaded from there.
+    const int64_t tick =
+        delta < kMaxTicks ? n.expiry_tick : cur_tick_ + kMaxTicks - 1;
+    const int64_t clamped_delta = tick - cur_tick_;
+    while (clamped_delta >= (int64_t{1} << (kLevelBits * (level + 1)))) {
+      ++level;
+    }
+    slot = (tick >> (kLevelBits * level)) & kSlotMask;
+  }
+
+  Level& l = levels_[level];
+  n.slot = level * kSlotsPerLevel + slot;
+  n.prev = kNil;
+  n.next = l.heads[slot];
+  if (n.next != kNil) {
+    nodes_[n.next].prev = index;
+  }
+  l.heads[slot] = index;
+  l.occupied |= uint64_t{1} << slot;
+}
+
+void TimerWheel::Unlink(uint32_t index) {
+  Node& n = nodes_[index];
+  Level& l = levels_[n.slot / kSlotsPerLevel];
+  const int slot = n.slot % kSlotsPerLevel;
+  if (n.prev != kNil) {
+    nodes_[n.prev].next = n.next;
+  } else {
+    l.heads[slot] = n.next;
+    if (n.next == kNil) {
+      l.occupied &= ~(uint64_t{1} << slot);
+    }
+  }
+  if (n.next != kNil) {
+    nodes_[n.next].prev = n.prev;
+  }
+}
+
+void TimerWheel::Release(uint32_t index) {
+  Node& n = nodes_[index];
+  ++n.generation;
+  n.slot = kNil;
+  n.next = free_head_;
+  free_head_ = index;
+  --size_;
+}
+
+bool TimerWheel::Cancel(TimerId id) {
+  const uint32_t index = static_cast<uint32_t>(id);
+  if (index >= nodes_.size()) {
+    return false;
+  }
+  Node& n = nodes_[index];
+  if (n.generation != static_cast<uint32_t>(id >> 32) || n.slot == kNil) {
+    return false;
+  }
+  Unlink(index);
+  Release(index);
+  return true;
+}
+
+void TimerWheel::Cascade(int level) {
+  Level& l = levels_[level];
+  const int slot = (cur_tick_ >> (kLevelBits * level)) & kSlotMask;
+  uint32_t index = l.heads[slot];
+  l.heads[slot] = kNil;
+  l.occupied &= ~(uint64_t{1} << slot);
+  while (index != kNil) {
+    const uint32_t next = nodes_[index].next;
+    Place(index);
+    index = next;
+  }
+}
+
+void TimerWheel::ExpireSlot(absl::FunctionRef<void(uint64_t)> expired) {
+  Level& l = levels_[0];
+  const int slot = cur_tick_ & kSlotMask;
+  // The callback may insert new timers, including already due ones that land
+  // in this very slot.
+  while (l.heads[slot] != kNil) {
+    const uint32_t index = l.heads[slot];
+    const uint64_t payload = nodes_[index].payload;
+    Unlink(index);
+    Release(index);
+    expired(payload);
+  }
+}
+
+int64_t TimerWheel::NextEventTick() const {
+  int64_t next_tick = std::numeric_limits<int64_t>::max();
+  for (int level = 0; level < kLevels; ++level) {
+    const uint64_t occupied = levels_[level].occupied;
+    if (occupied == 0) {
+      continue;
+    }
+    // Slot `i` of a level is processed at the ticks that start a slot of that
+    // level with index `i`. Rotate the bitmap to begin at the first slot that
+    // starts at or after `cur_tick_`.
+    const int shift = kLevelBits * level;
+    const int64_t first_slot = (cur_tick_ + (int64_t{1} << shift) - 1) >> shift;
+    const int offset = absl::countr_zero(
+        absl::rotr(occupied, static_cast<int>(first_slot & kSlotMask)));
+    next_tick = std::min(next_tick, (first_slot + offset) << shift);
+  }
+  return next_tick;
+}
+
+void TimerWheel::Advance(absl::Time now,
+                         absl::FunctionRef<void(uint64_t)> expired) {
+  const int64_t target_tick = absl::ToUnixNanos(now) / tick_ns_;
+  while (true) {
+    // Processing an empty slot does nothing, jump straight to the next tick
+    // that expires or cascades timers.
+    const int64_t next_tick = NextEventTick();
+    if (next_tick > target_tick) {
+      cur_tick_ = std::max(cur_tick_, target_tick + 1);
+      return;
+    }
+    cur_tick_ = next_tick;
+    if ((cur_tick_ & kSlotMask) == 0) {
+      // Level 0 wrapped around, bring down the timers of the next 64 ticks.
+      // Keep going up while the upper levels wrap around as well.
+      for (int level = 1; level < kLevels; ++level) {
+        Cascade(level);
+        if (((cur_tick_ >> (kLevelBits * level)) & kSlotMask) != 0) {
+          break;
+        }
+      }
+    }
+    ExpireSlot(expired);
+    ++cur_tick_;
+  }
+}
+
+}  // namespace mogo
@@ -0,0 +1,119 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_TIMER_WHEEL_H
+#define MOGO_EXP_TOKEN_BUCKET_TIMER_WHEEL_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/time/time.h"
+
+namespace mogo {
+
+/*
+TimerWheel schedules requests delayed by a token bucket until the delay
+expires.
+
+A hashed hierarchical timing wheel, the same scheme the classic Linux kernel
+timers use. Time is divided into ticks, by default 1us. Level 0 has one slot per
+tick for the next 64 ticks, every next level has 64 slots that each cover 64
+slots of the previous level. With 6 levels timers up to 64^6 ticks (~19 hours at
+1us) away are placed directly, longer ones are re-placed when they get closer.
+When the lower levels wrap around, the due slot of the level above is cascaded
+down.
+
+Insert and Cancel are O(1). Advance expires the due timers in batches of one
+slot and jumps over empty slots using the per-level occupancy bitmaps, so moving
+time forward costs O(non-empty slots passed) regardless of the elapsed time.
+
+Timers live in a pool owned by the wheel, inserting doesn't allocate once the
+pool has grown to the peak number of pending timers.
+
+Not thread-safe. This class is thread-compatible.
+*/
+class TimerWheel {
+ public:
+  // Identifies a pending timer, stays unique after the timer fires or is
+  // cancelled.
+  using TimerId = uint64_t;
+
+  explicit TimerWheel(absl::Time now,
+                      absl::Duration tick = absl::Microseconds(1));
+
+  // Schedules `payload` to be passed to the Advance callback once `expiry` is
+  // reached. Timers in the past expire on the next Advance.
+  TimerId Insert(absl::Time expiry, uint64_t payload) {
+    return InsertTick(ToTick(expiry), payload);
+  }
+
+  // Cancels a pending timer. Returns false if the timer already fired or was
+  // cancelled.
+  bool Cancel(TimerId id);
+
+  // Moves the time forward to `now` and invokes `expired` for the payload of
+  // every timer that is due, in expiry order up to the tick resolution.
+  void Advance(absl::Time now, absl::FunctionRef<void(uint64_t)> expired);
+
+  // The number of pending timers.
+  int64_t size() const { return size_; }
+
+ private:
+  static constexpr int kLevelBits = 6;
+  static constexpr int kSlotsPerLevel = 1 << kLevelBits;
+  static constexpr int kSlotMask = kSlotsPerLevel - 1;
+  static constexpr int kLevels = 6;
+  static constexpr int64_t kMaxTicks = int64_t{1} << (kLevelBits * kLevels);
+  static constexpr uint32_t kNil = ~uint32_t{0};
+
+  struct Node {
+    int64_t expiry_tick;
+    uint64_t payload;
+    uint32_t prev;
+    uint32_t next;
+    // Incremented every time the node is released, invalidates old TimerIds.
+    uint32_t generation;
+    // level * kSlotsPerLevel + slot, or kNil while the node is free.
+    uint32_t slot;
+  };
+
+  struct Level {
+    std::array<uint32_t, kSlotsPerLevel> heads;
+    // Bit `i` is set when slot `i` is not empty.
+    uint64_t occupied = 0;
+  };
+
+  int64_t ToTick(absl::Time t) const {
+    // Round up, timers never fire early.
+    return (absl::ToUnixNanos(t) + tick_ns_ - 1) / tick_ns_;
+  }
+
+  TimerId InsertTick(int64_t expiry_tick, uint64_t payload);
+
+  // Puts an allocated node into the slot matching its expiry.
+  void Place(uint32_t index);
+  void Unlink(uint32_t index);
+  void Release(uint32_t index);
+
+  // Moves all timers of the `level` slot that is due at `cur_tick_` to the
+  // lower levels.
+  void Cascade(int level);
+
+  // Returns the first tick at or after `cur_tick_` that processes a non-empty
+  // slot on any level.
+  int64_t NextEventTick() const;
+
+  // Expires all timers in the level 0 slot of `cur_tick_`.
+  void ExpireSlot(absl::FunctionRef<void(uint64_t)> expired);
+
+  const int64_t tick_ns_;
+  // The next tick to be processed, everything before has expired.
+  int64_t cur_tick_;
+  int64_t size_ = 0;
+  std::array<Level, kLevels> levels_;
+  std::vector<Node> nodes_;
+  uint32_t free_head_ = kNil;
+};
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_TIMER_WHEEL_H
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "token_bucket/timer_wheel.h"
+
+/*
+sudo cpufreq-set -g performance
+
+bazel test -c opt --dynamic_mode=off --test_output=streamed \
+  --cache_test_results=no token_bucket:timer_wheel_benchmarks \
+  --test_arg=--benchmark_filter=all \
+  --test_arg=--benchmark_repetitions=1 \
+  --test_arg=--benchmark_enable_random_interleaving=false
+
+sudo cpufreq-set -g powersave
+
+The "hold" model: the argument is the number of pending timers. Every time a
+timer fires a new one is inserted with a random delay, so the number of pending
+timers stays constant. Delays are log-uniform between 1us and 1s, the range of
+delays token buckets hand out. Time moves forward so that on average
+kExpiredPerStep timers fire per iteration. `items_per_second` is fired and
+re-inserted timers per second.
+*/
+
+namespace mogo {
+namespace {
+
+constexpr int kDelayCount = 1 << 20;
+constexpr int64_t kExpiredPerStep = 64;
+constexpr int64_t kMinDelayNs = 1000;
+constexpr int64_t kMaxDelayNs = 1000000000;
+
+std::vector<int64_t> MakeDelays() {
+  absl::InsecureBitGen gen;
+  std::vector<int64_t> delays;
+  delays.reserve(kDelayCount);
+  for (int i = 0; i < kDelayCount; ++i) {
+    delays.push_back(static_cast<int64_t>(std::exp(absl::Uniform(
+        gen, std::log(double{kMinDelayNs}), std::log(double{kMaxDelayNs})))));
+  }
+  return delays;
+}
+
+// Time step that fires kExpiredPerStep out of `pending` timers on average.
+int64_t StepNs(int64_t pending) {
+  const double mean_delay_ns =
+      (kMaxDelayNs - kMinDelayNs) / std::log(double{kMaxDelayNs / kMinDelayNs});
+  return std::max<int64_t>(1, mean_delay_ns * kExpiredPerStep / pending);
+}
+
+void BM_TimerWheel(benchmark::State& state) {
+  const std::vector<int64_t> delays = MakeDelays();
+  const int64_t pending = state.range(0);
+  const int64_t step_ns = StepNs(pending);
+  int64_t now_ns = 1000000000;
+  TimerWheel w(absl::FromUnixNanos(now_ns));
+  int64_t d = 0;
+  for (int64_t i = 0; i < pending; ++i) {
+    w.Insert(absl::FromUnixNanos(now_ns + delays[d++ % kDelayCount]), i);
+  }
+  int64_t fired = 0;
+  for (auto s : state) {
+    now_ns += step_ns;
+    w.Advance(absl::FromUnixNanos(now_ns), [&](uint64_t payload) {
+      w.Insert(absl::FromUnixNanos(now_ns + delays[d++ % kDelayCount]),
+               payload);
+      ++fired;
+    });
+  }
+  state.SetItemsProcessed(fired);
+}
+BENCHMARK(BM_TimerWheel)->Arg(10000)->Arg(1000000)->Arg(10000000);
+
+void BM_PriorityQueue(benchmark::State& state) {
+  using Timer = std::pair<int64_t, uint64_t>;
+  const std::vector<int64_t> delays = MakeDelays();
+  const int64_t pending = state.range(0);
+  const int64_t step_ns = StepNs(pending);
+  int64_t now_ns = 1000000000;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> q;
+  int64_t d = 0;
+  for (int64_t i = 0; i < pending; ++i) {
+    q.push({now_ns + delays[d++ % kDelayCount], i});
+  }
+  int64_t fired = 0;
+  for (auto s : state) {
+    now_ns += step_ns;
+    while (q.top().first <= now_ns) {
+      const uint64_t payload = q.top().second;
+      q.pop();
+      q.push({now_ns + delays[d++ % kDelayCount], payload});
+      ++fired;
+    }
+  }
+  state.SetItemsProcessed(fired);
+}
+BENCHMARK(BM_PriorityQueue)->Arg(10000)->Arg(1000000)->Arg(10000000);
+
+// Insert immediately followed by Cancel, the pattern of a request that gets its
+// tokens before the timer fires. A heap has no cheap equivalent.
+void BM_TimerWheelInsertCancel(benchmark::State& state) {
+  const std::vector<int64_t> delays = MakeDelays();
+  const int64_t pending = state.range(0);
+  int64_t now_ns = 1000000000;
+  TimerWheel w(absl::FromUnixNanos(now_ns));
+  int64_t d = 0;
+  for (int64_t i = 0; i < pending; ++i) {
+    w.Insert(absl::FromUnixNanos(now_ns + delays[d++ % kDelayCount]), i);
+  }
+  for (auto s : state) {
+    TimerWheel::TimerId id =
+        w.Insert(absl::FromUnixNanos(now_ns + delays[d++ % kDelayCount]), 0);
+    benchmark::DoNotOptimize(w.Cancel(id));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TimerWheelInsertCancel)->Arg(10000)->Arg(1000000)->Arg(10000000);
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,121 @@
+/*
+bazel test token_bucket:timer_wheel_test
+*/
+
+#include "token_bucket/timer_wheel.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/log/log.h"
+#include "absl/random/random.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace mogo {
+namespace {
+
+TEST(TimerWheelTest, Basic) {
+  absl::Time now = absl::UnixEpoch();
+  TimerWheel w(now);
+  std::vector<uint64_t> fired;
+  auto collect = [&](uint64_t payload) { fired.push_back(payload); };
+
+  w.Insert(now + absl::Microseconds(10), 1);
+  w.Insert(now + absl::Milliseconds(10), 2);
+  TimerWheel::TimerId id3 = w.Insert(now + absl::Seconds(10), 3);
+  w.Insert(now - absl::Seconds(1), 4);
+  ASSERT_EQ(4, w.size());
+
+  w.Advance(now, collect);
+  ASSERT_EQ(std::vector<uint64_t>({4}), fired);
+
+  w.Advance(now + absl::Microseconds(9), collect);
+  ASSERT_EQ(std::vector<uint64_t>({4}), fired);
+  w.Advance(now + absl::Microseconds(10), collect);
+  ASSERT_EQ(std::vector<uint64_t>({4, 1}), fired);
+
+  w.Advance(now + absl::Seconds(1), collect);
+  ASSERT_EQ(std::vector<uint64_t>({4, 1, 2}), fired);
+
+  ASSERT_TRUE(w.Cancel(id3));
+  ASSERT_FALSE(w.Cancel(id3));
+  w.Advance(now + absl::Seconds(20), collect);
+  ASSERT_EQ(std::vector<uint64_t>({4, 1, 2}), fired);
+  ASSERT_EQ(0, w.size());
+}
+
+TEST(TimerWheelTest, StaleIdCantCancelReusedNode) {
+  absl::Time now = absl::UnixEpoch();
+  TimerWheel w(now);
+  TimerWheel::TimerId id1 = w.Insert(now + absl::Microseconds(1), 1);
+  w.Advance(now + absl::Microseconds(1), [](uint64_t) {});
+  // The node of the first timer is reused.
+  TimerWheel::TimerId id2 = w.Insert(now + absl::Microseconds(5), 2);
+  ASSERT_NE(id1, id2);
+  ASSERT_FALSE(w.Cancel(id1));
+  ASSERT_EQ(1, w.size());
+  ASSERT_TRUE(w.Cancel(id2));
+}
+
+TEST(TimerWheelTest, VeryLongTimers) {
+  absl::Time now = absl::UnixEpoch();
+  TimerWheel w(now);
+  w.Insert(now + absl::Hours(24 * 30), 1);
+  int fired = 0;
+  w.Advance(now + absl::Hours(24 * 30) - absl::Microseconds(1),
+            [&](uint64_t) { ++fired; });
+  ASSERT_EQ(0, fired);
+  w.Advance(now + absl::Hours(24 * 30), [&](uint64_t) { ++fired; });
+  ASSERT_EQ(1, fired);
+}
+
+// Timers with the delays produced by token buckets, from microseconds to
+// seconds, inserted and cancelled at random while time moves forward in random
+// steps. Every timer has to fire exactly once, never early and never later than
+// the Advance call that passed its expiry.
+TEST(TimerWheelTest, Randomized) {
+  absl::BitGen gen;
+  absl::Time now = absl::UnixEpoch() + absl::Hours(1);
+  TimerWheel w(now);
+  absl::flat_hash_map<uint64_t, absl::Time> pending;
+  absl::flat_hash_map<uint64_t, TimerWheel::TimerId> ids;
+  uint64_t next_payload = 0;
+  absl::Time prev_now = now;
+  int64_t fired = 0;
+  auto check = [&](uint64_t payload) {
+    auto it = pending.find(payload);
+    ASSERT_TRUE(it != pending.end()) << payload;
+    ASSERT_LE(it->second, now);
+    ASSERT_GT(it->second, prev_now - absl::Microseconds(1));
+    pending.erase(it);
+    ++fired;
+  };
+
+  for (int step = 0; step < 20000; ++step) {
+    for (int i = 0; i < 10; ++i) {
+      absl::Duration delay = absl::Nanoseconds(
+          std::exp(absl::Uniform(gen, 0.0, std::log(1e10))));
+      absl::Time expiry = now + delay;
+      uint64_t payload = next_payload++;
+      pending[payload] = expiry;
+      ids[payload] = w.Insert(expiry, payload);
+    }
+    if (absl::Bernoulli(gen, 0.3) && !pending.empty()) {
+      uint64_t payload = pending.begin()->first;
+      ASSERT_TRUE(w.Cancel(ids[payload]));
+      pending.erase(payload);
+    }
+    prev_now = now;
+    now += absl::Nanoseconds(absl::Uniform(gen, 0, 1000000));
+    w.Advance(now, check);
+    ASSERT_EQ(pending.size(), w.size());
+  }
+  LOG(INFO) << "Fired: " << fired << " pending: " << pending.size();
+  ASSERT_GT(fired, 0);
+}
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,312 @@
+#include <array>
+#include <cstdint>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/log/log.h"
+#include "absl/numeric/bits.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "perf/cycle_clock_utils.h"
+#include "token_bucket/burst_token_bucket.h"
+#include "token_bucket/multi_token_bucket.h"
+#include "token_bucket/rate_token_bucket.h"
+#include "token_bucket/simple_token_bucket.h"
+
+/*
+sudo cpufreq-set -g performance
+
+bazel build -c opt --dynamic_mode=off token_bucket:token_bucket_benchmarks \
+&& taskset -c 0-15 bazel-bin/token_bucket/token_bucket_benchmarks \
+  --benchmark_filter=all \
+  --benchmark_repetitions=1 \
+  --benchmark_enable_random_interleaving=false
+
+sudo cpufreq-set -g powersave
+
+Every benchmark runs the workloads from kWorkloads, selected by the argument
+and printed as the label:
+  admit  - the clock moves faster than the tokens are spent, every call admits.
+  reject - the bucket is deep in debt, nearly every call returns a delay.
+  split  - the clock moves as fast as the tokens are spent. The bucket hovers
+           around zero and MultiTokenBucket keeps all of its lanes busy.
+
+The single-threaded benchmarks move a synthetic clock by the workload step
+after every call, so they measure the admission path only. The contended
+benchmarks share one bucket behind an absl::Mutex and read absl::Now(), the
+way a server without a concurrent bucket would.
+
+`Time` is the mean per call. `p99_ns` is the 99th percentile of the duration of
+a single call, measured with the cycle clock on every 16th call so the
+measurement doesn't inflate the mean much. The contended benchmarks merge the
+samples of all the threads and report one percentile of the run, not an
+average of per-thread percentiles. `admits` is the fraction of admitted calls.
+*/
+
+namespace mogo {
+namespace {
+
+struct Workload {
+  const char* name;
+  // Synthetic clock advance between calls, single-threaded benchmarks only.
+  absl::Duration step;
+  absl::Duration cost;
+};
+
+constexpr Workload kWorkloads[] = {
+    {"admit", absl::Nanoseconds(200), absl::Nanoseconds(100)},
+    {"reject", absl::Nanoseconds(10), absl::Milliseconds(1)},
+    {"split", absl::Nanoseconds(100), absl::Nanoseconds(100)},
+};
+
+constexpr absl::Duration kBurst = absl::Microseconds(10);
+
+// Makes every bucket type callable with a cost in absl::Duration.
+template <typename TokenBucket>
+struct BucketTraits;
+
+template <>
+struct BucketTraits<SimpleTokenBucket> {
+  using Cost = absl::Duration;
+  static SimpleTokenBucket Make(absl::Time now) {
+    return SimpleTokenBucket(now);
+  }
+  static Cost ToCost(absl::Duration d) { return d; }
+};
+
+template <>
+struct BucketTraits<RateTokenBucket> {
+  // One token per nanosecond.
+  using Cost = double;
+  static RateTokenBucket Make(absl::Time now) {
+    return RateTokenBucket(now, /*refill_rate=*/1e9);
+  }
+  static Cost ToCost(absl::Duration d) { return absl::ToDoubleNanoseconds(d); }
+};
+
+template <>
+struct BucketTraits<BurstTokenBucket> {
+  using Cost = absl::Duration;
+  static BurstTokenBucket Make(absl::Time now) {
+    return BurstTokenBucket(now, kBurst);
+  }
+  static Cost ToCost(absl::Duration d) { return d; }
+};
+
+template <>
+struct BucketTraits<MultiTokenBucket> {
+  using Cost = absl::Duration;
+  static MultiTokenBucket Make(absl::Time now) {
+    return MultiTokenBucket(now);
+  }
+  static Cost ToCost(absl::Duration d) { return d; }
+};
+
+// Collects per-call durations in cycles, sampling every kSampleEvery-th call.
+// The buckets are log-linear: exact below kSubBuckets cycles, then kSubBuckets
+// buckets per power of two, so a percentile is within 1/kSubBuckets of the
+// sampled value however slow the call was.
+class LatencySampler {
+ public:
+  static constexpr int kSampleEvery = 16;
+
+  bool ShouldSample() { return (++calls_ % kSampleEvery) == 0; }
+
+  void Add(int64_t cycles) {
+    ++counts_[Bucket(cycles < 0 ? 0 : cycles)];
+    ++total_;
+  }
+
+  void Merge(const LatencySampler& other) {
+    for (int i = 0; i < kBuckets; ++i) {
+      counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+  }
+
+  double PercentileNs(double p) const {
+    const int64_t rank = static_cast<int64_t>(total_ * p);
+    int64_t running = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+      running += counts_[i];
+      if (running > rank) {
+        return CyclesToSeconds(BucketMid(i)) * 1e9;
+      }
+    }
+    return 0;
+  }
+
+ private:
+  static constexpr int kSubBits = 4;
+  static constexpr int kSubBuckets = 1 << kSubBits;
+  static constexpr int kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+  // Values in [2^(e-1), 2^e) go to the row e - kSubBits, the column is given by
+  // the kSubBits bits below the leading one.
+  static int Bucket(int64_t cycles) {
+    if (cycles < kSubBuckets) return cycles;
+    const int e = absl::bit_width(static_cast<uint64_t>(cycles));
+    const int shift = e - kSubBits - 1;
+    return (e - kSubBits) * kSubBuckets + (cycles >> shift) - kSubBuckets;
+  }
+
+  static int64_t BucketMid(int bucket) {
+    if (bucket < kSubBuckets) return bucket;
+    const int shift = bucket / kSubBuckets - 1;
+    const int64_t low = static_cast<int64_t>(kSubBuckets + bucket % kSubBuckets)
+                        << shift;
+    return low + (int64_t{1} << shift) / 2;
+  }
+
+  int64_t calls_ = 0;
+  int64_t total_ = 0;
+  std::array<int64_t, kBuckets> counts_ = {};
+};
+
+template <typename TokenBucket, typename Cost, typename Now>
+int64_t RunLoop(benchmark::State& state, TokenBucket& tb, Cost cost, Now now,
+                LatencySampler& sampler) {
+  int64_t admits = 0;
+  for (auto s : state) {
+    const absl::Time t = now();
+    if (sampler.ShouldSample()) {
+      const int64_t start = CycleClock::Now();
+      const absl::Duration d = tb.TryGetTokens(t, cost);
+      sampler.Add(CycleClock::Now() - start);
+      admits += d == absl::ZeroDuration();
+    } else {
+      admits += tb.TryGetTokens(t, cost) == absl::ZeroDuration();
+    }
+  }
+  return admits;
+}
+
+// The framework sums the counters of all threads, `admits` over the total
+// number of iterations is the fraction of admitted calls of the run.
+void ReportAdmits(benchmark::State& state, int64_t admits) {
+  state.counters["admits"] =
+      benchmark::Counter(admits, benchmark::Counter::kAvgIterations);
+}
+
+// The samples of all the threads of a run, the percentile is computed once
+// every thread merged its own.
+class SharedLatency {
+ public:
+  // Thread 0 calls it before the timing loop, the other threads can't merge
+  // before the loop ends.
+  void Reset(int threads) {
+    absl::MutexLock lock(&mu_);
+    merged_ = LatencySampler();
+    pending_ = threads;
+  }
+
+  void Merge(const LatencySampler& sampler) {
+    absl::MutexLock lock(&mu_);
+    merged_.Merge(sampler);
+    --pending_;
+  }
+
+  // Waits for all the threads to merge.
+  double PercentileNs(double p) {
+    absl::MutexLock lock(&mu_);
+    mu_.Await(absl::Condition(this, &SharedLatency::AllMerged));
+    return merged_.PercentileNs(p);
+  }
+
+ private:
+  bool AllMerged() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return pending_ == 0;
+  }
+
+  absl::Mutex mu_;
+  LatencySampler merged_ ABSL_GUARDED_BY(mu_);
+  int pending_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+template <typename TokenBucket>
+void BM_Admit(benchmark::State& state) {
+  using Traits = BucketTraits<TokenBucket>;
+  const Workload& w = kWorkloads[state.range(0)];
+  state.SetLabel(w.name);
+  absl::Time now = absl::UnixEpoch() + absl::Hours(1);
+  TokenBucket tb = Traits::Make(now);
+  const typename Traits::Cost cost = Traits::ToCost(w.cost);
+  LatencySampler sampler;
+  const int64_t admits = RunLoop(
+      state, tb, cost,
+      [&now, step = w.step]() {
+        now += step;
+        return now;
+      },
+      sampler);
+  ReportAdmits(state, admits);
+  state.counters["p99_ns"] = sampler.PercentileNs(0.99);
+  VLOG(2) << tb;
+}
+BENCHMARK(BM_Admit<SimpleTokenBucket>)->DenseRange(0, 2);
+BENCHMARK(BM_Admit<RateTokenBucket>)->DenseRange(0, 2);
+BENCHMARK(BM_Admit<BurstTokenBucket>)->DenseRange(0, 2);
+BENCHMARK(BM_Admit<MultiTokenBucket>)->DenseRange(0, 2);
+
+template <typename TokenBucket>
+class MutexTokenBucket {
+ public:
+  explicit MutexTokenBucket(absl::Time now)
+      : tb_(BucketTraits<TokenBucket>::Make(now)) {}
+
+  template <typename Cost>
+  absl::Duration TryGetTokens(absl::Time now, Cost cost) {
+    absl::MutexLock lock(&mu_);
+    return tb_.TryGetTokens(now, cost);
+  }
+
+ private:
+  absl::Mutex mu_;
+  TokenBucket tb_ ABSL_GUARDED_BY(mu_);
+};
+
+template <typename TokenBucket>
+void BM_ContendedAdmit(benchmark::State& state) {
+  using Traits = BucketTraits<TokenBucket>;
+  // Shared between all benchmark threads, the instance from the previous run
+  // is destroyed before the timing loop of the next run starts.
+  static MutexTokenBucket<TokenBucket>* tb = nullptr;
+  static SharedLatency latency;
+  if (state.thread_index() == 0) {
+    delete tb;
+    tb = new MutexTokenBucket<TokenBucket>(absl::Now());
+    latency.Reset(state.threads());
+  }
+  const Workload& w = kWorkloads[state.range(0)];
+  state.SetLabel(w.name);
+  const typename Traits::Cost cost = Traits::ToCost(w.cost);
+  LatencySampler sampler;
+  const int64_t admits = RunLoop(
+      state, *tb, cost, []() { return absl::Now(); }, sampler);
+  ReportAdmits(state, admits);
+  latency.Merge(sampler);
+  // Only thread 0 reports the percentile, the framework sums the counter.
+  if (state.thread_index() == 0) {
+    state.counters["p99_ns"] = latency.PercentileNs(0.99);
+  }
+}
+BENCHMARK(BM_ContendedAdmit<SimpleTokenBucket>)
+    ->ArgsProduct({{0, 1, 2}})
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK(BM_ContendedAdmit<RateTokenBucket>)
+    ->ArgsProduct({{0, 1, 2}})
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK(BM_ContendedAdmit<BurstTokenBucket>)
+    ->ArgsProduct({{0, 1, 2}})
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK(BM_ContendedAdmit<MultiTokenBucket>)
+    ->ArgsProduct({{0, 1, 2}})
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace mogo
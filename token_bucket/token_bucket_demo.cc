@@ -6,9 +6,17 @@ bazel run token_bucket:token_bucket_demo -- --stderrthreshold=0
 bazel run token_bucket:token_bucket_demo -- --stderrthreshold=0 --tb_type=burst
 
 bazel run token_bucket:token_bucket_demo -- --stderrthreshold=0 --tb_type=multi
+
+# Compare the head-of-line blocking of a large transfer taken at once, smeared
+# by MultiTokenBucket and taken in chunks:
+bazel run token_bucket:token_bucket_demo -- --stderrthreshold=0 --tb_type=hol
 */
 
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -21,65 +29,63 @@ bazel run token_bucket:token_bucket_demo -- --stderrthreshold=0 --tb_type=multi
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
 #include "absl/time/time.h"
-#include "stat/approx_counter.h"
+#include "perf/bits.h"
 #include "token_bucket/burst_token_bucket.h"
 #include "token_bucket/rate_token_bucket.h"
+#include "token_bucket/clock_domain.h"
 #include "token_bucket/simple_token_bucket.h"
 #include "token_bucket/multi_token_bucket.h"
+#include "token_bucket/token_bucket_metrics.h"
 
 ABSL_FLAG(
     std::string, tb_type, "simple",
-    "Type of rate-limiter to use, valid values are `simple`, `rate`, `burst`");
+    "Type of rate-limiter to use, valid values are `simple`, `rate`, `burst`, "
+    "`multi`, `hol`");
 
 namespace mogo {
 
 struct TokenBucketInstanceInterface {
   virtual ~TokenBucketInstanceInterface() = default;
   virtual absl::Duration TryGetTokens(absl::Time now) = 0;
+  virtual const TokenBucketMetrics& metrics() const = 0;
 };
 
 struct FunctionTokenBucketInstance : public TokenBucketInstanceInterface {
-  FunctionTokenBucketInstance(std::function<absl::Duration(absl::Time now)> f)
-      : f_(f) {}
+  FunctionTokenBucketInstance(std::function<absl::Duration(absl::Time now)> f,
+                              const TokenBucketMetrics& metrics)
+      : f_(f), metrics_(metrics) {}
 
   absl::Duration TryGetTokens(absl::Time now) override { return f_(now); };
+  const TokenBucketMetrics& metrics() const override { return metrics_; }
 
   std::function<absl::Duration(absl::Time now)> f_;
+  const TokenBucketMetrics& metrics_;
 };
 
 absl::Status RunDemo(absl::Time now, TokenBucketInstanceInterface& tb) {
+  const TokenBucketMetrics& m = tb.metrics();
   // Run at max speed for 5s twice.
   for (int i = 0; i < 2; ++i) {
     const absl::Time start_time = now;
-
-    ApproxCounter req_cnt(now);
+    const int64_t start_admitted = m.admitted();
 
     absl::Time end_time = now + absl::Seconds(5);
     absl::Time next_log_time = now + absl::Seconds(1);
-    int request_count = 0;
-    int prev_log_request_count = request_count;
     while (now < end_time) {
       absl::Duration d = tb.TryGetTokens(now);
-      if (d == absl::ZeroDuration()) {
-        request_count++;
-        req_cnt.RecordRequest(1, now);
-      } else {
+      if (d != absl::ZeroDuration()) {
         // Sleep until we can schedule the next request.
         now += d;
       }
       if (now >= next_log_time) {
-        double log_delta_seconds =
-            absl::ToDoubleSeconds(now - next_log_time + absl::Seconds(1));
-        int log_delta_requests = request_count - prev_log_request_count;
-        LOG(INFO) << "Request rate: " << log_delta_requests / log_delta_seconds
-                  << " r/s, approx_rate: " << req_cnt.GetBytesPerSecond(now)
-                  << " r/s, request_count: " << log_delta_requests
-                  << ", seconds: " << log_delta_seconds;
+        LOG(INFO) << "Request rate: " << m.admit_rate(now)
+                  << " r/s, delay rate: " << m.delay_rate(now) << " r/s";
         next_log_time += absl::Seconds(1);
-        prev_log_request_count = request_count;
       }
     }
+    const int64_t request_count = m.admitted() - start_admitted;
     double total_seconds = absl::ToDoubleSeconds(now - start_time);
     LOG(INFO) << "Total rate: " << request_count / total_seconds
               << " r/s, request_count: " << request_count
@@ -102,16 +108,17 @@ absl::Status RunDemo(absl::Time now, TokenBucketInstanceInterface& tb) {
     }
   }
 
+  LOG(INFO) << "Metrics:\n" << m.ToString(now);
   return absl::OkStatus();
 }
 
 absl::Status RunSimpleDemo() {
   absl::Time now = absl::Now();
-  mogo::SimpleTokenBucket t(now);
+  mogo::BasicSimpleTokenBucket<AbslTimeDomain, TokenBucketMetrics> t(now);
   absl::Duration request_cost = absl::Microseconds(100);  // 10k requests/sec
-  FunctionTokenBucketInstance tb([&](absl::Time now) -> absl::Duration {
-    return t.TryGetTokens(now, request_cost);
-  });
+  FunctionTokenBucketInstance tb(
+      [&](absl::Time now) { return t.TryGetTokens(now, request_cost); },
+      t.metrics());
   return RunDemo(now, tb);
 }
 
@@ -119,10 +126,11 @@ absl::Status RunRateDemo() {
   double refill_rate = 10000;
   LOG(INFO) << "Running RateTokenBucket with refill_rate: " << refill_rate;
   absl::Time now = absl::Now();
-  mogo::RateTokenBucket t(now, /*refill_rate=*/refill_rate);
-  FunctionTokenBucketInstance tb([&](absl::Time now) -> absl::Duration {
-    return t.TryGetTokens(now, /*token_count=*/1);
-  });
+  mogo::BasicRateTokenBucket<AbslTimeDomain, TokenBucketMetrics> t(
+      now, /*refill_rate=*/refill_rate);
+  FunctionTokenBucketInstance tb(
+      [&](absl::Time now) { return t.TryGetTokens(now, /*token_count=*/1); },
+      t.metrics());
   return RunDemo(now, tb);
 }
 
@@ -133,24 +141,139 @@ absl::Status RunBurstDemo() {
   LOG(INFO) << "Running BurstTokenBucket with rate: " << rate
             << ", burst_duration: " << burst_duration;
   absl::Time now = absl::Now();
-  mogo::BurstTokenBucket t(now, /*burst_tokens=*/burst_duration);
-  FunctionTokenBucketInstance tb([&](absl::Time now) -> absl::Duration {
-    return t.TryGetTokens(now, op_cost);
-  });
+  mogo::BasicBurstTokenBucket<AbslTimeDomain, TokenBucketMetrics> t(
+      now, /*burst_tokens=*/burst_duration);
+  FunctionTokenBucketInstance tb(
+      [&](absl::Time now) { return t.TryGetTokens(now, op_cost); },
+      t.metrics());
   return RunDemo(now, tb);
 }
 
 absl::Status RunMultiDemo() {
   absl::Time now = absl::Now();
   mogo::MultiTokenBucket t(now);
+  // MultiTokenBucket has no Metrics policy, record the calls here.
+  TokenBucketMetrics metrics(now);
 
   absl::Duration request_cost = absl::Microseconds(100);  // 10k requests/sec
-  FunctionTokenBucketInstance tb([&](absl::Time now) -> absl::Duration {
-    return t.TryGetTokens(now, request_cost);
-  });
+  FunctionTokenBucketInstance tb(
+      [&](absl::Time now) {
+        absl::Duration d = t.TryGetTokens(now, request_cost);
+        if (d == absl::ZeroDuration()) {
+          metrics.RecordAdmit(now, request_cost);
+        } else {
+          metrics.RecordDelay(now, d);
+        }
+        return d;
+      },
+      metrics);
   return RunDemo(now, tb);
 }
 
+// Tokens are bytes at 10ns per byte, 100 MB/s. A stream of 4 KB requests every
+// 100us uses 40% of the rate, a 64 MB transfer arrives after 1s. Reports the
+// delays of the small requests and when the last byte of the transfer is
+// admitted.
+constexpr absl::Duration kHolCostPerByte = absl::Nanoseconds(10);
+constexpr int64_t kHolSmallBytes = 4 << 10;
+constexpr absl::Duration kHolSmallInterval = absl::Microseconds(100);
+constexpr int64_t kHolLargeBytes = 64 << 20;
+constexpr absl::Duration kHolLargeArrival = absl::Seconds(1);
+constexpr absl::Duration kHolDuration = absl::Seconds(3);
+
+// `try_large(now, remaining)` acquires some or all of the remaining tokens of
+// the large transfer.
+void RunHeadOfLine(
+    absl::string_view name, absl::Time start,
+    std::function<absl::Duration(absl::Time, absl::Duration)> try_small,
+    std::function<TokenGrant<AbslTimeDomain>(absl::Time, absl::Duration)>
+        try_large) {
+  Histogram64 small_delay_ns(/*min=*/1000, /*shift=*/10);
+  absl::Duration max_small_delay;
+  const absl::Duration small_cost = kHolSmallBytes * kHolCostPerByte;
+  int64_t small_index = 0;
+  absl::Time small_arrival = start;
+  absl::Time small_next = start;
+  absl::Duration large_remaining = kHolLargeBytes * kHolCostPerByte;
+  absl::Time large_next = start + kHolLargeArrival;
+  absl::Time large_done = absl::InfiniteFuture();
+  const absl::Time end = start + kHolDuration;
+  while (small_arrival < end || large_remaining > absl::ZeroDuration()) {
+    const bool small_turn =
+        small_arrival < end &&
+        (large_remaining == absl::ZeroDuration() || small_next <= large_next);
+    if (small_turn) {
+      absl::Duration d = try_small(small_next, small_cost);
+      if (d != absl::ZeroDuration()) {
+        small_next += d;
+        continue;
+      }
+      const absl::Duration delay = small_next - small_arrival;
+      small_delay_ns.Add(absl::ToInt64Nanoseconds(delay));
+      max_small_delay = std::max(max_small_delay, delay);
+      ++small_index;
+      small_arrival = start + small_index * kHolSmallInterval;
+      small_next = std::max(small_arrival, small_next);
+    } else {
+      TokenGrant<AbslTimeDomain> g = try_large(large_next, large_remaining);
+      large_remaining = g.remaining;
+      if (large_remaining == absl::ZeroDuration()) {
+        large_done = large_next;
+      }
+      large_next += g.delay;
+    }
+  }
+  std::ostringstream s;
+  PrintDelayHistogram(small_delay_ns, s);
+  LOG(INFO) << name << ": large transfer admitted after "
+            << absl::FormatDuration(large_done - start - kHolLargeArrival)
+            << ", max small request delay "
+            << absl::FormatDuration(max_small_delay)
+            << ", small request delays:\n"
+            << s.str();
+}
+
+absl::Status RunHeadOfLineDemo() {
+  absl::Time now = absl::Now();
+  {
+    SimpleTokenBucket t(now);
+    RunHeadOfLine(
+        "SimpleTokenBucket", now,
+        [&](absl::Time now, absl::Duration d) { return t.TryGetTokens(now, d); },
+        [&](absl::Time now, absl::Duration d) -> TokenGrant<AbslTimeDomain> {
+          absl::Duration delay = t.TryGetTokens(now, d);
+          if (delay == absl::ZeroDuration()) {
+            return {d, absl::ZeroDuration(), absl::ZeroDuration()};
+          }
+          return {absl::ZeroDuration(), d, delay};
+        });
+  }
+  {
+    MultiTokenBucket t(now);
+    RunHeadOfLine(
+        "MultiTokenBucket", now,
+        [&](absl::Time now, absl::Duration d) { return t.TryGetTokens(now, d); },
+        [&](absl::Time now, absl::Duration d) -> TokenGrant<AbslTimeDomain> {
+          absl::Duration delay = t.TryGetTokens(now, d);
+          if (delay == absl::ZeroDuration()) {
+            return {d, absl::ZeroDuration(), absl::ZeroDuration()};
+          }
+          return {absl::ZeroDuration(), d, delay};
+        });
+  }
+  for (int64_t chunk_bytes : {1 << 20, 64 << 10}) {
+    SimpleTokenBucket t(now);
+    RunHeadOfLine(
+        absl::StrCat("SimpleTokenBucket in ", chunk_bytes >> 10, " KB chunks"),
+        now,
+        [&](absl::Time now, absl::Duration d) { return t.TryGetTokens(now, d); },
+        [&](absl::Time now, absl::Duration d) {
+          return t.TryGetPartialTokens(now, d, chunk_bytes * kHolCostPerByte);
+        });
+  }
+  return absl::OkStatus();
+}
+
 }  // namespace mogo
 
 int main(int argc, char** argv) {
@@ -167,6 +290,8 @@ int main(int argc, char** argv) {
     status = mogo::RunBurstDemo();
   } else if (tb_type == "multi") {
     status = mogo::RunMultiDemo();
+  } else if (tb_type == "hol") {
+    status = mogo::RunHeadOfLineDemo();
   } else {
     status = absl::InvalidArgumentError(
         absl::StrCat("Uknown token bucket type: '", tb_type, "'"));
@@ -0,0 +1,51 @@
+#include "token_bucket/token_bucket_metrics.h"
+
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "absl/time/time.h"
+#include "perf/bits.h"
+
+namespace mogo {
+
+void PrintDelayHistogram(const Histogram64& h, std::ostream& s) {
+  int64_t total = 0;
+  for (int pos = 0; pos <= h.max_pos(); ++pos) {
+    total += h.value_at_pos(pos);
+  }
+  if (total == 0) {
+    return;
+  }
+  int64_t running = 0;
+  for (int pos = 0; pos <= h.max_pos(); ++pos) {
+    const int64_t v = h.value_at_pos(pos);
+    if (v == 0) {
+      continue;
+    }
+    running += v;
+    s << running * 100 / total << "% \t" << v * 100 / total << "% \t" << v
+      << "\t";
+    if (pos == 0) {
+      s << "< " << h.range_max_pos(pos) / 1000 << " us\n";
+    } else {
+      s << h.range_min_pos(pos) / 1000 << " us - "
+        << h.range_max_pos(pos) / 1000 << " us\n";
+    }
+  }
+}
+
+std::string TokenBucketMetrics::ToString(absl::Time now) const {
+  std::ostringstream s;
+  s << "admitted: " << admitted_ << " (" << admit_rate(now) << " r/s, "
+    << absl::FormatDuration(admitted_tokens_) << " tokens)\n"
+    << "delayed: " << delayed_ << " (" << delay_rate(now) << " r/s, mean "
+    << absl::FormatDuration(delayed_ == 0 ? absl::ZeroDuration()
+                                          : total_delay_ / delayed_)
+    << ")\n";
+  PrintDelayHistogram(delay_ns_, s);
+  return s.str();
+}
+
+}  // namespace mogo
@@ -0,0 +1,85 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_TOKEN_BUCKET_METRICS_H
+#define MOGO_EXP_TOKEN_BUCKET_TOKEN_BUCKET_METRICS_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "absl/time/time.h"
+#include "perf/bits.h"
+#include "stat/approx_counter.h"
+
+namespace mogo {
+
+/*
+Admission metrics for the token buckets in AbslTimeDomain, pass as the Metrics
+template argument:
+
+  BasicBurstTokenBucket<AbslTimeDomain, TokenBucketMetrics> tb(now, burst);
+  ...
+  LOG(INFO) << tb.metrics().ToString(now);
+
+Every TryGetTokens call is recorded either as an admit, with the tokens it took,
+or as a delay, with the delay handed back to the caller. Recent admit and delay
+rates are tracked with ApproxCounter, the delays go into a log histogram with
+the 1us resolution of ReplayStats. Recording costs a few additions on the admit
+path and a histogram bucket lookup on the delay path.
+
+The default NoTokenBucketMetrics, see simple_token_bucket.h, compiles out.
+
+Not thread-safe. This class is thread-compatible.
+*/
+class TokenBucketMetrics {
+ public:
+  explicit TokenBucketMetrics(absl::Time now,
+                              absl::Duration rate_interval = absl::Seconds(1))
+      : admit_rate_(now, rate_interval), delay_rate_(now, rate_interval) {}
+
+  void RecordAdmit(absl::Time now, absl::Duration tokens) {
+    ++admitted_;
+    admitted_tokens_ += tokens;
+    admit_rate_.RecordRequest(1, now);
+  }
+
+  void RecordDelay(absl::Time now, absl::Duration delay) {
+    ++delayed_;
+    total_delay_ += delay;
+    delay_rate_.RecordRequest(1, now);
+    delay_ns_.Add(absl::ToInt64Nanoseconds(delay));
+  }
+
+  int64_t admitted() const { return admitted_; }
+  int64_t delayed() const { return delayed_; }
+  absl::Duration admitted_tokens() const { return admitted_tokens_; }
+  absl::Duration total_delay() const { return total_delay_; }
+
+  // Admits and delays per second over the last rate interval.
+  double admit_rate(absl::Time now) const {
+    return admit_rate_.GetBytesPerSecond(now);
+  }
+  double delay_rate(absl::Time now) const {
+    return delay_rate_.GetBytesPerSecond(now);
+  }
+
+  // The delays handed out, in nanoseconds.
+  const Histogram64& delay_ns() const { return delay_ns_; }
+
+  std::string ToString(absl::Time now) const;
+
+ private:
+  int64_t admitted_ = 0;
+  int64_t delayed_ = 0;
+  absl::Duration admitted_tokens_;
+  absl::Duration total_delay_;
+  ApproxCounter admit_rate_;
+  ApproxCounter delay_rate_;
+  Histogram64 delay_ns_{/*min=*/1000, /*shift=*/10};
+};
+
+// Prints the non-empty buckets of a nanosecond histogram, one per line, with
+// the cumulative and bucket percentages and the range in microseconds.
+void PrintDelayHistogram(const Histogram64& h, std::ostream& s);
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_TOKEN_BUCKET_METRICS_H
@@ -0,0 +1,112 @@
+/*
+bazel test token_bucket:token_bucket_metrics_test
+*/
+
+#include "token_bucket/token_bucket_metrics.h"
+
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "token_bucket/burst_token_bucket.h"
+#include "token_bucket/clock_domain.h"
+#include "token_bucket/rate_token_bucket.h"
+#include "token_bucket/simple_token_bucket.h"
+
+namespace mogo {
+namespace {
+
+// The default metrics take no space.
+static_assert(sizeof(SimpleTokenBucket) == sizeof(absl::Time));
+static_assert(sizeof(BasicSimpleTokenBucket<NanosDomain>) == sizeof(int64_t));
+static_assert(sizeof(BasicBurstTokenBucket<NanosDomain>) ==
+              2 * sizeof(int64_t));
+
+TEST(TokenBucketMetricsTest, Simple) {
+  absl::Time now = absl::UnixEpoch();
+  BasicSimpleTokenBucket<AbslTimeDomain, TokenBucketMetrics> tb(now);
+  ASSERT_EQ(absl::ZeroDuration(), tb.TryGetTokens(now, absl::Milliseconds(2)));
+  ASSERT_EQ(absl::Milliseconds(2), tb.TryGetTokens(now, absl::Milliseconds(2)));
+  now += absl::Milliseconds(1);
+  ASSERT_EQ(absl::Milliseconds(1), tb.TryGetTokens(now, absl::Milliseconds(2)));
+  now += absl::Milliseconds(1);
+  ASSERT_EQ(absl::ZeroDuration(), tb.TryGetTokens(now, absl::Milliseconds(2)));
+
+  const TokenBucketMetrics& m = tb.metrics();
+  EXPECT_EQ(2, m.admitted());
+  EXPECT_EQ(2, m.delayed());
+  EXPECT_EQ(absl::Milliseconds(4), m.admitted_tokens());
+  EXPECT_EQ(absl::Milliseconds(3), m.total_delay());
+  EXPECT_EQ(2, m.admit_rate(now));
+  EXPECT_EQ(2, m.delay_rate(now));
+  EXPECT_EQ(0, m.admit_rate(now + absl::Seconds(10)));
+
+  // 1ms and 2ms land in neighbouring power of two buckets above 1us.
+  int64_t histogram_total = 0;
+  for (int pos = 0; pos <= m.delay_ns().max_pos(); ++pos) {
+    const int64_t v = m.delay_ns().value_at_pos(pos);
+    if (v != 0) {
+      EXPECT_EQ(1, v);
+    }
+    histogram_total += v;
+  }
+  EXPECT_EQ(2, histogram_total);
+  LOG(INFO) << m.ToString(now);
+}
+
+TEST(TokenBucketMetricsTest, Burst) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  BasicBurstTokenBucket<AbslTimeDomain, TokenBucketMetrics> tb(now, 3 * token);
+  int admitted = 0;
+  int delayed = 0;
+  absl::Duration total_delay;
+  for (int i = 0; i < 10; ++i) {
+    absl::Duration d = tb.TryGetTokens(now, token);
+    if (d == absl::ZeroDuration()) {
+      ++admitted;
+    } else {
+      ++delayed;
+      total_delay += d;
+    }
+    now += token / 2;
+  }
+  EXPECT_EQ(admitted, tb.metrics().admitted());
+  EXPECT_EQ(delayed, tb.metrics().delayed());
+  EXPECT_EQ(admitted * token, tb.metrics().admitted_tokens());
+  EXPECT_EQ(total_delay, tb.metrics().total_delay());
+  EXPECT_GT(delayed, 0);
+}
+
+// The admission path of PriorityTokenBucket.
+TEST(TokenBucketMetricsTest, BurstAboveHeadroom) {
+  absl::Time now = absl::UnixEpoch();
+  absl::Duration token = absl::Milliseconds(1);
+  BasicBurstTokenBucket<AbslTimeDomain, TokenBucketMetrics> tb(now, 4 * token);
+  ASSERT_EQ(absl::ZeroDuration(),
+            tb.TryGetTokensAboveHeadroom(now, token, 2 * token));
+  ASSERT_EQ(absl::ZeroDuration(),
+            tb.TryGetTokensAboveHeadroom(now, token, 2 * token));
+  // Two tokens left, a headroom of three has to wait for one more.
+  ASSERT_EQ(token, tb.TryGetTokensAboveHeadroom(now, token, 3 * token));
+  // The last request above a headroom of two still goes through.
+  ASSERT_EQ(absl::ZeroDuration(),
+            tb.TryGetTokensAboveHeadroom(now, token, 2 * token));
+  EXPECT_EQ(3, tb.metrics().admitted());
+  EXPECT_EQ(3 * token, tb.metrics().admitted_tokens());
+  EXPECT_EQ(1, tb.metrics().delayed());
+  EXPECT_EQ(token, tb.metrics().total_delay());
+}
+
+TEST(TokenBucketMetricsTest, Rate) {
+  absl::Time now = absl::UnixEpoch();
+  BasicRateTokenBucket<AbslTimeDomain, TokenBucketMetrics> tb(
+      now, /*refill_rate=*/1000);
+  ASSERT_EQ(absl::ZeroDuration(), tb.TryGetTokens(now, /*token_count=*/5));
+  ASSERT_NE(absl::ZeroDuration(), tb.TryGetTokens(now, /*token_count=*/5));
+  EXPECT_EQ(1, tb.metrics().admitted());
+  EXPECT_EQ(absl::Milliseconds(5), tb.metrics().admitted_tokens());
+  EXPECT_EQ(1, tb.metrics().delayed());
+}
+
+}  // namespace
+}  // namespace mogo
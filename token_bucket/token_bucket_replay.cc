@@ -0,0 +1,130 @@
+/*
+# Compare the buckets on a synthetic trace with 10M requests:
+bazel run -c opt token_bucket:token_bucket_replay -- --synthetic_events=10000000
+
+# Replay a recorded trace, one bucket per key:
+bazel run -c opt token_bucket:token_bucket_replay -- \
+  --trace=/tmp/trace.csv --per_key --refill_rate=100 --tb_type=burst
+
+# Convert a CSV trace to the binary format, which loads much faster:
+bazel run -c opt token_bucket:token_bucket_replay -- \
+  --trace=/tmp/trace.csv --write_trace=/tmp/trace.bin
+*/
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/initialize.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "token_bucket/multi_token_bucket.h"
+#include "token_bucket/trace.h"
+#include "token_bucket/trace_replay.h"
+
+ABSL_FLAG(std::string, trace, "",
+          "The trace to replay, CSV if the name ends with .csv, binary "
+          "otherwise.");
+ABSL_FLAG(int64_t, synthetic_events, 0,
+          "Replay a synthetic trace with that many requests instead of "
+          "--trace.");
+ABSL_FLAG(int64_t, synthetic_keys, 1000,
+          "The number of keys in the synthetic trace.");
+ABSL_FLAG(double, synthetic_rate, 20000,
+          "Requests per second in the synthetic trace.");
+ABSL_FLAG(std::string, write_trace, "",
+          "Write the trace in the binary format to this file and exit.");
+ABSL_FLAG(std::string, tb_type, "all",
+          "Type of rate-limiter to use, valid values are `simple`, `burst`, "
+          "`multi` and `all`");
+ABSL_FLAG(double, refill_rate, 10000, "Tokens per second of every bucket.");
+ABSL_FLAG(absl::Duration, burst, absl::Milliseconds(1),
+          "Burst of the `burst` bucket.");
+ABSL_FLAG(int, max_in_flight, mogo::MultiTokenBucket::kDefaultMaxInFlight,
+          "In-flight requests of the `multi` bucket.");
+ABSL_FLAG(bool, per_key, false,
+          "One bucket per key instead of a single shared bucket.");
+
+namespace mogo {
+
+absl::Status RunReplay() {
+  std::vector<TraceEvent> events;
+  const absl::Time load_start = absl::Now();
+  if (absl::GetFlag(FLAGS_synthetic_events) > 0) {
+    events = MakeSyntheticTrace(absl::GetFlag(FLAGS_synthetic_events),
+                                absl::GetFlag(FLAGS_synthetic_keys),
+                                absl::GetFlag(FLAGS_synthetic_rate));
+  } else {
+    absl::StatusOr<std::vector<TraceEvent>> trace =
+        ReadTrace(absl::GetFlag(FLAGS_trace));
+    if (!trace.ok()) {
+      return trace.status();
+    }
+    events = *std::move(trace);
+  }
+  LOG(INFO) << "Loaded " << events.size() << " events in "
+            << absl::Now() - load_start;
+
+  if (!absl::GetFlag(FLAGS_write_trace).empty()) {
+    return WriteBinaryTrace(absl::GetFlag(FLAGS_write_trace), events);
+  }
+
+  const int64_t key_count = DensifyKeys(absl::MakeSpan(events));
+
+  std::vector<std::pair<std::string, ReplayOptions::BucketType>> types;
+  const std::string tb_type = absl::GetFlag(FLAGS_tb_type);
+  if (tb_type == "simple" || tb_type == "all") {
+    types.push_back({"simple", ReplayOptions::BucketType::kSimple});
+  }
+  if (tb_type == "burst" || tb_type == "all") {
+    types.push_back({"burst", ReplayOptions::BucketType::kBurst});
+  }
+  if (tb_type == "multi" || tb_type == "all") {
+    types.push_back({"multi", ReplayOptions::BucketType::kMulti});
+  }
+  if (types.empty()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Uknown token bucket type: '", tb_type, "'"));
+  }
+
+  for (const auto& [name, type] : types) {
+    ReplayOptions options;
+    options.type = type;
+    options.refill_rate = absl::GetFlag(FLAGS_refill_rate);
+    options.burst = absl::GetFlag(FLAGS_burst);
+    options.max_in_flight = absl::GetFlag(FLAGS_max_in_flight);
+    options.per_key = absl::GetFlag(FLAGS_per_key);
+
+    const absl::Time start = absl::Now();
+    ReplayStats stats = ReplayTrace(events, key_count, options);
+    const absl::Duration elapsed = absl::Now() - start;
+    std::cout << "=== " << name << ", replayed in " << elapsed << ", "
+              << events.size() / absl::ToDoubleSeconds(elapsed) / 1e6
+              << "M events/s\n"
+              << stats.ToString() << std::endl;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace mogo
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  absl::InitializeLog();
+
+  absl::Status status = mogo::RunReplay();
+  if (status.ok()) {
+    return EXIT_SUCCESS;
+  } else {
+    LOG(ERROR) << status;
+    return EXIT_FAILURE;
+  }
+}
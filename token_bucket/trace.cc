@@ -0,0 +1,159 @@
+#include "token_bucket/trace.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace mogo {
+namespace {
+
+struct FileCloser {
+  void operator()(FILE* f) const { fclose(f); }
+};
+using FilePtr = std::unique_ptr<FILE, FileCloser>;
+
+absl::Status CheckSorted(absl::Span<const TraceEvent> events) {
+  for (size_t i = 1; i < events.size(); ++i) {
+    if (events[i].time_ns < events[i - 1].time_ns) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Trace is not sorted by time at event ", i));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::vector<TraceEvent>> ReadCsvTrace(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) {
+    return absl::NotFoundError(absl::StrCat("Can't open ", path));
+  }
+  std::vector<TraceEvent> events;
+  std::string line;
+  int64_t line_number = 0;
+  while (std::getline(in, line)) {
+    ++line_number;
+    absl::string_view l = absl::StripAsciiWhitespace(line);
+    if (l.empty() || l[0] == '#') {
+      continue;
+    }
+    std::vector<absl::string_view> fields = absl::StrSplit(l, ',');
+    TraceEvent e;
+    if (fields.size() != 3 ||
+        !absl::SimpleAtoi(absl::StripAsciiWhitespace(fields[0]), &e.time_ns) ||
+        !absl::SimpleAtoi(absl::StripAsciiWhitespace(fields[1]), &e.key) ||
+        !absl::SimpleAtoi(absl::StripAsciiWhitespace(fields[2]), &e.cost)) {
+      if (events.empty() && line_number == 1) {
+        // The header.
+        continue;
+      }
+      return absl::InvalidArgumentError(
+          absl::StrCat(path, ":", line_number, ": expected 3 integers"));
+    }
+    events.push_back(e);
+  }
+  return events;
+}
+
+absl::StatusOr<std::vector<TraceEvent>> ReadBinaryTrace(
+    const std::string& path) {
+  FilePtr f(fopen(path.c_str(), "rb"));
+  if (f == nullptr) {
+    return absl::NotFoundError(absl::StrCat("Can't open ", path));
+  }
+  char magic[sizeof(kTraceMagic)];
+  if (fread(magic, sizeof(magic), 1, f.get()) != 1 ||
+      memcmp(magic, kTraceMagic, sizeof(magic)) != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " is not a binary trace"));
+  }
+  fseek(f.get(), 0, SEEK_END);
+  const int64_t bytes = ftell(f.get()) - sizeof(kTraceMagic);
+  if (bytes % sizeof(TraceEvent) != 0) {
+    return absl::InvalidArgumentError(absl::StrCat(path, " is truncated"));
+  }
+  fseek(f.get(), sizeof(kTraceMagic), SEEK_SET);
+  std::vector<TraceEvent> events(bytes / sizeof(TraceEvent));
+  if (fread(events.data(), sizeof(TraceEvent), events.size(), f.get()) !=
+      events.size()) {
+    return absl::DataLossError(absl::StrCat("Failed to read ", path));
+  }
+  return events;
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<TraceEvent>> ReadTrace(const std::string& path) {
+  absl::StatusOr<std::vector<TraceEvent>> events =
+      absl::EndsWith(path, ".csv") ? ReadCsvTrace(path) : ReadBinaryTrace(path);
+  if (!events.ok()) {
+    return events;
+  }
+  if (absl::Status s = CheckSorted(*events); !s.ok()) {
+    return s;
+  }
+  return events;
+}
+
+absl::Status WriteBinaryTrace(const std::string& path,
+                              absl::Span<const TraceEvent> events) {
+  FilePtr f(fopen(path.c_str(), "wb"));
+  if (f == nullptr) {
+    return absl::PermissionDeniedError(absl::StrCat("Can't create ", path));
+  }
+  if (fwrite(kTraceMagic, sizeof(kTraceMagic), 1, f.get()) != 1 ||
+      fwrite(events.data(), sizeof(TraceEvent), events.size(), f.get()) !=
+          events.size()) {
+    return absl::DataLossError(absl::StrCat("Failed to write ", path));
+  }
+  // The buffered data is only written out by fclose.
+  if (fclose(f.release()) != 0) {
+    return absl::DataLossError(absl::StrCat("Failed to write ", path));
+  }
+  return absl::OkStatus();
+}
+
+int64_t DensifyKeys(absl::Span<TraceEvent> events) {
+  absl::flat_hash_map<uint64_t, uint64_t> index;
+  for (TraceEvent& e : events) {
+    e.key = index.try_emplace(e.key, index.size()).first->second;
+  }
+  return index.size();
+}
+
+std::vector<TraceEvent> MakeSyntheticTrace(int64_t count, int64_t key_count,
+                                           double events_per_second) {
+  absl::InsecureBitGen gen;
+  std::vector<TraceEvent> events;
+  events.reserve(count);
+  // The gaps add up from zero, a double around the start time can't hold
+  // nanoseconds.
+  constexpr int64_t kStartNs = 1000000000000000000;
+  double offset_ns = 0;
+  for (int64_t i = 0; i < count; ++i) {
+    offset_ns += absl::Exponential<double>(gen, events_per_second / 1e9);
+    events.push_back(
+        {kStartNs + static_cast<int64_t>(offset_ns),
+         absl::Zipf<uint64_t>(gen, key_count - 1),
+         absl::Bernoulli(gen, 0.01) ? 100 : 1});
+  }
+  return events;
+}
+
+}  // namespace mogo
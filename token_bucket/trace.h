@@ -0,0 +1,61 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_TRACE_H
+#define MOGO_EXP_TOKEN_BUCKET_TRACE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+
+namespace mogo {
+
+/*
+Arrival traces replayed through the token buckets by trace_replay.
+
+A trace is a sequence of requests sorted by arrival time. Two file formats are
+supported:
+  * CSV, for files with the `.csv` extension. One request per line:
+    `timestamp_ns,key,cost`. An optional header line and lines starting with `#`
+    are skipped.
+  * Binary, for everything else. The kTraceMagic header followed by packed
+    TraceEvent records in host byte order. Loads at disk speed.
+*/
+
+struct TraceEvent {
+  // Arrival time in nanoseconds since the unix epoch.
+  int64_t time_ns;
+  // The client, tenant or any other entity the requests are limited by.
+  uint64_t key;
+  // The number of tokens the request needs, for example 1 or its size in
+  // bytes.
+  int64_t cost;
+
+  friend bool operator==(const TraceEvent& a, const TraceEvent& b) {
+    return a.time_ns == b.time_ns && a.key == b.key && a.cost == b.cost;
+  }
+};
+
+inline constexpr char kTraceMagic[8] = {'T', 'B', 'T', 'R', 'A', 'C', 'E', '1'};
+
+// Reads a trace in the format matching the `path` extension.
+absl::StatusOr<std::vector<TraceEvent>> ReadTrace(const std::string& path);
+
+absl::Status WriteBinaryTrace(const std::string& path,
+                              absl::Span<const TraceEvent> events);
+
+// Replaces keys with dense indices in [0, key_count) in the order of first
+// appearance and returns key_count, so replays can keep per-key state in a
+// plain array.
+int64_t DensifyKeys(absl::Span<TraceEvent> events);
+
+// Generates `count` Poisson arrivals at `events_per_second` over `key_count`
+// keys with skewed popularity. 1% of the requests are 100 times larger than
+// the rest, the typical source of head-of-line blocking.
+std::vector<TraceEvent> MakeSyntheticTrace(int64_t count, int64_t key_count,
+                                           double events_per_second);
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_TRACE_H
@@ -0,0 +1,110 @@
+#include "token_bucket/trace_replay.h"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "perf/bits.h"
+#include "token_bucket/burst_token_bucket.h"
+#include "token_bucket/clock_domain.h"
+#include "token_bucket/multi_token_bucket.h"
+#include "token_bucket/rate_token_bucket.h"
+#include "token_bucket/token_bucket_metrics.h"
+
+namespace mogo {
+namespace {
+
+// `try_get_tokens(bucket, now_ns, cost)` returns the delay in nanoseconds.
+template <typename Bucket, typename TryGetTokens>
+ReplayStats Replay(absl::Span<const TraceEvent> events, int64_t bucket_count,
+                   bool per_key, const Bucket& initial,
+                   TryGetTokens try_get_tokens) {
+  ReplayStats stats;
+  std::vector<Bucket> buckets(bucket_count, initial);
+  // The cost of the request each bucket admitted last.
+  std::vector<int64_t> last_admitted_cost(bucket_count, 0);
+  for (const TraceEvent& e : events) {
+    const uint64_t b = per_key ? e.key : 0;
+    DCHECK_LT(b, bucket_count);
+    const int64_t delay_ns = try_get_tokens(buckets[b], e.time_ns, e.cost);
+    if (delay_ns == 0) {
+      ++stats.admitted;
+      stats.admitted_tokens += e.cost;
+      last_admitted_cost[b] = e.cost;
+    } else {
+      ++stats.rejected;
+      stats.delay_ns.Add(delay_ns);
+      if (e.cost < last_admitted_cost[b]) {
+        ++stats.head_of_line_blocked;
+        stats.head_of_line_delay_ns.Add(delay_ns);
+      }
+    }
+  }
+  stats.events = events.size();
+  if (!events.empty()) {
+    stats.duration_ns = events.back().time_ns - events.front().time_ns;
+  }
+  return stats;
+}
+
+}  // namespace
+
+std::string ReplayStats::ToString() const {
+  std::ostringstream s;
+  const double seconds = duration_ns / 1e9;
+  s << "events: " << events << " over " << seconds << "s\n"
+    << "admitted: " << admitted << " (" << admitted / seconds << " r/s, "
+    << admitted_tokens / seconds << " tokens/s)\n"
+    << "rejected: " << rejected << "\n"
+    << "head-of-line blocked: " << head_of_line_blocked << " ("
+    << (rejected == 0 ? 0 : head_of_line_blocked * 100 / rejected)
+    << "% of rejected)\n"
+    << "delays of rejected requests:\n";
+  PrintDelayHistogram(delay_ns, s);
+  s << "delays of head-of-line blocked requests:\n";
+  PrintDelayHistogram(head_of_line_delay_ns, s);
+  return s.str();
+}
+
+ReplayStats ReplayTrace(absl::Span<const TraceEvent> events, int64_t key_count,
+                        const ReplayOptions& options) {
+  const int64_t bucket_count = options.per_key ? key_count : 1;
+  const int64_t start_ns = events.empty() ? 0 : events.front().time_ns;
+  const NanosDomain::TokenCost cost_per_token =
+      NanosDomain::CostPerToken(options.refill_rate);
+  switch (options.type) {
+    case ReplayOptions::BucketType::kSimple:
+      return Replay(events, bucket_count, options.per_key,
+                    BasicRateTokenBucket<NanosDomain>(start_ns, cost_per_token),
+                    [](BasicRateTokenBucket<NanosDomain>& b, int64_t now_ns,
+                       int64_t cost) { return b.TryGetTokens(now_ns, cost); });
+    case ReplayOptions::BucketType::kBurst:
+      return Replay(
+          events, bucket_count, options.per_key,
+          BasicBurstTokenBucket<NanosDomain>(
+              start_ns, absl::ToInt64Nanoseconds(options.burst)),
+          [cost_per_token](BasicBurstTokenBucket<NanosDomain>& b,
+                           int64_t now_ns, int64_t cost) {
+            return b.TryGetTokens(now_ns,
+                                  NanosDomain::CostOf(cost_per_token, cost));
+          });
+    case ReplayOptions::BucketType::kMulti:
+      return Replay(
+          events, bucket_count, options.per_key,
+          MultiTokenBucket(absl::FromUnixNanos(start_ns),
+                           options.max_in_flight),
+          [cost_per_token](MultiTokenBucket& b, int64_t now_ns, int64_t cost) {
+            return absl::ToInt64Nanoseconds(b.TryGetTokens(
+                absl::FromUnixNanos(now_ns),
+                absl::Nanoseconds(NanosDomain::CostOf(cost_per_token, cost))));
+          });
+  }
+  LOG(FATAL) << "Unknown bucket type " << static_cast<int>(options.type);
+}
+
+}  // namespace mogo
@@ -0,0 +1,82 @@
+#ifndef MOGO_EXP_TOKEN_BUCKET_TRACE_REPLAY_H
+#define MOGO_EXP_TOKEN_BUCKET_TRACE_REPLAY_H
+
+#include <cstdint>
+#include <string>
+
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "perf/bits.h"
+#include "token_bucket/multi_token_bucket.h"
+#include "token_bucket/trace.h"
+
+namespace mogo {
+
+/*
+Replays an arrival trace through a token bucket and collects the admission
+statistics.
+
+Every request is offered to the bucket exactly once at its arrival time.
+Requests that get a delay are counted as rejected and the delay, the time the
+client would have to wait for its tokens, goes into a histogram. Rejected
+requests are not retried, so the admitted rate is the rate the bucket lets
+through from the recorded demand.
+
+A rejected request is head-of-line blocked when the last request its bucket
+admitted was larger: it waits for tokens lent to a bigger request even though
+its own cost is small. This is the delay MultiTokenBucket is meant to reduce.
+
+The replay loop runs on int64 nanoseconds (see clock_domain.h), the Simple and
+Burst replays process around 100M events per second on a single core. Multi is
+bound by the absl::Time arithmetic of MultiTokenBucket, 30-45M events per
+second, see trace_replay_benchmarks.
+*/
+
+struct ReplayOptions {
+  enum class BucketType {
+    // RateTokenBucket, no burst.
+    kSimple,
+    kBurst,
+    kMulti,
+  };
+
+  BucketType type = BucketType::kSimple;
+  // Tokens per second, of every bucket when `per_key` is set.
+  double refill_rate = 10000;
+  // kBurst only.
+  absl::Duration burst = absl::Milliseconds(1);
+  // kMulti only.
+  int max_in_flight = MultiTokenBucket::kDefaultMaxInFlight;
+  // One bucket per key instead of a single bucket shared by all keys. Requires
+  // keys in [0, key_count), see DensifyKeys.
+  bool per_key = false;
+};
+
+struct ReplayStats {
+  // Delays are bucketed by powers of two starting at 1us.
+  static constexpr uint64_t kMinDelayNs = 1000;
+  static constexpr int kDelayShift = 10;
+
+  int64_t events = 0;
+  int64_t admitted = 0;
+  int64_t admitted_tokens = 0;
+  int64_t rejected = 0;
+  int64_t head_of_line_blocked = 0;
+  // Between the first and the last arrival.
+  int64_t duration_ns = 0;
+
+  // Delays handed out to the rejected requests.
+  Histogram64 delay_ns{kMinDelayNs, kDelayShift};
+  // Delays handed out to the head-of-line blocked requests.
+  Histogram64 head_of_line_delay_ns{kMinDelayNs, kDelayShift};
+
+  std::string ToString() const;
+};
+
+// `key_count` is only used with `options.per_key`.
+ReplayStats ReplayTrace(absl::Span<const TraceEvent> events, int64_t key_count,
+                        const ReplayOptions& options);
+
+}  // namespace mogo
+
+#endif  // MOGO_EXP_TOKEN_BUCKET_TRACE_REPLAY_H
@@ -0,0 +1,63 @@
+#include <cstdint>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "token_bucket/trace.h"
+#include "token_bucket/trace_replay.h"
+
+/*
+sudo cpufreq-set -g performance
+
+bazel test -c opt --dynamic_mode=off --test_output=streamed \
+  --cache_test_results=no token_bucket:trace_replay_benchmarks \
+  --test_arg=--benchmark_filter=all \
+  --test_arg=--benchmark_repetitions=1 \
+  --test_arg=--benchmark_enable_random_interleaving=false
+
+sudo cpufreq-set -g powersave
+
+Replays a synthetic trace of 10M requests over 10K keys that offers more
+requests than the buckets admit. `items_per_second` is replayed events per
+second. The argument selects one shared bucket (0) or one bucket per key (1).
+*/
+
+namespace mogo {
+namespace {
+
+constexpr int64_t kEventCount = 10000000;
+constexpr int64_t kKeyCount = 10000;
+
+const std::vector<TraceEvent>& Trace() {
+  static const std::vector<TraceEvent>* events = [] {
+    auto* events = new std::vector<TraceEvent>(
+        MakeSyntheticTrace(kEventCount, kKeyCount, /*events_per_second=*/1e6));
+    DensifyKeys(absl::MakeSpan(*events));
+    return events;
+  }();
+  return *events;
+}
+
+void BM_Replay(benchmark::State& state, ReplayOptions::BucketType type) {
+  const std::vector<TraceEvent>& events = Trace();
+  ReplayOptions options;
+  options.type = type;
+  options.per_key = state.range(0);
+  // Per key buckets see 1/kKeyCount of the traffic on average.
+  options.refill_rate = options.per_key ? 100 : 500000;
+  for (auto s : state) {
+    benchmark::DoNotOptimize(ReplayTrace(events, kKeyCount, options));
+  }
+  state.SetItemsProcessed(state.iterations() * events.size());
+}
+BENCHMARK_CAPTURE(BM_Replay, Simple, ReplayOptions::BucketType::kSimple)
+    ->Arg(0)
+    ->Arg(1);
+BENCHMARK_CAPTURE(BM_Replay, Burst, ReplayOptions::BucketType::kBurst)
+    ->Arg(0)
+    ->Arg(1);
+BENCHMARK_CAPTURE(BM_Replay, Multi, ReplayOptions::BucketType::kMulti)
+    ->Arg(0)
+    ->Arg(1);
+
+}  // namespace
+}  // namespace mogo
@@ -0,0 +1,134 @@
+/*
+bazel test token_bucket:trace_replay_test
+*/
+
+#include "token_bucket/trace_replay.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "token_bucket/trace.h"
+
+namespace mogo {
+namespace {
+
+constexpr int64_t kMs = 1000000;
+
+TEST(TraceTest, ReadCsv) {
+  const std::string path = ::testing::TempDir() + "/trace.csv";
+  {
+    std::ofstream out(path);
+    out << "timestamp_ns,key,cost\n"
+        << "# comment\n"
+        << "100,7,1\n"
+        << "200, 9, 100\n";
+  }
+  absl::StatusOr<std::vector<TraceEvent>> events = ReadTrace(path);
+  ASSERT_TRUE(events.ok()) << events.status();
+  ASSERT_EQ(std::vector<TraceEvent>({{100, 7, 1}, {200, 9, 100}}), *events);
+
+  {
+    std::ofstream out(path);
+    out << "200,7,1\n100,7,1\n";
+  }
+  ASSERT_EQ(absl::StatusCode::kInvalidArgument, ReadTrace(path).status().code());
+  {
+    std::ofstream out(path);
+    out << "100,7,1\n200,7\n";
+  }
+  ASSERT_EQ(absl::StatusCode::kInvalidArgument, ReadTrace(path).status().code());
+}
+
+TEST(TraceTest, BinaryRoundTrip) {
+  const std::string path = ::testing::TempDir() + "/trace.bin";
+  std::vector<TraceEvent> events = MakeSyntheticTrace(1000, 10, 1000);
+  ASSERT_TRUE(WriteBinaryTrace(path, events).ok());
+  absl::StatusOr<std::vector<TraceEvent>> read = ReadTrace(path);
+  ASSERT_TRUE(read.ok()) << read.status();
+  ASSERT_EQ(events, *read);
+  ASSERT_EQ(absl::StatusCode::kNotFound,
+            ReadTrace(path + ".missing").status().code());
+}
+
+TEST(TraceTest, SyntheticRate) {
+  for (double rate : {1e6, 1e8}) {
+    std::vector<TraceEvent> events =
+        MakeSyntheticTrace(/*count=*/1000000, /*key_count=*/10, rate);
+    const double achieved = (events.size() - 1) * 1e9 /
+                            (events.back().time_ns - events.front().time_ns);
+    EXPECT_NEAR(achieved, rate, rate * 0.01);
+  }
+}
+
+TEST(TraceTest, DensifyKeys) {
+  std::vector<TraceEvent> events = {{1, 42, 1}, {2, 7, 1}, {3, 42, 1}};
+  ASSERT_EQ(2, DensifyKeys(absl::MakeSpan(events)));
+  ASSERT_EQ(0, events[0].key);
+  ASSERT_EQ(1, events[1].key);
+  ASSERT_EQ(0, events[2].key);
+}
+
+TEST(TraceReplayTest, Simple) {
+  // 1000 tokens per second, one token per millisecond.
+  ReplayOptions options;
+  options.refill_rate = 1000;
+  std::vector<TraceEvent> events = {
+      {0, 0, 5},                 // Admitted, the bucket is at zero at 5ms.
+      {1 * kMs, 0, 1},           // 4ms delay, head-of-line blocked.
+      {5 * kMs, 0, 1},           // Admitted.
+      {5 * kMs + kMs / 2, 0, 1}  // 0.5ms delay.
+  };
+  ReplayStats stats = ReplayTrace(events, /*key_count=*/1, options);
+  ASSERT_EQ(4, stats.events);
+  ASSERT_EQ(2, stats.admitted);
+  ASSERT_EQ(6, stats.admitted_tokens);
+  ASSERT_EQ(2, stats.rejected);
+  ASSERT_EQ(1, stats.head_of_line_blocked);
+  ASSERT_EQ(5 * kMs + kMs / 2, stats.duration_ns);
+  // 4ms is in [1us + 2^21ns, 1us + 2^22ns).
+  ASSERT_EQ(1, stats.head_of_line_delay_ns.value_at_pos(13));
+}
+
+TEST(TraceReplayTest, PerKey) {
+  ReplayOptions options;
+  options.refill_rate = 1000;
+  options.per_key = true;
+  std::vector<TraceEvent> events = {{0, 0, 5}, {1 * kMs, 1, 1}};
+  ASSERT_EQ(2, ReplayTrace(events, /*key_count=*/2, options).admitted);
+  options.per_key = false;
+  ASSERT_EQ(1, ReplayTrace(events, /*key_count=*/2, options).admitted);
+}
+
+// Over a long trace every bucket type admits tokens at the refill rate, and
+// spreading large requests reduces head-of-line blocking.
+TEST(TraceReplayTest, AllTypesAdmitAtRefillRate) {
+  std::vector<TraceEvent> events =
+      MakeSyntheticTrace(/*count=*/1000000, /*key_count=*/100,
+                         /*events_per_second=*/20000);
+  ReplayOptions options;
+  options.refill_rate = 15000;
+  int64_t hol[3];
+  for (ReplayOptions::BucketType type :
+       {ReplayOptions::BucketType::kSimple, ReplayOptions::BucketType::kBurst,
+        ReplayOptions::BucketType::kMulti}) {
+    options.type = type;
+    ReplayStats stats = ReplayTrace(events, /*key_count=*/1, options);
+    ASSERT_EQ(stats.events, stats.admitted + stats.rejected);
+    const double tokens_per_second =
+        stats.admitted_tokens / (stats.duration_ns / 1e9);
+    ASSERT_LE(tokens_per_second, options.refill_rate * 1.01);
+    ASSERT_GE(tokens_per_second, options.refill_rate * 0.6);
+    hol[static_cast<int>(type)] = stats.head_of_line_blocked;
+  }
+  ASSERT_LT(hol[static_cast<int>(ReplayOptions::BucketType::kMulti)],
+            hol[static_cast<int>(ReplayOptions::BucketType::kSimple)]);
+}
+
+}  // namespace
+}  // namespace mogo